@@ -7,11 +7,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/InstanceBuffer.h>
+#include <rg/Lod.h>
+#include <rg/VertexFormat.h>
 
 #include <string>
 #include <vector>
 using namespace std;
 
+// the vertex as imported and cached; on the GPU it is packed by rg::VertexLayout::active()
 struct Vertex {
     // position
     glm::vec3 Position;
@@ -41,29 +46,118 @@ public:
     vector<Texture>      textures;
 
     unsigned int VAO;
+    // indices of level 0, the full mesh
+    unsigned int indexCount;
+    // index ranges of the levels of detail, level 0 first; all of them are in the one index buffer
+    vector<rg::MeshLod> lods;
+    // GPU memory of the buffers, the vertices in the rg::VertexLayout they were uploaded with
+    size_t vertexCount = 0;
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+    // object space bounds, computed at import
+    rg::AABB bounds;
+    rg::BoundingSphere sphere;
     std::string glslIdentifierPrefix;
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, vector<rg::MeshLod> lods = {})
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->lods = lods;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+    }
+    // uploads the data straight from the given memory (e.g. a memory mapped mesh cache) without
+    // keeping a CPU copy, so `vertices` and `indices` stay empty for meshes built this way.
+    Mesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, vector<Texture> textures,
+         vector<rg::MeshLod> lods = {})
+    {
+        this->textures = textures;
+        this->lods = lods;
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
     }
 
-    // render the mesh
+    // render the mesh. Leaves the VAO and the textures bound, the next draw rebinds what it needs.
     void Draw(Shader &shader)
     {
+        bindTextures(shader);
+
+        // draw mesh
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    }
+
+    // render one copy of the mesh per transform in `instances`, in a single draw call.
+    // The shader takes the model matrix from the instance attribute instead of the `model` uniform.
+    void DrawInstanced(Shader &shader, const rg::InstanceBuffer &instances)
+    {
+        if (instances.count() == 0)
+            return;
+        bindTextures(shader);
+
+        glBindVertexArray(VAO);
+        AttachInstances(instances);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instances.count());
+    }
+
+    // location of the sampler for each entry of `textures` in `shader`, -1 where it has none
+    const vector<GLint> &SamplerLocations(Shader &shader)
+    {
+        // resolved once per shader (and prefix), not per draw
+        const rg::UniformTable &uniforms = shader.uniformTable();
+        if (&uniforms != samplerTable || uniforms.generation() != samplerGeneration || glslIdentifierPrefix != samplerPrefix)
+            resolveSamplers(uniforms);
+        return samplerLocations;
+    }
+
+    // points the instance attributes at `instances`; the VAO has to be bound
+    void AttachInstances(const rg::InstanceBuffer &instances)
+    {
+        // the instance attributes are VAO state, so they only change with the buffer
+        if (attachedInstanceBuffer != instances.buffer())
+        {
+            instances.attach();
+            attachedInstanceBuffer = instances.buffer();
+        }
+    }
+
+private:
+    // render data
+    unsigned int VBO, AttributeVBO, EBO;
+
+    // location of the sampler for each texture in the shader that drew the mesh last
+    vector<GLint> samplerLocations;
+    const rg::UniformTable *samplerTable = nullptr;
+    unsigned int samplerGeneration = 0;
+    std::string samplerPrefix;
+    // instance buffer the VAO's instance attributes point at
+    unsigned int attachedInstanceBuffer = 0;
+
+    void bindTextures(Shader &shader)
+    {
+        const vector<GLint> &samplers = SamplerLocations(shader);
         // bind appropriate textures
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+            // now set the sampler to the correct texture unit
+            glUniform1i(samplers[i], i);
+            // and finally bind the texture
+            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    void resolveSamplers(const rg::UniformTable &uniforms)
+    {
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        samplerLocations.clear();
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -75,63 +169,45 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplerLocations.push_back(uniforms.location(glslIdentifierPrefix + name + number));
         }
-
-
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        samplerTable = &uniforms;
+        samplerGeneration = uniforms.generation();
+        samplerPrefix = glslIdentifierPrefix;
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
-
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
     {
+        // without levels of detail the whole index buffer is level 0
+        if (lods.empty())
+            lods.push_back({0, (uint32_t)indexCount, 0.0f});
+        this->indexCount = lods[0].indexCount;
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
+        glGenBuffers(1, &AttributeVBO);
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
-        // load data into vertex buffers
+        // positions and the other attributes go to separate buffers, in the formats of the active layout
+        const rg::VertexLayout &layout = rg::VertexLayout::active();
+        vector<unsigned char> positions, attributes;
+        layout.pack(vertexData, vertexCount, positions, attributes);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, positions.size(), positions.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, AttributeVBO);
+        glBufferData(GL_ARRAY_BUFFER, attributes.size(), attributes.data(), GL_STATIC_DRAW);
+        this->vertexCount = vertexCount;
+        vertexBytes = positions.size() + attributes.size();
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+        indexBytes = indexCount * sizeof(unsigned int);
 
         // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        layout.setAttributes(VBO, AttributeVBO);
 
         glBindVertexArray(0);
     }
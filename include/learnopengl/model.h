@@ -12,32 +12,143 @@
 
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
+#include <rg/MeshCache.h>
+#include <rg/Simplify.h>
+#include <rg/TextureCache.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
 #include <map>
+#include <memory>
+#include <thread>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
-
+// result of the CPU phase of model loading (Model::Import), everything the GL phase (Model::Upload) needs.
+struct ModelData
+{
+    string path;
+    string directory;
+    bool loaded = false;
+    // set when the mesh cache matched; the GL phase then uploads straight from the mapping
+    std::unique_ptr<rg::MeshCacheFile> cache;
+    // one entry per mesh. On a cache hit only the texture references are filled in
+    vector<rg::MeshData> meshes;
+
+    // time spent in the CPU phase, in milliseconds
+    double importMs = 0.0;
+    std::thread::id worker;
+};
 
 class Model
 {
 public:
     // model data
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
     string directory;
+    // object space bounds of all meshes
+    rg::AABB bounds;
     bool gammaCorrection;
 
+    Model() : gammaCorrection(false) {}
+
     // constructor, expects a filepath to a 3D model.
     Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
     {
-        loadModel(path);
+        ModelData data = Import(path);
+        Upload(data);
+    }
+
+    // CPU phase of loading: reads the mesh cache (or imports with ASSIMP on a miss) and queues the
+    // referenced textures on the shared texture cache. Doesn't touch OpenGL, so it runs on worker threads.
+    static ModelData Import(string const &path)
+    {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+
+        ModelData data;
+        data.worker = std::this_thread::get_id();
+        readMeshes(path, data);
+
+        // start decoding the textures now, they finish while other models are still importing
+        for (const rg::MeshData &mesh : data.meshes)
+        {
+            for (const rg::TextureRef &ref : mesh.textures)
+                rg::TextureCache::instance().prefetch(data.directory + '/' + ref.path);
+        }
+
+        data.importMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        return data;
+    }
+
+    // reads the meshes and texture references of a model from the mesh cache (or ASSIMP on a miss),
+    // without queueing any textures. Doesn't touch OpenGL.
+    static void readMeshes(string const &path, ModelData &data)
+    {
+        data.path = path;
+        // retrieve the directory path of the filepath
+        data.directory = path.substr(0, path.find_last_of('/'));
+
+        uint64_t hash = rg::meshSourceHash(data.path);
+        std::unique_ptr<rg::MeshCacheFile> cache(new rg::MeshCacheFile);
+        if (hash && cache->open(rg::meshCachePath(data.path), hash))
+        {
+            const rg::MeshCacheHeader &header = cache->header();
+            data.meshes.resize(header.meshCount);
+            for (uint32_t i = 0; i < header.meshCount; i++)
+            {
+                const rg::MeshCacheEntry &entry = cache->entries()[i];
+                for (uint32_t j = 0; j < entry.textureCount; j++)
+                {
+                    const rg::MeshCacheTextureRef &ref = cache->textureRefs()[entry.firstTexture + j];
+                    data.meshes[i].textures.push_back({cache->string(ref.typeOffset), cache->string(ref.pathOffset)});
+                }
+            }
+            data.cache = std::move(cache);
+            data.loaded = true;
+        }
+        else if (importModel(data.path, data.meshes))
+        {
+            if (hash && !rg::writeMeshCache(rg::meshCachePath(data.path), hash, data.meshes))
+                cout << "WARNING::MESH_CACHE:: can't write " << rg::meshCachePath(data.path) << endl;
+            data.loaded = true;
+        }
+    }
+
+    // GL phase of loading: creates the buffers and textures. Must run on the thread owning the context.
+    void Upload(ModelData &data)
+    {
+        directory = data.directory;
+        if (!data.loaded)
+            return;
+        meshes.reserve(meshes.size() + data.meshes.size());
+        for (size_t i = 0; i < data.meshes.size(); i++)
+        {
+            rg::MeshData &mesh = data.meshes[i];
+            vector<Texture> textures = loadMaterialTextures(mesh.textures);
+            if (data.cache)
+            {
+                const rg::MeshCacheEntry &entry = data.cache->entries()[i];
+                meshes.push_back(Mesh(data.cache->vertices() + entry.firstVertex, entry.vertexCount,
+                                      data.cache->indices() + entry.firstIndex, entry.indexCount,
+                                      textures, rg::entryLods(entry)));
+                rg::entryBounds(entry, meshes.back().bounds, meshes.back().sphere);
+            }
+            else
+            {
+                meshes.push_back(Mesh(std::move(mesh.vertices), std::move(mesh.indices), textures, std::move(mesh.lods)));
+                meshes.back().bounds = mesh.bounds;
+                meshes.back().sphere = mesh.sphere;
+            }
+            bounds.expand(meshes.back().bounds);
+        }
+        // the mapping isn't needed once the meshes are in GL memory
+        data.cache.reset();
     }
 
     // draws the model, and thus all its meshes
@@ -47,14 +158,44 @@ public:
             meshes[i].Draw(shader);
     }
 
+    // draws every mesh once per transform in `instances`, one draw call per mesh
+    void DrawInstanced(Shader &shader, const rg::InstanceBuffer &instances)
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].DrawInstanced(shader, instances);
+    }
+
+    // GPU memory of the vertex buffers in the layout they were uploaded with, and as float Vertex
+    size_t VertexBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.vertexBytes;
+        return bytes;
+    }
+    size_t FloatVertexBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.vertexCount * sizeof(Vertex);
+        return bytes;
+    }
+    size_t IndexBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.indexBytes;
+        return bytes;
+    }
+
     void SetShaderTextureNamePrefix(std::string prefix) {
         for (Mesh& mesh: meshes) {
             mesh.glslIdentifierPrefix = prefix;
         }
     }
-private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+
+    // reads the model with ASSIMP into CPU side meshes. Doesn't touch OpenGL, so it can run without a context.
+    static bool importModel(string const &path, vector<rg::MeshData> &meshes)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
@@ -63,17 +204,53 @@ private:
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return false;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        processNode(scene->mRootNode, scene, meshes);
+        return true;
     }
 
+    // replaces placeholder texture names (files that turned out to duplicate another one while
+    // loading) with the textures they stand for. Call once the texture cache has finished. GL thread only.
+    void resolveTextures()
+    {
+        const rg::TextureCache &cache = rg::TextureCache::instance();
+        for (Mesh &mesh : meshes)
+        {
+            for (Texture &texture : mesh.textures)
+                texture.id = cache.resolve(texture.id);
+        }
+    }
+
+    // offline bake step: imports the model and (re)writes its binary mesh cache next to the source file.
+    // `optimization` (if given) gets the vertex cache stats of all meshes before and after optimizing.
+    static bool bakeMeshCache(string const &path, rg::MeshOptimization *optimization = nullptr)
+    {
+        uint64_t hash = rg::meshSourceHash(path);
+        if (!hash)
+        {
+            cout << "ERROR::MESH_CACHE:: can't read " << path << endl;
+            return false;
+        }
+        vector<rg::MeshData> meshes;
+        if (!importModel(path, meshes))
+            return false;
+        if (optimization)
+        {
+            for (const rg::MeshData &mesh : meshes)
+                optimization->add(mesh.optimization);
+        }
+        if (!rg::writeMeshCache(rg::meshCachePath(path), hash, meshes))
+        {
+            cout << "ERROR::MESH_CACHE:: can't write " << rg::meshCachePath(path) << endl;
+            return false;
+        }
+        return true;
+    }
+private:
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    static void processNode(aiNode *node, const aiScene *scene, vector<rg::MeshData> &meshes)
     {
         // process each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -86,18 +263,19 @@ private:
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, meshes);
         }
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    static rg::MeshData processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
-
+        rg::MeshData data;
+        vector<Vertex> &vertices = data.vertices;
+        vector<unsigned int> &indices = data.indices;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
@@ -151,6 +329,11 @@ private:
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
+        // welded and reordered for the vertex cache, overdraw and vertex fetch
+        data.optimization = rg::optimizeMesh(vertices, indices);
+        rg::computeBounds(vertices.data(), vertices.size(), data.bounds, data.sphere);
+        // simplified levels of detail, appended to the indices
+        data.lods = rg::generateLods(vertices, indices);
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -159,58 +342,42 @@ private:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
-        aiColor3D color(0.0f, 0.0f, 0.0f);
-        material->Get(AI_MATKEY_COLOR_AMBIENT, color);
-
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        collectMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
+        collectMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", data.textures);
 
-
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // records the texture paths of a given type, they are resolved to GL textures in loadMaterialTextures.
+    static void collectMaterialTextures(aiMaterial *mat, aiTextureType type, const string &typeName, vector<rg::TextureRef> &textures)
     {
-        vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back({typeName, str.C_Str()});
+        }
+    }
+
+    // resolves the texture references through the process-wide texture cache, so a file used by several
+    // meshes or models is decoded and uploaded only once. The pixels may still be on their way.
+    vector<Texture> loadMaterialTextures(const vector<rg::TextureRef> &refs)
+    {
+        vector<Texture> textures;
+        for(const rg::TextureRef &ref : refs)
+        {
+            Texture texture;
+            texture.id = rg::TextureCache::instance().acquire(this->directory + '/' + ref.path);
+            texture.type = ref.type;
+            texture.path = ref.path;
+            textures.push_back(texture);
         }
         return textures;
     }
@@ -222,38 +389,7 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    // decoded on the worker pool and streamed in through the PBO ring by the texture cache
+    return rg::TextureCache::instance().acquire(filename);
 }
 #endif
@@ -9,19 +9,159 @@
 #include <sstream>
 #include <iostream>
 #include <common.h>
+#include <rg/Uniform.h>
+#include <rg/UniformBuffer.h>
+
+#include <memory>
+#include <vector>
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly. `defines` (e.g. "#define ALPHA_TEST\n") goes
+    // right after the #version line of every stage, so one file can build several variants.
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const char* defines = nullptr)
+        : vertexFile(vertexPath), fragmentFile(fragmentPath), geometryFile(geometryPath ? geometryPath : ""),
+          defineLines(defines ? defines : "")
+    {
+        bool success = true;
+        ID = build(success);
+        // shared blocks (camera, lights) come from the fixed binding points
+        rg::bindUniformBlocks(ID);
+        // look every active uniform up once, the setters below only hit the table
+        uniforms->reflect(ID);
+    }
+    // builds the program again from its files. If every stage compiles and it links, the new program
+    // replaces ID: uniform handles are re-resolved and the values set on the old program are carried
+    // over. Otherwise the old program stays and this returns false. GL thread only, between frames;
+    // copies of this Shader keep the old (deleted) ID.
+    // ------------------------------------------------------------------------
+    bool reload()
+    {
+        bool success = true;
+        unsigned int program = build(success);
+        if (!success)
+        {
+            glDeleteProgram(program);
+            return false;
+        }
+        rg::bindUniformBlocks(program);
+        std::vector<rg::UniformTable::Entry> previous = uniforms->entries();
+        uniforms->reflect(program);
+        GLint current = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+        glUseProgram(program);
+        for (const rg::UniformTable::Entry &entry : uniforms->entries())
+        {
+            for (const rg::UniformTable::Entry &old : previous)
+            {
+                if (old.type == entry.type && old.name == entry.name)
+                {
+                    rg::copyUniform(ID, old.location, entry.location, entry.type);
+                    break;
+                }
+            }
+        }
+        glUseProgram((GLuint)current == ID ? program : (GLuint)current);
+        glDeleteProgram(ID);
+        ID = program;
+        return true;
+    }
+    // true if `path` is one of the files the program is built from
+    bool readsFile(const std::string &path) const
+    {
+        return path == vertexFile || path == fragmentFile || path == geometryFile;
+    }
+    // activate the shader
+    // ------------------------------------------------------------------------
+    void use() 
+    { 
+        glUseProgram(ID); 
+    }
+    // typed handle to a uniform, resolve it once at setup and set it every frame without any lookup
+    // ------------------------------------------------------------------------
+    template<typename T>
+    rg::Uniform<T> uniform(const std::string &name)
+    {
+        return rg::Uniform<T>(uniforms.get(), uniforms->bind(name));
+    }
+    const rg::UniformTable &uniformTable() const
+    {
+        return *uniforms;
+    }
+    // utility uniform functions
+    // ------------------------------------------------------------------------
+    void setBool(const std::string &name, bool value) const
+    {         
+        glUniform1i(uniforms->location(name), (int)value); 
+    }
+    // ------------------------------------------------------------------------
+    void setInt(const std::string &name, int value) const
+    { 
+        glUniform1i(uniforms->location(name), value); 
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(const std::string &name, float value) const
+    { 
+        glUniform1f(uniforms->location(name), value); 
+    }
+    // ------------------------------------------------------------------------
+    void setVec2(const std::string &name, const glm::vec2 &value) const
+    { 
+        glUniform2fv(uniforms->location(name), 1, &value[0]); 
+    }
+    void setVec2(const std::string &name, float x, float y) const
+    { 
+        glUniform2f(uniforms->location(name), x, y); 
+    }
+    // ------------------------------------------------------------------------
+    void setVec3(const std::string &name, const glm::vec3 &value) const
+    { 
+        glUniform3fv(uniforms->location(name), 1, &value[0]); 
+    }
+    void setVec3(const std::string &name, float x, float y, float z) const
+    { 
+        glUniform3f(uniforms->location(name), x, y, z); 
+    }
+    // ------------------------------------------------------------------------
+    void setVec4(const std::string &name, const glm::vec4 &value) const
+    { 
+        glUniform4fv(uniforms->location(name), 1, &value[0]); 
+    }
+    void setVec4(const std::string &name, float x, float y, float z, float w) 
+    { 
+        glUniform4f(uniforms->location(name), x, y, z, w); 
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(uniforms->location(name), 1, GL_FALSE, &mat[0][0]);
+    }
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    {
+        glUniformMatrix3fv(uniforms->location(name), 1, GL_FALSE, &mat[0][0]);
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        std::string vertexPathString(vertexPath);
-        std::string fragmentPathString(fragmentPath);
+        glUniformMatrix4fv(uniforms->location(name), 1, GL_FALSE, &mat[0][0]);
+    }
+
+private:
+    // shared by copies of the Shader, they refer to the same program
+    std::shared_ptr<rg::UniformTable> uniforms = std::make_shared<rg::UniformTable>();
+    // what the program is built from, kept for reload(); no geometry stage if empty
+    std::string vertexFile, fragmentFile, geometryFile;
+    std::string defineLines;
 
-        vertexPath = vertexPathString.c_str();
-        fragmentPath= fragmentPathString.c_str();
+    // reads, compiles and links the stages into a new program, `success` is cleared if any step fails
+    // ------------------------------------------------------------------------
+    unsigned int build(bool &success)
+    {
+        const bool geometryStage = !geometryFile.empty();
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -36,8 +176,8 @@ public:
         try 
         {
             // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
+            vShaderFile.open(vertexFile);
+            fShaderFile.open(fragmentFile);
             std::stringstream vShaderStream, fShaderStream;
             // read file's buffer contents into streams
             vShaderStream << vShaderFile.rdbuf();
@@ -49,11 +189,9 @@ public:
             vertexCode = vShaderStream.str();
             fragmentCode = fShaderStream.str();			
             // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
+            if(geometryStage)
             {
-                std::string geometryPathString(geometryPath);
-                geometryPath = geometryPathString.c_str();
-                gShaderFile.open(geometryPath);
+                gShaderFile.open(geometryFile);
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
@@ -63,6 +201,13 @@ public:
         catch (std::ifstream::failure& e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            success = false;
+        }
+        if (!defineLines.empty())
+        {
+            vertexCode = insertDefines(vertexCode, defineLines.c_str());
+            fragmentCode = insertDefines(fragmentCode, defineLines.c_str());
+            geometryCode = insertDefines(geometryCode, defineLines.c_str());
         }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
@@ -72,106 +217,55 @@ public:
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        success &= checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        success &= checkCompileErrors(fragment, "FRAGMENT");
         // if geometry shader is given, compile geometry shader
         unsigned int geometry;
-        if(geometryPath != nullptr)
+        if(geometryStage)
         {
             const char * gShaderCode = geometryCode.c_str();
             geometry = glCreateShader(GL_GEOMETRY_SHADER);
             glShaderSource(geometry, 1, &gShaderCode, NULL);
             glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            success &= checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        if(geometryStage)
+            glAttachShader(program, geometry);
+        glLinkProgram(program);
+        success &= checkCompileErrors(program, "PROGRAM");
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-        if(geometryPath != nullptr)
+        if(geometryStage)
             glDeleteShader(geometry);
-
-    }
-    // activate the shader
-    // ------------------------------------------------------------------------
-    void use() 
-    { 
-        glUseProgram(ID); 
-    }
-    // utility uniform functions
-    // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
-    {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
-    }
-    // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
-    { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
-    }
-    // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
-    { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
-    }
-    // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
-    { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
-    }
-    void setVec2(const std::string &name, float x, float y) const
-    { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
-    }
-    // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
-    { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
-    }
-    void setVec3(const std::string &name, float x, float y, float z) const
-    { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
-    }
-    // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
-    { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
-    }
-    void setVec4(const std::string &name, float x, float y, float z, float w) 
-    { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
-    }
-    // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
-    {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-    // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
-    {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        return program;
     }
+
+    // source with `defines` after its #version line (GLSL wants #version first)
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    static std::string insertDefines(const std::string &code, const char *defines)
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        if (code.empty())
+            return code;
+        size_t line = code.compare(0, 8, "#version") == 0 ? code.find('\n') : 0;
+        if (line == std::string::npos)
+            return code + "\n" + defines;
+        if (line != 0)
+            line++;
+        return code.substr(0, line) + defines + code.substr(line);
     }
 
-private:
-    // utility function for checking shader compilation/linking errors.
+    // utility function for checking shader compilation/linking errors, false if there were any.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -193,6 +287,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
 #endif
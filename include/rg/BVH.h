@@ -0,0 +1,117 @@
+//
+// Bounding volume hierarchy over the world space boxes of placed objects.
+//
+// Built top-down by splitting at the median of the longest axis of the centroid bounds. Nodes
+// are stored depth-first in one array, so a subtree is a contiguous range of nodes and objects.
+// The frustum query skips whole subtrees that are outside and stops testing below a node that is
+// fully inside.
+//
+
+#ifndef PROJECT_BASE_BVH_H
+#define PROJECT_BASE_BVH_H
+
+#include <rg/Bounds.h>
+#include <rg/Frustum.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+// per-frame culling counters
+struct CullStats {
+    unsigned int objects = 0;
+    unsigned int objectsVisible = 0;
+    unsigned int meshes = 0;       // meshes of visible, non-instanced objects
+    unsigned int meshesCulled = 0;
+    unsigned int tests = 0;        // box/frustum tests, BVH nodes included
+};
+
+class BVH {
+public:
+    static const unsigned int kLeafSize = 4;
+
+    // `boxes[i]` is the world space box of object i; queries return these indices
+    void build(const std::vector<AABB>& boxes) {
+        m_Nodes.clear();
+        m_Objects.resize(boxes.size());
+        for (uint32_t i = 0; i < boxes.size(); ++i)
+            m_Objects[i] = i;
+        m_Boxes = boxes;
+        if (!boxes.empty())
+            buildNode(0, (uint32_t)boxes.size());
+    }
+
+    size_t objectCount() const {
+        return m_Objects.size();
+    }
+
+    // appends the objects that are at least partly inside `frustum` to `visible`.
+    // Returns the number of box tests done.
+    unsigned int query(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+        unsigned int tests = 0;
+        uint32_t node = 0;
+        while (node < m_Nodes.size()) {
+            const Node& n = m_Nodes[node];
+            tests++;
+            Containment containment = frustum.test(n.bounds);
+            if (containment == Containment::Outside) {
+                node = n.skip;
+                continue;
+            }
+            if (containment == Containment::Inside || n.count <= kLeafSize) {
+                for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                    // leaves still test their objects, a fully inside subtree doesn't have to
+                    if (containment == Containment::Inside || (++tests, frustum.visible(m_Boxes[m_Objects[i]])))
+                        visible.push_back(m_Objects[i]);
+                }
+                node = n.skip;
+                continue;
+            }
+            node++; // first child follows its parent
+        }
+        return tests;
+    }
+
+private:
+    struct Node {
+        AABB bounds;
+        uint32_t first; // range in m_Objects
+        uint32_t count;
+        uint32_t skip;  // next node when this subtree is done
+    };
+
+    std::vector<Node> m_Nodes;
+    std::vector<uint32_t> m_Objects;
+    std::vector<AABB> m_Boxes;
+
+    void buildNode(uint32_t first, uint32_t count) {
+        uint32_t index = m_Nodes.size();
+        m_Nodes.push_back(Node());
+        AABB bounds, centroids;
+        for (uint32_t i = first; i < first + count; ++i) {
+            bounds.expand(m_Boxes[m_Objects[i]]);
+            centroids.expand(m_Boxes[m_Objects[i]].center());
+        }
+        if (count > kLeafSize) {
+            glm::vec3 size = centroids.max - centroids.min;
+            int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+            uint32_t middle = first + count / 2;
+            std::nth_element(m_Objects.begin() + first, m_Objects.begin() + middle, m_Objects.begin() + first + count,
+                             [&](uint32_t a, uint32_t b) {
+                                 return m_Boxes[a].center()[axis] < m_Boxes[b].center()[axis];
+                             });
+            buildNode(first, middle - first);
+            buildNode(middle, first + count - middle);
+        }
+        Node& node = m_Nodes[index];
+        node.bounds = bounds;
+        node.first = first;
+        node.count = count;
+        node.skip = m_Nodes.size();
+    }
+};
+
+};
+#endif //PROJECT_BASE_BVH_H
@@ -0,0 +1,483 @@
+//
+// Frame time benchmarks.
+//
+// A benchmark replays a CameraPath with a fixed time step, so every run draws exactly the same
+// frames whatever the machine, and records for each frame:
+//   cpu    time spent issuing it, from the start of the loop to just before the swap (or glFinish)
+//   gpu    time between two GL_TIMESTAMP queries around it. Timestamps instead of a GL_TIME_ELAPSED
+//          query, which can't nest and is already used by the shadow cascades. The results are
+//          read kGpuTimerLatency frames later if they are available by then, nothing waits for
+//          them; a frame whose results are late has no GPU time and is counted in gpuMissed().
+//          While the CPU is the bottleneck this includes the GPU waiting for commands.
+//   frame  wall time from its start to the start of the next one, swap or glFinish included
+// The summary of each has min, max, mean, p50/p95/p99 and a histogram over frame budget buckets.
+// It is written as JSON, every frame as CSV. compareBenchmarks() reads two JSON summaries and
+// flags every value that got more than kRegressionThreshold slower. Built with RG_GL_STATS, the
+// GL calls of every frame (GLStats.h) are recorded too, their averages go into the summary.
+//
+
+#ifndef PROJECT_BASE_BENCHMARK_H
+#define PROJECT_BASE_BENCHMARK_H
+
+#include <glad/glad.h>
+#include <rg/GLState.h>
+#include <rg/GLStats.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// simulated seconds per frame when the frame count comes from the path
+const float kBenchmarkTimeStep = 1.0f / 60.0f;
+// frames between issuing a GPU timer and reading it
+const int kGpuTimerLatency = 3;
+// slower by more than this fraction (and by more than kRegressionMinMs) is a regression
+const double kRegressionThreshold = 0.05;
+const double kRegressionMinMs = 0.05;
+
+const int kHistogramBuckets = 16;
+// upper edges (ms) of the histogram buckets, the last bucket holds everything above
+const double kHistogramEdgesMs[kHistogramBuckets - 1] = {1.0,  2.0,  4.0,  6.0,  8.0,  10.0,  12.0, 14.0,
+                                                         16.7, 20.0, 25.0, 33.3, 50.0, 100.0, 200.0};
+
+struct TimeStats {
+    size_t samples = 0;
+    double min = 0.0, max = 0.0, mean = 0.0;
+    double p50 = 0.0, p95 = 0.0, p99 = 0.0;
+    unsigned int histogram[kHistogramBuckets] = {};
+
+    // of the values in `ms` that aren't negative (negative ones were never measured)
+    static TimeStats of(const std::vector<double>& ms) {
+        TimeStats stats;
+        std::vector<double> sorted;
+        for (double value : ms)
+            if (value >= 0.0)
+                sorted.push_back(value);
+        if (sorted.empty())
+            return stats;
+        std::sort(sorted.begin(), sorted.end());
+        stats.samples = sorted.size();
+        stats.min = sorted.front();
+        stats.max = sorted.back();
+        double sum = 0.0;
+        for (double value : sorted) {
+            sum += value;
+            int bucket = 0;
+            while (bucket < kHistogramBuckets - 1 && value > kHistogramEdgesMs[bucket])
+                bucket++;
+            stats.histogram[bucket]++;
+        }
+        stats.mean = sum / sorted.size();
+        stats.p50 = percentile(sorted, 0.50);
+        stats.p95 = percentile(sorted, 0.95);
+        stats.p99 = percentile(sorted, 0.99);
+        return stats;
+    }
+
+private:
+    // nearest rank
+    static double percentile(const std::vector<double>& sorted, double fraction) {
+        size_t rank = (size_t)std::ceil(fraction * sorted.size());
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+};
+
+struct BenchmarkFrame {
+    float time;           // on the path
+    double cpuMs = 0.0;
+    double gpuMs = -1.0;  // -1 until the timer is read, without timer queries or when it was late
+    double frameMs = -1.0;
+    unsigned int draws = 0;
+    unsigned int triangles = 0;
+    GLCallStats calls;    // all zero without RG_GL_STATS
+};
+
+// what the run was, for the report and the files
+struct BenchmarkInfo {
+    std::string scene;
+    std::string path;
+    std::string renderer;
+    unsigned int width = 0, height = 0;
+    float timeStep = 0.0f;
+    uint64_t checksum = 0; // of the last image, 0 when there is none
+};
+
+class BenchmarkRecorder {
+public:
+    // call with the context current, before the first frame
+    void create() {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        if (bits > 0 && !m_Slots[0].queries[0]) {
+            for (Slot& slot : m_Slots)
+                glGenQueries(2, slot.queries);
+        }
+        m_Frames.clear();
+        m_GpuMissed = 0;
+    }
+
+    // call before the context is destroyed
+    void release() {
+        for (Slot& slot : m_Slots) {
+            if (slot.queries[0])
+                glDeleteQueries(2, slot.queries);
+            slot = Slot();
+        }
+    }
+
+    // starts measuring a frame showing `time` of the path
+    void beginFrame(float time) {
+        clock::time_point now = clock::now();
+        if (!m_Frames.empty())
+            m_Frames.back().frameMs = std::chrono::duration<double, std::milli>(now - m_Start).count();
+        m_Start = now;
+        uint32_t index = (uint32_t)m_Frames.size();
+        BenchmarkFrame frame;
+        frame.time = time;
+        m_Frames.push_back(frame);
+        Slot& slot = m_Slots[index % kGpuTimerLatency];
+        if (!slot.queries[0])
+            return;
+        // a frame whose timestamps still aren't there kGpuTimerLatency frames later is dropped,
+        // waiting for them would change the frame times being measured
+        if (slot.pending) {
+            if (available(slot))
+                read(slot);
+            else
+                m_GpuMissed++;
+            slot.pending = false;
+        }
+        glQueryCounter(slot.queries[0], GL_TIMESTAMP);
+        slot.frame = index;
+    }
+
+    // call when the frame is issued, before it is swapped or finished
+    void endFrame(const RenderStats& stats, const GLCallStats& calls = GLCallStats()) {
+        BenchmarkFrame& frame = m_Frames.back();
+        frame.cpuMs = std::chrono::duration<double, std::milli>(clock::now() - m_Start).count();
+        frame.draws = stats.draws;
+        frame.triangles = stats.triangles;
+        frame.calls = calls;
+        Slot& slot = m_Slots[(m_Frames.size() - 1) % kGpuTimerLatency];
+        if (!slot.queries[0])
+            return;
+        glQueryCounter(slot.queries[1], GL_TIMESTAMP);
+        slot.pending = true;
+    }
+
+    // call after the last frame was swapped or finished: closes it and waits for the GPU timers
+    void finish() {
+        if (!m_Frames.empty() && m_Frames.back().frameMs < 0.0)
+            m_Frames.back().frameMs = std::chrono::duration<double, std::milli>(clock::now() - m_Start).count();
+        for (Slot& slot : m_Slots)
+            if (slot.pending)
+                read(slot);
+    }
+
+    const std::vector<BenchmarkFrame>& frames() const {
+        return m_Frames;
+    }
+    TimeStats cpu() const {
+        return stats(&BenchmarkFrame::cpuMs);
+    }
+    TimeStats gpu() const {
+        return stats(&BenchmarkFrame::gpuMs);
+    }
+    TimeStats frame() const {
+        return stats(&BenchmarkFrame::frameMs);
+    }
+    // frames whose GPU timestamps weren't available kGpuTimerLatency frames later
+    unsigned int gpuMissed() const {
+        return m_GpuMissed;
+    }
+
+    void print(const BenchmarkInfo& info) const {
+        printf("benchmark: %zu frames of %s at %ux%u, %s\n", m_Frames.size(), info.path.c_str(), info.width,
+               info.height, info.renderer.c_str());
+        printf("%8s %9s %9s %9s %9s %9s %9s\n", "", "min ms", "mean ms", "p50 ms", "p95 ms", "p99 ms", "max ms");
+        const char* names[3] = {"cpu", "gpu", "frame"};
+        TimeStats all[3] = {cpu(), gpu(), frame()};
+        for (int i = 0; i < 3; ++i) {
+            if (all[i].samples == 0)
+                printf("%8s %9s\n", names[i], "-");
+            else
+                printf("%8s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", names[i], all[i].min, all[i].mean, all[i].p50,
+                       all[i].p95, all[i].p99, all[i].max);
+        }
+        if (m_GpuMissed)
+            printf("gpu: %u frames without a time, their timestamps were late\n", m_GpuMissed);
+        printf("frame time histogram:\n");
+        TimeStats frames = all[2];
+        for (int bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+            if (frames.histogram[bucket] == 0)
+                continue;
+            int bar = (int)(50.0 * frames.histogram[bucket] / std::max<size_t>(frames.samples, 1) + 0.5);
+            printf("  %-12s %6u %s\n", bucketName(bucket).c_str(), frames.histogram[bucket],
+                   std::string(bar, '#').c_str());
+        }
+        if (kGLStatsEnabled && !m_Frames.empty()) {
+            GLCallStats calls = totalCalls();
+            double count = (double)m_Frames.size();
+            printf("gl calls per frame: %.1f draws, %.1f program binds, %.1f texture binds, %.1f buffer uploads "
+                   "(%.1f KB), %.1f uniforms, %.1f state changes\n",
+                   calls.draws / count, calls.programBinds / count, calls.textureBinds / count,
+                   calls.bufferUploads / count, calls.bufferUploadBytes / count / 1024.0, calls.uniformCalls / count,
+                   calls.stateChanges / count);
+        }
+        if (info.checksum)
+            printf("last image checksum %016llx\n", (unsigned long long)info.checksum);
+    }
+
+    // `prefix`.json with the summary and `prefix`.csv with every frame. False if either can't be written.
+    bool write(const std::string& prefix, const BenchmarkInfo& info) const {
+        std::ofstream csv(prefix + ".csv");
+        std::ofstream json(prefix + ".json");
+        if (!csv || !json) {
+            std::cout << "ERROR::BENCHMARK:: can't write " << prefix << ".json/.csv" << std::endl;
+            return false;
+        }
+        csv << "frame,time,cpu_ms,gpu_ms,frame_ms,draws,triangles";
+        if (kGLStatsEnabled)
+            csv << ",gl_draws,gl_triangles,program_binds,texture_binds,vao_binds,buffer_binds,framebuffer_binds,"
+                   "uniform_calls,state_changes,buffer_uploads,buffer_upload_bytes,texture_uploads";
+        csv << '\n';
+        for (size_t i = 0; i < m_Frames.size(); ++i) {
+            const BenchmarkFrame& frame = m_Frames[i];
+            csv << i << ',' << frame.time << ',' << frame.cpuMs << ',';
+            if (frame.gpuMs >= 0.0)
+                csv << frame.gpuMs;
+            csv << ',' << frame.frameMs << ',' << frame.draws << ',' << frame.triangles;
+            if (kGLStatsEnabled) {
+                const GLCallStats& calls = frame.calls;
+                csv << ',' << calls.draws << ',' << calls.triangles << ',' << calls.programBinds << ','
+                    << calls.textureBinds << ',' << calls.vaoBinds << ',' << calls.bufferBinds << ','
+                    << calls.framebufferBinds << ',' << calls.uniformCalls << ',' << calls.stateChanges << ','
+                    << calls.bufferUploads << ',' << calls.bufferUploadBytes << ',' << calls.textureUploads;
+            }
+            csv << '\n';
+        }
+
+        json << "{\n";
+        json << "  \"scene\": \"" << escape(info.scene) << "\",\n";
+        json << "  \"path\": \"" << escape(info.path) << "\",\n";
+        json << "  \"renderer\": \"" << escape(info.renderer) << "\",\n";
+        json << "  \"width\": " << info.width << ",\n";
+        json << "  \"height\": " << info.height << ",\n";
+        json << "  \"timeStep\": " << info.timeStep << ",\n";
+        json << "  \"frames\": " << m_Frames.size() << ",\n";
+        json << "  \"gpuMissed\": " << m_GpuMissed << ",\n";
+        if (info.checksum) {
+            char checksum[17];
+            snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long)info.checksum);
+            json << "  \"checksum\": \"" << checksum << "\",\n";
+        }
+        double draws = 0.0, triangles = 0.0;
+        for (const BenchmarkFrame& frame : m_Frames) {
+            draws += frame.draws;
+            triangles += frame.triangles;
+        }
+        size_t count = std::max<size_t>(m_Frames.size(), 1);
+        json << "  \"draws\": " << draws / count << ",\n";
+        json << "  \"triangles\": " << triangles / count << ",\n";
+        if (kGLStatsEnabled) {
+            // averages per frame
+            GLCallStats calls = totalCalls();
+            double frames = (double)count;
+            json << "  \"glCalls\": {\"draws\": " << calls.draws / frames
+                 << ", \"triangles\": " << calls.triangles / frames
+                 << ", \"programBinds\": " << calls.programBinds / frames
+                 << ", \"textureBinds\": " << calls.textureBinds / frames
+                 << ", \"vaoBinds\": " << calls.vaoBinds / frames
+                 << ", \"bufferBinds\": " << calls.bufferBinds / frames
+                 << ", \"framebufferBinds\": " << calls.framebufferBinds / frames
+                 << ", \"uniformCalls\": " << calls.uniformCalls / frames
+                 << ", \"stateChanges\": " << calls.stateChanges / frames
+                 << ", \"clears\": " << calls.clears / frames
+                 << ", \"queries\": " << calls.queries / frames
+                 << ", \"bufferUploads\": " << calls.bufferUploads / frames
+                 << ", \"bufferUploadBytes\": " << calls.bufferUploadBytes / frames
+                 << ", \"textureUploads\": " << calls.textureUploads / frames << "},\n";
+        }
+        json << "  \"histogramEdgesMs\": [";
+        for (int i = 0; i < kHistogramBuckets - 1; ++i)
+            json << (i ? ", " : "") << kHistogramEdgesMs[i];
+        json << "],\n";
+        writeStats(json, "cpu", cpu());
+        json << ",\n";
+        writeStats(json, "gpu", gpu());
+        json << ",\n";
+        writeStats(json, "frame", frame());
+        json << "\n}\n";
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Slot {
+        GLuint queries[2] = {0, 0}; // start and end timestamps
+        uint32_t frame = 0;
+        bool pending = false;
+    };
+
+    std::vector<BenchmarkFrame> m_Frames;
+    Slot m_Slots[kGpuTimerLatency];
+    unsigned int m_GpuMissed = 0;
+    clock::time_point m_Start;
+
+    bool available(const Slot& slot) const {
+        // the end timestamp is issued last
+        GLuint ready = 0;
+        glGetQueryObjectuiv(slot.queries[1], GL_QUERY_RESULT_AVAILABLE, &ready);
+        return ready != 0;
+    }
+
+    void read(Slot& slot) {
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(slot.queries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(slot.queries[1], GL_QUERY_RESULT, &end);
+        if (slot.frame < m_Frames.size())
+            m_Frames[slot.frame].gpuMs = end > start ? (double)(end - start) / 1e6 : 0.0;
+        slot.pending = false;
+    }
+
+    GLCallStats totalCalls() const {
+        GLCallStats total;
+        for (const BenchmarkFrame& frame : m_Frames)
+            total.add(frame.calls);
+        return total;
+    }
+
+    TimeStats stats(double BenchmarkFrame::*member) const {
+        std::vector<double> ms;
+        ms.reserve(m_Frames.size());
+        for (const BenchmarkFrame& frame : m_Frames)
+            ms.push_back(frame.*member);
+        return TimeStats::of(ms);
+    }
+
+    static std::string bucketName(int bucket) {
+        std::ostringstream name;
+        if (bucket == kHistogramBuckets - 1)
+            name << "> " << kHistogramEdgesMs[bucket - 1] << " ms";
+        else
+            name << "<= " << kHistogramEdgesMs[bucket] << " ms";
+        return name.str();
+    }
+
+    static std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    static void writeStats(std::ostream& json, const char* name, const TimeStats& stats) {
+        json << "  \"" << name << "\": {\"samples\": " << stats.samples << ", \"min\": " << stats.min
+             << ", \"max\": " << stats.max << ", \"mean\": " << stats.mean << ", \"p50\": " << stats.p50
+             << ", \"p95\": " << stats.p95 << ", \"p99\": " << stats.p99 << ", \"histogram\": [";
+        for (int i = 0; i < kHistogramBuckets; ++i)
+            json << (i ? ", " : "") << stats.histogram[i];
+        json << "]}";
+    }
+};
+
+namespace detail {
+
+// The value after `"key":` in the object `"section"` of a summary written by BenchmarkRecorder
+// (no nesting below sections), or at the top level when `section` is null. Not a JSON parser.
+inline bool benchmarkValue(const std::string& json, const char* section, const char* key, std::string& value) {
+    size_t begin = 0, end = json.size();
+    if (section) {
+        begin = json.find(std::string("\"") + section + "\":");
+        if (begin == std::string::npos)
+            return false;
+        end = json.find('}', begin);
+    }
+    size_t at = json.find(std::string("\"") + key + "\":", begin);
+    if (at == std::string::npos || at > end)
+        return false;
+    at = json.find_first_not_of(" ", json.find(':', at) + 1);
+    if (at == std::string::npos)
+        return false;
+    if (json[at] == '"') {
+        size_t stop = json.find('"', at + 1);
+        value = json.substr(at + 1, stop == std::string::npos ? std::string::npos : stop - at - 1);
+    } else {
+        size_t stop = json.find_first_of(",}\n", at);
+        value = json.substr(at, stop == std::string::npos ? std::string::npos : stop - at);
+    }
+    return !value.empty();
+}
+
+};
+
+// Prints the summaries of `basePath` and `currentPath` side by side and flags what got slower.
+// Returns the number of regressions, -1 if a file can't be read.
+inline int compareBenchmarks(const std::string& basePath, const std::string& currentPath) {
+    std::string texts[2];
+    const std::string* paths[2] = {&basePath, &currentPath};
+    for (int i = 0; i < 2; ++i) {
+        std::ifstream in(*paths[i]);
+        if (!in) {
+            std::cout << "ERROR::BENCHMARK:: can't read " << *paths[i] << std::endl;
+            return -1;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        texts[i] = buffer.str();
+    }
+    std::string baseFrames, currentFrames, baseCameraPath, currentCameraPath;
+    detail::benchmarkValue(texts[0], nullptr, "frames", baseFrames);
+    detail::benchmarkValue(texts[1], nullptr, "frames", currentFrames);
+    detail::benchmarkValue(texts[0], nullptr, "path", baseCameraPath);
+    detail::benchmarkValue(texts[1], nullptr, "path", currentCameraPath);
+    if (baseFrames != currentFrames || baseCameraPath != currentCameraPath)
+        std::cout << "ERROR::BENCHMARK:: the runs didn't replay the same frames (" << baseCameraPath << ", "
+                  << baseFrames << " frames vs " << currentCameraPath << ", " << currentFrames << " frames)"
+                  << std::endl;
+
+    const char* sections[3] = {"cpu", "gpu", "frame"};
+    const char* keys[4] = {"mean", "p50", "p95", "p99"};
+    int regressions = 0;
+    printf("%-12s %10s %10s %9s\n", "", "base ms", "current ms", "change");
+    for (const char* section : sections) {
+        for (const char* key : keys) {
+            std::string baseText, currentText;
+            if (!detail::benchmarkValue(texts[0], section, key, baseText)
+                || !detail::benchmarkValue(texts[1], section, key, currentText))
+                continue;
+            double base = atof(baseText.c_str()), current = atof(currentText.c_str());
+            if (base <= 0.0 || current <= 0.0)
+                continue;
+            double change = current / base - 1.0;
+            bool regression = change > kRegressionThreshold && current - base > kRegressionMinMs;
+            regressions += regression ? 1 : 0;
+            std::string name = std::string(section) + " " + key;
+            printf("%-12s %10.3f %10.3f %+8.1f%% %s\n", name.c_str(), base, current, change * 100.0,
+                   regression ? "REGRESSION" : "");
+        }
+    }
+    std::string baseChecksum, currentChecksum;
+    if (detail::benchmarkValue(texts[0], nullptr, "checksum", baseChecksum)
+        && detail::benchmarkValue(texts[1], nullptr, "checksum", currentChecksum) && baseChecksum != currentChecksum)
+        printf("the last image changed: %s -> %s\n", baseChecksum.c_str(), currentChecksum.c_str());
+    printf("%d regression%s over %.0f%%\n", regressions, regressions == 1 ? "" : "s", kRegressionThreshold * 100.0);
+    return regressions;
+}
+
+};
+#endif //PROJECT_BASE_BENCHMARK_H
@@ -0,0 +1,84 @@
+//
+// Bounding volumes: axis aligned boxes and spheres.
+//
+// Meshes get both at import time (stored in the mesh cache), models merge the boxes of their
+// meshes, and the culling code moves them to world space with transformed().
+//
+
+#ifndef PROJECT_BASE_BOUNDS_H
+#define PROJECT_BASE_BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace rg {
+
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+    glm::vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+    glm::vec3 extents() const {
+        return (max - min) * 0.5f;
+    }
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    void expand(const AABB& other) {
+        if (other.empty())
+            return;
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    // box around this box after `transform` (Arvo's method, exact for the 8 corners)
+    AABB transformed(const glm::mat4& transform) const {
+        if (empty())
+            return *this;
+        glm::vec3 center = glm::vec3(transform * glm::vec4(this->center(), 1.0f));
+        glm::vec3 extents = this->extents();
+        glm::vec3 worldExtents(0.0f);
+        for (int column = 0; column < 3; ++column)
+            worldExtents += glm::abs(glm::vec3(transform[column])) * extents[column];
+        AABB result;
+        result.min = center - worldExtents;
+        result.max = center + worldExtents;
+        return result;
+    }
+};
+
+struct BoundingSphere {
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = -1.0f; // negative when empty
+};
+
+// box and sphere of a point set; the sphere is centered on the box and encloses every point
+template<typename Vertex>
+void computeBounds(const Vertex* vertices, size_t count, AABB& box, BoundingSphere& sphere) {
+    box = AABB();
+    for (size_t i = 0; i < count; ++i)
+        box.expand(vertices[i].Position);
+    sphere = BoundingSphere();
+    if (box.empty())
+        return;
+    sphere.center = box.center();
+    float radius2 = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        glm::vec3 d = vertices[i].Position - sphere.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    sphere.radius = std::sqrt(radius2);
+}
+
+};
+#endif //PROJECT_BASE_BOUNDS_H
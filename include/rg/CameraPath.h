@@ -0,0 +1,166 @@
+//
+// Scripted camera paths.
+//
+// A path is a list of keyframes (time, position, yaw, pitch). Positions and angles are
+// interpolated with a Catmull-Rom spline through the keyframes, so the camera moves smoothly
+// through every one of them without overshooting far between. Yaw isn't wrapped: a path that
+// turns around keeps counting past 360 degrees, interpolation never takes the long way round.
+//
+// Runs that replay the same path with the same time step see exactly the same frames, which is
+// what the headless mode and the benchmarks rely on to compare frame times and images between
+// builds. Paths are recorded from the interactive camera (`--record-path`) and saved as text, one
+// keyframe per line: time, position, yaw and pitch. A hand written file with a few keyframes is a
+// spline through them.
+//
+
+#ifndef PROJECT_BASE_CAMERAPATH_H
+#define PROJECT_BASE_CAMERAPATH_H
+
+#include <glm/glm.hpp>
+#include <learnopengl/camera.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// a recorded path gets a keyframe at most this often (seconds)
+const float kCameraRecordInterval = 1.0f / 30.0f;
+
+struct CameraKey {
+    float time;         // seconds from the start of the path
+    glm::vec3 position;
+    float yaw;          // degrees, like Camera
+    float pitch;
+};
+
+class CameraPath {
+public:
+    std::vector<CameraKey> keys; // by time
+
+    // `count` keyframes on a circle around `center`, once around in `seconds`, always looking at `center`
+    static CameraPath orbit(const glm::vec3& center, float radius, float height, float seconds, int count = 16) {
+        CameraPath path;
+        for (int i = 0; i <= count; ++i) {
+            float angle = glm::radians(360.0f) * (float)i / (float)count;
+            glm::vec3 position = center + glm::vec3(std::cos(angle) * radius, height, std::sin(angle) * radius);
+            glm::vec3 direction = center - position;
+            CameraKey key;
+            key.time = seconds * (float)i / (float)count;
+            key.position = position;
+            // the camera looks back at the center: 180 degrees past the angle it stands at, unwrapped
+            key.yaw = glm::degrees(angle) + 180.0f;
+            key.pitch = glm::degrees(std::asin(direction.y / glm::length(direction)));
+            path.keys.push_back(key);
+        }
+        return path;
+    }
+
+    // adds the state of `camera` at `time`, which has to be past the last keyframe
+    void append(float time, const Camera& camera) {
+        CameraKey key;
+        key.time = time;
+        key.position = camera.Position;
+        key.yaw = camera.Yaw;
+        key.pitch = camera.Pitch;
+        keys.push_back(key);
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            std::cout << "ERROR::CAMERA_PATH:: can't write " << path << std::endl;
+            return false;
+        }
+        out.precision(9);
+        out << "# time x y z yaw pitch\n";
+        for (const CameraKey& key : keys)
+            out << key.time << ' ' << key.position.x << ' ' << key.position.y << ' ' << key.position.z << ' '
+                << key.yaw << ' ' << key.pitch << '\n';
+        return true;
+    }
+
+    // false (after printing why) if the file can't be read or has no keyframes
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cout << "ERROR::CAMERA_PATH:: can't read " << path << std::endl;
+            return false;
+        }
+        keys.clear();
+        std::string line;
+        for (int number = 1; std::getline(in, line); ++number) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            CameraKey key;
+            if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+                || (!keys.empty() && key.time < keys.back().time)) {
+                std::cout << "ERROR::CAMERA_PATH:: " << path << ":" << number << ": bad keyframe" << std::endl;
+                keys.clear();
+                return false;
+            }
+            // unwrapped, so the spline never turns the long way round
+            if (!keys.empty()) {
+                while (key.yaw - keys.back().yaw > 180.0f)
+                    key.yaw -= 360.0f;
+                while (key.yaw - keys.back().yaw < -180.0f)
+                    key.yaw += 360.0f;
+            }
+            keys.push_back(key);
+        }
+        if (keys.empty()) {
+            std::cout << "ERROR::CAMERA_PATH:: " << path << " has no keyframes" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    float duration() const {
+        return keys.empty() ? 0.0f : keys.back().time;
+    }
+
+    // the camera at `time`, clamped to the ends of the path; `zoom` is kept
+    Camera sample(float time, float zoom = ZOOM) const {
+        Camera camera;
+        if (keys.empty())
+            return camera;
+        time = std::max(keys.front().time, std::min(time, keys.back().time));
+        size_t next = 1;
+        while (next < keys.size() && keys[next].time < time)
+            next++;
+        if (next >= keys.size()) {
+            camera = Camera(keys.back().position, glm::vec3(0.0f, 1.0f, 0.0f), keys.back().yaw, keys.back().pitch);
+        } else {
+            const CameraKey& k1 = keys[next - 1];
+            const CameraKey& k2 = keys[next];
+            // the ends repeat their keyframe as the missing neighbour
+            const CameraKey& k0 = next >= 2 ? keys[next - 2] : k1;
+            const CameraKey& k3 = next + 1 < keys.size() ? keys[next + 1] : k2;
+            float span = k2.time - k1.time;
+            float t = span > 0.0f ? (time - k1.time) / span : 1.0f;
+            glm::vec3 position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+            float yaw = catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+            float pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+            camera = Camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, std::max(-89.0f, std::min(pitch, 89.0f)));
+        }
+        camera.Zoom = zoom;
+        return camera;
+    }
+
+private:
+    template <typename T>
+    static T catmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t) {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2
+                       + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+};
+
+};
+#endif //PROJECT_BASE_CAMERAPATH_H
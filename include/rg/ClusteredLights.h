@@ -0,0 +1,245 @@
+//
+// Clustered forward lighting for many point lights.
+//
+// The view frustum is cut into a grid of clusters: kTilesX x kTilesY screen tiles times kSlices
+// depth slices, spaced exponentially between the near and far plane. Every frame the lights are
+// binned on the CPU: each light's bounding sphere is tested against the slices it spans and, per
+// slice, the screen tiles its projection can cover. The result is a (first index, count) range per
+// cluster and one shared list of light indices.
+//
+// glad is generated for GL 3.3, so there are no SSBOs: lights, ranges and indices go to the
+// shader through texture buffers, and the lighting shader loops only over the lights of the
+// fragment's cluster.
+//
+
+#ifndef PROJECT_BASE_CLUSTEREDLIGHTS_H
+#define PROJECT_BASE_CLUSTEREDLIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <rg/GLState.h>
+#include <rg/UniformBuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+// texture units of the three buffers, above the shadow map
+const GLuint kClusterLightsUnit = 9;
+const GLuint kClusterRangesUnit = 10;
+const GLuint kClusterIndicesUnit = 11;
+
+// one point light, two RGBA32F texels in the light buffer
+struct ClusterLight {
+    glm::vec3 position;
+    float radius;      // the light doesn't reach past this
+    glm::vec3 color;
+    float padding;
+};
+
+struct ClusterStats {
+    unsigned int lights = 0;
+    unsigned int visibleLights = 0;   // lights touching at least one cluster
+    unsigned int occupiedClusters = 0;
+    unsigned int indices = 0;         // light/cluster pairs
+    unsigned int maxPerCluster = 0;
+    double binMs = 0.0;
+};
+
+class LightClusters {
+public:
+    static const int kTilesX = 16;
+    static const int kTilesY = 9;
+    static const int kSlices = 24;
+    static const int kClusters = kTilesX * kTilesY * kSlices;
+
+    void create() {
+        for (int i = 0; i < 3; ++i) {
+            glGenBuffers(1, &m_Buffers[i]);
+            glGenTextures(1, &m_Textures[i]);
+        }
+        static const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        // a texture buffer needs storage before it is attached
+        for (int i = 0; i < 3; ++i) {
+            glBindBuffer(GL_TEXTURE_BUFFER, m_Buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, m_Textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_Buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // call before the context is destroyed
+    void release() {
+        if (m_Buffers[0]) {
+            glDeleteBuffers(3, m_Buffers);
+            glDeleteTextures(3, m_Textures);
+        }
+        for (int i = 0; i < 3; ++i)
+            m_Buffers[i] = m_Textures[i] = 0;
+    }
+
+    // replaces the lights, uploaded by the next update()
+    void setLights(const std::vector<ClusterLight>& lights) {
+        m_Lights = lights;
+        m_LightsDirty = true;
+    }
+    const std::vector<ClusterLight>& lights() const {
+        return m_Lights;
+    }
+
+    // bins the lights for a camera with `view` and a perspective of `fovY` radians, `aspect`,
+    // `near`..`far`, rendering to `width` x `height` pixels, and uploads the result
+    void update(const glm::mat4& view, float fovY, float aspect, float near, float far, int width, int height) {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+        m_Stats = ClusterStats();
+        m_Stats.lights = m_Lights.size();
+
+        float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+        float logDepth = std::log(far / near);
+        m_Block = ClustersBlock();
+        m_Block.grid[0] = kTilesX;
+        m_Block.grid[1] = kTilesY;
+        m_Block.grid[2] = kSlices;
+        m_Block.grid[3] = m_Lights.size();
+        m_Block.params = glm::vec4(near, far, kSlices / logDepth, 0.0f);
+        m_Block.tileSize = glm::vec4((float)width / kTilesX, (float)height / kTilesY, 0.0f, 0.0f);
+
+        // first pass: the cluster box of every light (per slice), counting the pairs
+        std::fill(m_Counts.begin(), m_Counts.end(), 0u);
+        m_Counts.resize(kClusters, 0u);
+        m_Spans.clear();
+        for (uint32_t light = 0; light < m_Lights.size(); ++light) {
+            const ClusterLight& l = m_Lights[light];
+            glm::vec3 p = glm::vec3(view * glm::vec4(l.position, 1.0f));
+            float depth = -p.z, r = l.radius;
+            if (depth + r < near || depth - r > far)
+                continue;
+            int firstSlice = slice(std::max(depth - r, near), near, logDepth);
+            int lastSlice = slice(std::min(depth + r, far), near, logDepth);
+            bool visible = false;
+            for (int k = firstSlice; k <= lastSlice; ++k) {
+                // the part of the sphere's depth range inside this slice
+                float d0 = std::max(depth - r, near * std::exp(logDepth * k / kSlices));
+                float d1 = std::min(depth + r, near * std::exp(logDepth * (k + 1) / kSlices));
+                if (d0 > d1)
+                    continue;
+                // the sphere's x/y extent projected at both ends, the widest of them is conservative
+                Span span;
+                span.light = light;
+                span.slice = k;
+                if (!tileRange(p.x, r, d0, d1, tanX, kTilesX, span.x0, span.x1)
+                    || !tileRange(p.y, r, d0, d1, tanY, kTilesY, span.y0, span.y1))
+                    continue;
+                for (int y = span.y0; y <= span.y1; ++y)
+                    for (int x = span.x0; x <= span.x1; ++x)
+                        m_Counts[cluster(x, y, k)]++;
+                m_Spans.push_back(span);
+                visible = true;
+            }
+            m_Stats.visibleLights += visible;
+        }
+
+        // second pass: ranges from the counts, then the indices
+        m_Ranges.resize(kClusters * 2);
+        uint32_t offset = 0;
+        for (int c = 0; c < kClusters; ++c) {
+            m_Ranges[c * 2] = offset;
+            m_Ranges[c * 2 + 1] = 0;
+            offset += m_Counts[c];
+            m_Stats.occupiedClusters += m_Counts[c] > 0;
+            m_Stats.maxPerCluster = std::max(m_Stats.maxPerCluster, m_Counts[c]);
+        }
+        m_Indices.resize(std::max(offset, 1u));
+        for (const Span& span : m_Spans) {
+            for (int y = span.y0; y <= span.y1; ++y) {
+                for (int x = span.x0; x <= span.x1; ++x) {
+                    int c = cluster(x, y, span.slice);
+                    m_Indices[m_Ranges[c * 2] + m_Ranges[c * 2 + 1]++] = span.light;
+                }
+            }
+        }
+        m_Stats.indices = offset;
+
+        if (m_LightsDirty) {
+            upload(0, m_Lights.size() * sizeof(ClusterLight), m_Lights.data());
+            m_LightsDirty = false;
+        }
+        upload(1, m_Ranges.size() * sizeof(uint32_t), m_Ranges.data());
+        upload(2, m_Indices.size() * sizeof(uint32_t), m_Indices.data());
+        m_Stats.binMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    // binds the three buffers to their units for the lighting programs
+    void bind(GLStateCache& state) const {
+        state.bindTexture(kClusterLightsUnit, GL_TEXTURE_BUFFER, m_Textures[0]);
+        state.bindTexture(kClusterRangesUnit, GL_TEXTURE_BUFFER, m_Textures[1]);
+        state.bindTexture(kClusterIndicesUnit, GL_TEXTURE_BUFFER, m_Textures[2]);
+    }
+
+    // what the lighting shaders read; lightCount is 0 until the first update()
+    const ClustersBlock& block() const {
+        return m_Block;
+    }
+    const ClusterStats& stats() const {
+        return m_Stats;
+    }
+
+private:
+    // clusters a light covers in one slice
+    struct Span {
+        uint32_t light;
+        int slice;
+        int x0, x1, y0, y1;
+    };
+
+    GLuint m_Buffers[3] = {};
+    GLuint m_Textures[3] = {};
+    std::vector<ClusterLight> m_Lights;
+    bool m_LightsDirty = true;
+    std::vector<uint32_t> m_Counts;
+    std::vector<uint32_t> m_Ranges;  // first index, count
+    std::vector<uint32_t> m_Indices;
+    std::vector<Span> m_Spans;
+    ClustersBlock m_Block = ClustersBlock();
+    ClusterStats m_Stats;
+
+    static int cluster(int x, int y, int slice) {
+        return (slice * kTilesY + y) * kTilesX + x;
+    }
+
+    static int slice(float depth, float near, float logDepth) {
+        int k = (int)std::floor(std::log(depth / near) / logDepth * kSlices);
+        return std::max(0, std::min(k, kSlices - 1));
+    }
+
+    // tiles covered along one axis by [center - r, center + r] seen at depths d0..d1
+    static bool tileRange(float center, float r, float d0, float d1, float tanHalf, int tiles, int& first,
+                          int& last) {
+        float lo = std::min((center - r) / (d0 * tanHalf), (center - r) / (d1 * tanHalf));
+        float hi = std::max((center + r) / (d0 * tanHalf), (center + r) / (d1 * tanHalf));
+        if (lo > 1.0f || hi < -1.0f)
+            return false;
+        first = std::max(0, (int)std::floor((lo * 0.5f + 0.5f) * tiles));
+        last = std::min(tiles - 1, (int)std::floor((hi * 0.5f + 0.5f) * tiles));
+        return first <= last;
+    }
+
+    void upload(int buffer, size_t bytes, const void* data) {
+        // orphaned every time, the previous frame's draws may still read the old storage
+        glBindBuffer(GL_TEXTURE_BUFFER, m_Buffers[buffer]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, (size_t)16), nullptr, GL_STREAM_DRAW);
+        if (bytes)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+};
+#endif //PROJECT_BASE_CLUSTEREDLIGHTS_H
@@ -0,0 +1,114 @@
+//
+// View frustum and box/sphere tests against it.
+//
+// The six planes are pulled out of projection * view (Gribb/Hartmann) and kept in SoA form,
+// padded to eight, so one box is tested against four planes per SSE instruction. Without SSE
+// the same math runs as plain loops.
+//
+
+#ifndef PROJECT_BASE_FRUSTUM_H
+#define PROJECT_BASE_FRUSTUM_H
+
+#include <glm/glm.hpp>
+#include <rg/Bounds.h>
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RG_FRUSTUM_SSE 1
+#endif
+
+namespace rg {
+
+enum class Containment { Outside, Intersects, Inside };
+
+class Frustum {
+public:
+    Frustum() = default;
+    explicit Frustum(const glm::mat4& viewProjection) {
+        set(viewProjection);
+    }
+
+    // planes point inwards; a point p is inside when dot(n, p) + d >= 0 for all six
+    void set(const glm::mat4& m) {
+        glm::vec4 row[4];
+        for (int r = 0; r < 4; ++r)
+            row[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+        glm::vec4 planes[6] = {row[3] + row[0], row[3] - row[0], row[3] + row[1],
+                               row[3] - row[1], row[3] + row[2], row[3] - row[2]};
+        for (int i = 0; i < kPlanes; ++i) {
+            // the padding planes (0, 0, 0, 1) accept everything
+            glm::vec4 plane = i < 6 ? planes[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+            if (i < 6 && length > 0.0f)
+                plane /= length;
+            m_X[i] = plane.x;
+            m_Y[i] = plane.y;
+            m_Z[i] = plane.z;
+            m_W[i] = plane.w;
+        }
+    }
+
+    Containment test(const AABB& box) const {
+        if (box.empty())
+            return Containment::Outside;
+        glm::vec3 c = box.center(), e = box.extents();
+#ifdef RG_FRUSTUM_SSE
+        const __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+        const __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        int outside = 0, intersecting = 0;
+        for (int i = 0; i < kPlanes; i += 4) {
+            __m128 px = _mm_load_ps(m_X + i), py = _mm_load_ps(m_Y + i), pz = _mm_load_ps(m_Z + i);
+            // signed distance of the center and projected radius of the box for 4 planes
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                                         _mm_add_ps(_mm_mul_ps(pz, cz), _mm_load_ps(m_W + i)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, px), ex),
+                                                  _mm_mul_ps(_mm_andnot_ps(signMask, py), ey)),
+                                       _mm_mul_ps(_mm_andnot_ps(signMask, pz), ez));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+            intersecting |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+        }
+        if (outside)
+            return Containment::Outside;
+        return intersecting ? Containment::Intersects : Containment::Inside;
+#else
+        bool intersecting = false;
+        for (int i = 0; i < 6; ++i) {
+            float distance = m_X[i] * c.x + m_Y[i] * c.y + m_Z[i] * c.z + m_W[i];
+            float radius = std::fabs(m_X[i]) * e.x + std::fabs(m_Y[i]) * e.y + std::fabs(m_Z[i]) * e.z;
+            if (distance + radius < 0.0f)
+                return Containment::Outside;
+            if (distance - radius < 0.0f)
+                intersecting = true;
+        }
+        return intersecting ? Containment::Intersects : Containment::Inside;
+#endif
+    }
+
+    bool visible(const AABB& box) const {
+        return test(box) != Containment::Outside;
+    }
+
+    bool visible(const BoundingSphere& sphere) const {
+        if (sphere.radius < 0.0f)
+            return false;
+        for (int i = 0; i < 6; ++i) {
+            if (m_X[i] * sphere.center.x + m_Y[i] * sphere.center.y + m_Z[i] * sphere.center.z + m_W[i]
+                < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    static const int kPlanes = 8;
+    alignas(16) float m_X[kPlanes] = {};
+    alignas(16) float m_Y[kPlanes] = {};
+    alignas(16) float m_Z[kPlanes] = {};
+    alignas(16) float m_W[kPlanes] = {};
+};
+
+};
+#endif //PROJECT_BASE_FRUSTUM_H
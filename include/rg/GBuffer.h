@@ -0,0 +1,114 @@
+//
+// G-buffer of the deferred renderer.
+//
+// The opaque geometry is drawn once into three screen sized targets: albedo with the specular mask
+// in alpha, the world space normal and depth. The lighting pass then shades every pixel exactly
+// once from those, no matter how many surfaces were drawn over it, and reconstructs the position
+// from depth with the inverse view-projection. Depth is DEPTH24_STENCIL8 to match the default
+// framebuffer, so it can be blitted there for the forward passes drawn after lighting (vegetation,
+// skybox).
+//
+
+#ifndef PROJECT_BASE_GBUFFER_H
+#define PROJECT_BASE_GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <iostream>
+
+namespace rg {
+
+// texture units the lighting pass reads the G-buffer from
+const GLuint kGBufferAlbedoUnit = 0;
+const GLuint kGBufferNormalUnit = 1;
+const GLuint kGBufferDepthUnit = 2;
+
+class GBuffer {
+public:
+    // false if the framebuffer isn't complete
+    bool create(int width, int height) {
+        m_Width = width;
+        m_Height = height;
+        glGenFramebuffers(1, &m_Framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffer);
+        m_AlbedoSpecular = target(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0);
+        // RGB16F isn't required to be renderable in 3.3
+        m_Normal = target(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, GL_COLOR_ATTACHMENT1);
+        m_Depth = target(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT);
+        const GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, buffers);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete)
+            std::cout << "ERROR::GBUFFER:: framebuffer isn't complete" << std::endl;
+        return complete;
+    }
+
+    // call before the context is destroyed
+    void release() {
+        if (m_Framebuffer) {
+            glDeleteFramebuffers(1, &m_Framebuffer);
+            GLuint textures[3] = {m_AlbedoSpecular, m_Normal, m_Depth};
+            glDeleteTextures(3, textures);
+        }
+        m_Framebuffer = m_AlbedoSpecular = m_Normal = m_Depth = 0;
+    }
+
+    // binds the G-buffer for the geometry pass and clears it
+    void begin() const {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffer);
+        glViewport(0, 0, m_Width, m_Height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // copies the depth into `framebuffer` (0 is the window), which has to be the same size
+    void blitDepth(GLuint framebuffer) const {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_Framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glBlitFramebuffer(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+    GLuint albedoSpecular() const {
+        return m_AlbedoSpecular;
+    }
+    GLuint normal() const {
+        return m_Normal;
+    }
+    GLuint depth() const {
+        return m_Depth;
+    }
+
+    // video memory of the three targets
+    size_t bytes() const {
+        return (size_t)m_Width * m_Height * (4 + 8 + 4);
+    }
+
+private:
+    GLuint m_Framebuffer = 0;
+    GLuint m_AlbedoSpecular = 0;
+    GLuint m_Normal = 0;
+    GLuint m_Depth = 0;
+    int m_Width = 0;
+    int m_Height = 0;
+
+    GLuint target(GLint internalFormat, GLenum format, GLenum type, GLenum attachment) const {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, m_Width, m_Height, 0, format, type, nullptr);
+        // read with texelFetch, one texel per pixel
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+};
+
+};
+#endif //PROJECT_BASE_GBUFFER_H
@@ -0,0 +1,134 @@
+//
+// Shadow copy of the GL binding state, so redundant binds never reach the driver.
+//
+// Everything in the frame that binds programs, VAOs or textures goes through one GLStateCache,
+// which skips calls that wouldn't change anything and counts the ones that do. Code that touches
+// the bindings behind its back (texture streaming, ImGui) is followed by invalidate().
+//
+
+#ifndef PROJECT_BASE_GLSTATE_H
+#define PROJECT_BASE_GLSTATE_H
+
+#include <glad/glad.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+// per-frame counters
+struct RenderStats {
+    unsigned int draws = 0;
+    unsigned int instances = 0;
+    unsigned int triangles = 0;        // over all instances
+    unsigned int programSwitches = 0;
+    unsigned int vaoSwitches = 0;
+    unsigned int textureSwitches = 0;
+    unsigned int redundantSkipped = 0; // binds and sampler writes that were filtered out
+};
+
+class GLStateCache {
+public:
+    static const unsigned int kTextureUnits = 16;
+
+    GLStateCache() {
+        invalidate();
+    }
+
+    // resets the counters; the bindings are assumed to have been touched since the last frame
+    void beginFrame() {
+        m_Stats = RenderStats();
+        invalidate();
+    }
+
+    // forget what is bound, the next bind of each kind always reaches GL
+    void invalidate() {
+        m_Program = kUnknown;
+        m_VertexArray = kUnknown;
+        m_ActiveUnit = kUnknown;
+        for (unsigned int unit = 0; unit < kTextureUnits; ++unit)
+            m_Textures[unit][0] = m_Textures[unit][1] = kUnknown;
+    }
+
+    void useProgram(GLuint program) {
+        if (program == m_Program) {
+            m_Stats.redundantSkipped++;
+            return;
+        }
+        glUseProgram(program);
+        m_Program = program;
+        m_Stats.programSwitches++;
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        if (vertexArray == m_VertexArray) {
+            m_Stats.redundantSkipped++;
+            return;
+        }
+        glBindVertexArray(vertexArray);
+        m_VertexArray = vertexArray;
+        m_Stats.vaoSwitches++;
+    }
+
+    // GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP are tracked, other targets always go through
+    void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+        int slot = target == GL_TEXTURE_2D ? 0 : target == GL_TEXTURE_CUBE_MAP ? 1 : -1;
+        if (slot >= 0 && unit < kTextureUnits && m_Textures[unit][slot] == texture) {
+            m_Stats.redundantSkipped++;
+            return;
+        }
+        if (unit != m_ActiveUnit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            m_ActiveUnit = unit;
+        }
+        glBindTexture(target, texture);
+        if (slot >= 0 && unit < kTextureUnits)
+            m_Textures[unit][slot] = texture;
+        m_Stats.textureSwitches++;
+    }
+
+    // sampler uniforms are program state, so their values are remembered per program across frames.
+    // Applies to the current program.
+    void setSampler(GLint location, GLint unit) {
+        if (location < 0)
+            return;
+        std::vector<GLint>& values = m_Samplers[m_Program];
+        if ((size_t)location < values.size() && values[location] == unit) {
+            m_Stats.redundantSkipped++;
+            return;
+        }
+        if ((size_t)location >= values.size())
+            values.resize(location + 1, -1);
+        glUniform1i(location, unit);
+        values[location] = unit;
+    }
+
+    // drops the remembered sampler values of a program that was deleted or relinked
+    void forgetProgram(GLuint program) {
+        m_Samplers.erase(program);
+    }
+
+    // a draw of `instances` copies of `triangles` triangles
+    void countDraw(GLsizei instances = 1, unsigned int triangles = 0) {
+        m_Stats.draws++;
+        m_Stats.instances += instances;
+        m_Stats.triangles += triangles * instances;
+    }
+
+    const RenderStats& stats() const {
+        return m_Stats;
+    }
+
+private:
+    static const GLuint kUnknown = ~0u;
+
+    GLuint m_Program;
+    GLuint m_VertexArray;
+    GLuint m_ActiveUnit;
+    GLuint m_Textures[kTextureUnits][2];
+    std::unordered_map<GLuint, std::vector<GLint>> m_Samplers;
+    RenderStats m_Stats;
+};
+
+};
+#endif //PROJECT_BASE_GLSTATE_H
@@ -0,0 +1,259 @@
+//
+// Per frame counts of GL calls.
+//
+// With RG_GL_STATS defined (cmake -DRG_GL_STATS=ON), installGLStats() swaps the glad function
+// pointers of the entry points below for wrappers that count the call and forward it to the
+// driver. Everything that calls GL through glad is counted this way (Mesh, Shader, the render
+// loop, the texture streamer, ImGui's backend), without touching the call sites. Draw calls
+// also add up instances and triangles, buffer uploads (glBufferData, glBufferSubData, written
+// glMapBufferRange ranges) the bytes they send.
+//
+// Unlike RenderStats, which counts what goes through the GLStateCache, these are the calls that
+// actually reach the driver. Without RG_GL_STATS nothing is wrapped, the functions below do
+// nothing and kGLStatsEnabled is false, so there is no cost.
+//
+
+#ifndef PROJECT_BASE_GLSTATS_H
+#define PROJECT_BASE_GLSTATS_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+namespace rg {
+
+struct GLCallStats {
+    unsigned int draws = 0;
+    unsigned int instances = 0;        // over all draws, 1 for non instanced ones
+    uint64_t triangles = 0;            // GL_TRIANGLES draws, over all instances
+    unsigned int programBinds = 0;
+    unsigned int textureBinds = 0;     // glBindTexture and glBindSampler
+    unsigned int vaoBinds = 0;
+    unsigned int bufferBinds = 0;
+    unsigned int framebufferBinds = 0;
+    unsigned int uniformCalls = 0;     // glUniform*
+    unsigned int stateChanges = 0;     // enables, depth/blend/cull/color mask state, viewport, active texture
+    unsigned int clears = 0;
+    unsigned int queries = 0;          // glBeginQuery and glQueryCounter
+    unsigned int bufferUploads = 0;
+    uint64_t bufferUploadBytes = 0;
+    unsigned int textureUploads = 0;   // glTex(Sub)Image and their compressed variants
+
+    void add(const GLCallStats& other) {
+        draws += other.draws;
+        instances += other.instances;
+        triangles += other.triangles;
+        programBinds += other.programBinds;
+        textureBinds += other.textureBinds;
+        vaoBinds += other.vaoBinds;
+        bufferBinds += other.bufferBinds;
+        framebufferBinds += other.framebufferBinds;
+        uniformCalls += other.uniformCalls;
+        stateChanges += other.stateChanges;
+        clears += other.clears;
+        queries += other.queries;
+        bufferUploads += other.bufferUploads;
+        bufferUploadBytes += other.bufferUploadBytes;
+        textureUploads += other.textureUploads;
+    }
+};
+
+#ifdef RG_GL_STATS
+
+const bool kGLStatsEnabled = true;
+
+namespace detail {
+
+// counts since the last endGLStatsFrame()
+inline GLCallStats& glCallCounts() {
+    static GLCallStats counts;
+    return counts;
+}
+
+// Replaces the glad entry point `*Entry` with one that adds 1 to `Counter` and calls the driver's.
+template <typename Proc, Proc* Entry, unsigned int GLCallStats::*Counter>
+struct GLCounter;
+
+template <typename... Args, void (APIENTRYP* Entry)(Args...), unsigned int GLCallStats::*Counter>
+struct GLCounter<void (APIENTRYP)(Args...), Entry, Counter> {
+    typedef void (APIENTRYP Proc)(Args...);
+
+    static Proc& original() {
+        static Proc proc = nullptr;
+        return proc;
+    }
+    static void APIENTRY call(Args... args) {
+        (glCallCounts().*Counter)++;
+        original()(args...);
+    }
+    static void install() {
+        if (!*Entry || *Entry == &call)
+            return;
+        original() = *Entry;
+        *Entry = &call;
+    }
+};
+
+// the draws and uploads look at their arguments
+struct GLEntries {
+    PFNGLDRAWARRAYSPROC drawArrays = nullptr;
+    PFNGLDRAWARRAYSINSTANCEDPROC drawArraysInstanced = nullptr;
+    PFNGLDRAWELEMENTSPROC drawElements = nullptr;
+    PFNGLDRAWELEMENTSBASEVERTEXPROC drawElementsBaseVertex = nullptr;
+    PFNGLDRAWELEMENTSINSTANCEDPROC drawElementsInstanced = nullptr;
+    PFNGLBUFFERDATAPROC bufferData = nullptr;
+    PFNGLBUFFERSUBDATAPROC bufferSubData = nullptr;
+    PFNGLMAPBUFFERRANGEPROC mapBufferRange = nullptr;
+};
+
+inline GLEntries& glEntries() {
+    static GLEntries entries;
+    return entries;
+}
+
+inline void countDraw(GLenum mode, GLsizei count, GLsizei instances) {
+    GLCallStats& counts = glCallCounts();
+    counts.draws++;
+    counts.instances += instances;
+    if (mode == GL_TRIANGLES)
+        counts.triangles += (uint64_t)(count / 3) * instances;
+}
+
+inline void APIENTRY countedDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    countDraw(mode, count, 1);
+    glEntries().drawArrays(mode, first, count);
+}
+inline void APIENTRY countedDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+    countDraw(mode, count, instances);
+    glEntries().drawArraysInstanced(mode, first, count, instances);
+}
+inline void APIENTRY countedDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+    countDraw(mode, count, 1);
+    glEntries().drawElements(mode, count, type, indices);
+}
+inline void APIENTRY countedDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices,
+                                                   GLint baseVertex) {
+    countDraw(mode, count, 1);
+    glEntries().drawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+inline void APIENTRY countedDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices,
+                                                  GLsizei instances) {
+    countDraw(mode, count, instances);
+    glEntries().drawElementsInstanced(mode, count, type, indices, instances);
+}
+
+inline void APIENTRY countedBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+    GLCallStats& counts = glCallCounts();
+    counts.bufferUploads++;
+    // orphaning (no data) sends nothing
+    if (data)
+        counts.bufferUploadBytes += (uint64_t)size;
+    glEntries().bufferData(target, size, data, usage);
+}
+inline void APIENTRY countedBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+    GLCallStats& counts = glCallCounts();
+    counts.bufferUploads++;
+    counts.bufferUploadBytes += (uint64_t)size;
+    glEntries().bufferSubData(target, offset, size, data);
+}
+inline void* APIENTRY countedMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+    if (access & GL_MAP_WRITE_BIT) {
+        GLCallStats& counts = glCallCounts();
+        counts.bufferUploads++;
+        counts.bufferUploadBytes += (uint64_t)length;
+    }
+    return glEntries().mapBufferRange(target, offset, length, access);
+}
+
+template <typename Proc>
+void replaceEntry(Proc& entry, Proc& original, Proc counted) {
+    if (!entry || entry == counted)
+        return;
+    original = entry;
+    entry = counted;
+}
+
+};
+
+// call once after glad is loaded
+inline void installGLStats() {
+    detail::GLEntries& entries = detail::glEntries();
+    detail::replaceEntry(glad_glDrawArrays, entries.drawArrays, &detail::countedDrawArrays);
+    detail::replaceEntry(glad_glDrawArraysInstanced, entries.drawArraysInstanced, &detail::countedDrawArraysInstanced);
+    detail::replaceEntry(glad_glDrawElements, entries.drawElements, &detail::countedDrawElements);
+    detail::replaceEntry(glad_glDrawElementsBaseVertex, entries.drawElementsBaseVertex,
+                         &detail::countedDrawElementsBaseVertex);
+    detail::replaceEntry(glad_glDrawElementsInstanced, entries.drawElementsInstanced,
+                         &detail::countedDrawElementsInstanced);
+    detail::replaceEntry(glad_glBufferData, entries.bufferData, &detail::countedBufferData);
+    detail::replaceEntry(glad_glBufferSubData, entries.bufferSubData, &detail::countedBufferSubData);
+    detail::replaceEntry(glad_glMapBufferRange, entries.mapBufferRange, &detail::countedMapBufferRange);
+
+#define RG_COUNT_GL(entry, counter) \
+    detail::GLCounter<decltype(glad_##entry), &glad_##entry, &GLCallStats::counter>::install()
+    RG_COUNT_GL(glUseProgram, programBinds);
+    RG_COUNT_GL(glBindTexture, textureBinds);
+    RG_COUNT_GL(glBindSampler, textureBinds);
+    RG_COUNT_GL(glBindVertexArray, vaoBinds);
+    RG_COUNT_GL(glBindBuffer, bufferBinds);
+    RG_COUNT_GL(glBindBufferBase, bufferBinds);
+    RG_COUNT_GL(glBindBufferRange, bufferBinds);
+    RG_COUNT_GL(glBindFramebuffer, framebufferBinds);
+    RG_COUNT_GL(glUniform1i, uniformCalls);
+    RG_COUNT_GL(glUniform1f, uniformCalls);
+    RG_COUNT_GL(glUniform2f, uniformCalls);
+    RG_COUNT_GL(glUniform3f, uniformCalls);
+    RG_COUNT_GL(glUniform4f, uniformCalls);
+    RG_COUNT_GL(glUniform1iv, uniformCalls);
+    RG_COUNT_GL(glUniform1fv, uniformCalls);
+    RG_COUNT_GL(glUniform2fv, uniformCalls);
+    RG_COUNT_GL(glUniform3fv, uniformCalls);
+    RG_COUNT_GL(glUniform4fv, uniformCalls);
+    RG_COUNT_GL(glUniformMatrix2fv, uniformCalls);
+    RG_COUNT_GL(glUniformMatrix3fv, uniformCalls);
+    RG_COUNT_GL(glUniformMatrix4fv, uniformCalls);
+    RG_COUNT_GL(glEnable, stateChanges);
+    RG_COUNT_GL(glDisable, stateChanges);
+    RG_COUNT_GL(glDepthMask, stateChanges);
+    RG_COUNT_GL(glDepthFunc, stateChanges);
+    RG_COUNT_GL(glColorMask, stateChanges);
+    RG_COUNT_GL(glCullFace, stateChanges);
+    RG_COUNT_GL(glBlendFunc, stateChanges);
+    RG_COUNT_GL(glBlendFuncSeparate, stateChanges);
+    RG_COUNT_GL(glBlendEquation, stateChanges);
+    RG_COUNT_GL(glBlendEquationSeparate, stateChanges);
+    RG_COUNT_GL(glPolygonOffset, stateChanges);
+    RG_COUNT_GL(glViewport, stateChanges);
+    RG_COUNT_GL(glScissor, stateChanges);
+    RG_COUNT_GL(glActiveTexture, stateChanges);
+    RG_COUNT_GL(glClear, clears);
+    RG_COUNT_GL(glBeginQuery, queries);
+    RG_COUNT_GL(glQueryCounter, queries);
+    RG_COUNT_GL(glTexImage2D, textureUploads);
+    RG_COUNT_GL(glTexImage3D, textureUploads);
+    RG_COUNT_GL(glTexSubImage2D, textureUploads);
+    RG_COUNT_GL(glCompressedTexImage2D, textureUploads);
+    RG_COUNT_GL(glCompressedTexSubImage2D, textureUploads);
+#undef RG_COUNT_GL
+}
+
+// the counts since the last call (the frame that just ended), starts counting the next frame
+inline GLCallStats endGLStatsFrame() {
+    GLCallStats counts = detail::glCallCounts();
+    detail::glCallCounts() = GLCallStats();
+    return counts;
+}
+
+#else
+
+const bool kGLStatsEnabled = false;
+
+inline void installGLStats() {}
+inline GLCallStats endGLStatsFrame() {
+    return GLCallStats();
+}
+
+#endif
+
+};
+#endif //PROJECT_BASE_GLSTATS_H
@@ -0,0 +1,53 @@
+//
+// 64-bit FNV-1a, used to key the asset caches by content, and the temporary file names the
+// cache writers rename into place.
+//
+
+#ifndef PROJECT_BASE_HASH_H
+#define PROJECT_BASE_HASH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+namespace rg {
+
+const uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = kFnvOffsetBasis) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// hash of the whole file. Returns 0 if the file can't be read.
+inline uint64_t hashFile(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+        return 0;
+    uint64_t hash = kFnvOffsetBasis;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        hash = hashBytes(buffer, n, hash);
+    fclose(f);
+    // make sure a hash of 0 always means "could not read"
+    return hash ? hash : 1;
+}
+
+// a name next to `path` that no other writer uses, neither another process nor another thread of
+// this one. Written to and then renamed over `path`.
+inline std::string temporaryPath(const std::string& path) {
+    static std::atomic<unsigned int> writers{0};
+    return path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(writers++);
+}
+
+};
+#endif //PROJECT_BASE_HASH_H
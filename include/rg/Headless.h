@@ -0,0 +1,176 @@
+//
+// Offscreen OpenGL context for runs without a window.
+//
+// The context comes from EGL without any surface: Mesa's surfaceless platform when the driver
+// has it (no display server, no GPU needed, llvmpipe renders on the CPU), the default display
+// otherwise. Since there is no default framebuffer, everything is drawn into a window sized
+// framebuffer object (RGBA8 color, DEPTH24_STENCIL8 depth like a GLFW window), which the frame
+// binds wherever it would bind 0.
+//
+// Only built when CMake finds EGL (RG_HAVE_EGL); without it create() fails with an error.
+//
+
+#ifndef PROJECT_BASE_HEADLESS_H
+#define PROJECT_BASE_HEADLESS_H
+
+#include <glad/glad.h>
+
+#ifdef RG_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+class HeadlessContext {
+public:
+    // makes a 3.3 core context current, loads the GL functions and creates the framebuffer.
+    // False (after printing why) if any of it fails.
+    bool create(int width, int height) {
+#ifdef RG_HAVE_EGL
+        if (!createContext())
+            return false;
+#else
+        std::cout << "ERROR::HEADLESS:: built without EGL, no offscreen context" << std::endl;
+        return false;
+#endif
+        m_Width = width;
+        m_Height = height;
+        glGenFramebuffers(1, &m_Framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffer);
+        glGenRenderbuffers(2, m_Renderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_Renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_Renderbuffers[0]);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_Renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_Renderbuffers[1]);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::HEADLESS:: framebuffer isn't complete" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // deletes the framebuffer and destroys the context; release everything else first
+    void release() {
+        if (m_Framebuffer) {
+            glDeleteFramebuffers(1, &m_Framebuffer);
+            glDeleteRenderbuffers(2, m_Renderbuffers);
+        }
+        m_Framebuffer = m_Renderbuffers[0] = m_Renderbuffers[1] = 0;
+#ifdef RG_HAVE_EGL
+        if (m_Display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (m_Context != EGL_NO_CONTEXT)
+                eglDestroyContext(m_Display, m_Context);
+            eglTerminate(m_Display);
+        }
+        m_Display = EGL_NO_DISPLAY;
+        m_Context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    // what the frame renders into instead of the window
+    GLuint framebuffer() const {
+        return m_Framebuffer;
+    }
+
+    // FNV-1a hash of the color buffer. The same scene, path and frame count give the same value
+    // on the same driver, so a changed hash means the image changed.
+    uint64_t checksum() const {
+        std::vector<unsigned char> pixels((size_t)m_Width * m_Height * 4);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_Framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, m_Width, m_Height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char byte : pixels) {
+            hash ^= byte;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // the driver doing the rendering, for the report
+    static std::string renderer() {
+        const GLubyte* name = glGetString(GL_RENDERER);
+        return name ? std::string((const char*)name) : std::string("unknown");
+    }
+
+private:
+    GLuint m_Framebuffer = 0;
+    GLuint m_Renderbuffers[2] = {0, 0}; // color, depth-stencil
+    int m_Width = 0;
+    int m_Height = 0;
+
+#ifdef RG_HAVE_EGL
+    EGLDisplay m_Display = EGL_NO_DISPLAY;
+    EGLContext m_Context = EGL_NO_CONTEXT;
+
+    static bool hasExtension(const char* extensions, const char* name) {
+        if (!extensions)
+            return false;
+        size_t length = strlen(name);
+        for (const char* found = strstr(extensions, name); found; found = strstr(found + length, name)) {
+            if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+                return true;
+        }
+        return false;
+    }
+
+    bool createContext() {
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            m_Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (m_Display == EGL_NO_DISPLAY)
+            m_Display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major = 0, minor = 0;
+        if (m_Display == EGL_NO_DISPLAY || !eglInitialize(m_Display, &major, &minor)) {
+            std::cout << "ERROR::HEADLESS:: no EGL display" << std::endl;
+            m_Display = EGL_NO_DISPLAY;
+            return false;
+        }
+        if (!hasExtension(eglQueryString(m_Display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+            std::cout << "ERROR::HEADLESS:: EGL " << major << "." << minor << " can't make a context current without a surface" << std::endl;
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            std::cout << "ERROR::HEADLESS:: EGL has no desktop OpenGL" << std::endl;
+            return false;
+        }
+        const EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                           EGL_NONE};
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(m_Display, configAttributes, &config, 1, &configs) || configs == 0) {
+            std::cout << "ERROR::HEADLESS:: no EGL config for OpenGL" << std::endl;
+            return false;
+        }
+        const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION_KHR, 3, EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+                                            EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+                                            EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR, EGL_NONE};
+        m_Context = eglCreateContext(m_Display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (m_Context == EGL_NO_CONTEXT || !eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_Context)) {
+            std::cout << "ERROR::HEADLESS:: failed to create an OpenGL 3.3 core context" << std::endl;
+            return false;
+        }
+        if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+        return true;
+    }
+#endif
+};
+
+};
+#endif //PROJECT_BASE_HEADLESS_H
@@ -0,0 +1,105 @@
+//
+// Per-instance transforms for instanced draws.
+//
+// The model matrices live in one vertex buffer and are fed to the vertex shader as a mat4
+// attribute at locations 5..8 (right after the Vertex attributes) with a divisor of 1, so
+// `layout (location = 5) in mat4 aInstanceModel;` sees one matrix per instance. Next to each one
+// upload() stores its normalMatrix(), read as
+// `layout (location = 9) in mat3 aInstanceNormalMatrix;`, so the shaders don't invert per vertex.
+//
+// Like Mesh, it's a plain handle: copies refer to the same buffer and nothing is freed implicitly.
+//
+
+#ifndef PROJECT_BASE_INSTANCEBUFFER_H
+#define PROJECT_BASE_INSTANCEBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace rg {
+
+// the matrix normals are brought to world space by, the inverse transpose of `model`'s upper 3x3.
+// Keeps them perpendicular to the surface under non-uniform scale.
+inline glm::mat3 normalMatrix(const glm::mat4& model) {
+    return glm::transpose(glm::inverse(glm::mat3(model)));
+}
+
+class InstanceBuffer {
+public:
+    static const GLuint kFirstAttribute = 5;
+    static const GLuint kNormalMatrixAttribute = 9;
+
+    // replaces the transforms, the buffer is created on first use. Reallocates only when it grows.
+    void upload(const std::vector<glm::mat4>& transforms) {
+        m_Staging.resize(transforms.size());
+        for (size_t i = 0; i < transforms.size(); ++i) {
+            m_Staging[i].model = transforms[i];
+            m_Staging[i].normalMatrix = normalMatrix(transforms[i]);
+        }
+        if (!m_Buffer)
+            glGenBuffers(1, &m_Buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_Buffer);
+        size_t bytes = m_Staging.size() * sizeof(Instance);
+        if (m_Staging.size() > m_Capacity) {
+            glBufferData(GL_ARRAY_BUFFER, bytes, m_Staging.data(), GL_DYNAMIC_DRAW);
+            m_Capacity = m_Staging.size();
+        } else if (bytes) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, m_Staging.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        m_Count = transforms.size();
+    }
+
+    // points the instance attributes of the currently bound VAO at this buffer
+    void attach() const {
+        glBindBuffer(GL_ARRAY_BUFFER, m_Buffer);
+        for (GLuint column = 0; column < 4; ++column) {
+            GLuint attribute = kFirstAttribute + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void*)(offsetof(Instance, model) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        for (GLuint column = 0; column < 3; ++column) {
+            GLuint attribute = kNormalMatrixAttribute + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void*)(offsetof(Instance, normalMatrix) + column * sizeof(glm::vec3)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    GLuint buffer() const {
+        return m_Buffer;
+    }
+    GLsizei count() const {
+        return (GLsizei)m_Count;
+    }
+
+    // call before the context is destroyed
+    void release() {
+        if (m_Buffer)
+            glDeleteBuffers(1, &m_Buffer);
+        m_Buffer = 0;
+        m_Capacity = m_Count = 0;
+    }
+
+private:
+    // one instance as the buffer stores it
+    struct Instance {
+        glm::mat4 model;
+        glm::mat3 normalMatrix;
+    };
+
+    GLuint m_Buffer = 0;
+    size_t m_Capacity = 0;
+    size_t m_Count = 0;
+    std::vector<Instance> m_Staging; // kept so a steady frame doesn't allocate
+};
+
+};
+#endif //PROJECT_BASE_INSTANCEBUFFER_H
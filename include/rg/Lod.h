@@ -0,0 +1,107 @@
+//
+// Levels of detail.
+//
+// Every mesh carries up to kMaxLodLevels index ranges into its own index buffer: level 0 is the
+// imported mesh, each next one a QEM simplification of it (see Simplify.h) built on the same
+// vertices, so switching levels only changes the range of the draw.
+//
+// LodSelector picks a level per scene node from the height of its bounding sphere on screen.
+// A node only changes level once its size is kLodHysteresis past the threshold, so objects sitting
+// near a threshold don't flicker between two levels while the camera moves a little.
+//
+
+#ifndef PROJECT_BASE_LOD_H
+#define PROJECT_BASE_LOD_H
+
+#include <glm/glm.hpp>
+#include <rg/Bounds.h>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+const unsigned int kMaxLodLevels = 4;
+// below these heights on screen (pixels) levels 1, 2 and 3 are used
+const float kLodPixels[kMaxLodLevels - 1] = {320.0f, 140.0f, 60.0f};
+
+// index range of one level
+struct MeshLod {
+    uint32_t firstIndex;  // into the mesh's index buffer
+    uint32_t indexCount;
+    float error;          // object space distance the level deviates from level 0 by (RMS over its planes)
+};
+
+struct LodStats {
+    unsigned int objects[kMaxLodLevels] = {}; // nodes drawn with each level
+    unsigned int switches = 0;                // nodes that changed level this frame
+};
+
+class LodSelector {
+public:
+    // a node needs to be this much (relative) past a threshold to change level
+    static constexpr float kLodHysteresis = 0.15f;
+
+    bool enabled = true;
+    // thresholds are multiplied by this; larger switches to coarser levels earlier
+    float bias = 1.0f;
+
+    // `projection` and the viewport `height` turn sizes into pixels
+    void beginFrame(size_t nodes, const glm::vec3& eye, const glm::mat4& projection, int height) {
+        m_Eye = eye;
+        m_PixelsPerUnit = projection[1][1] * 0.5f * (float)height;
+        m_Stats = LodStats();
+        if (m_Levels.size() < nodes)
+            m_Levels.resize(nodes, 0);
+    }
+
+    // level `node` (world box `box`) is drawn with this frame
+    unsigned int select(uint32_t node, const AABB& box) {
+        unsigned int& level = m_Levels[node];
+        unsigned int previous = level;
+        if (!enabled) {
+            level = 0;
+        } else {
+            float radius = glm::length(box.extents());
+            float distance = glm::length(box.center() - m_Eye);
+            // inside the sphere it covers the whole screen
+            float pixels = distance > radius ? 2.0f * radius / distance * m_PixelsPerUnit : 1e9f;
+            unsigned int coarser = levelFor(pixels * (1.0f + kLodHysteresis));
+            unsigned int finer = levelFor(pixels * (1.0f - kLodHysteresis));
+            if (coarser > level)
+                level = coarser;
+            else if (finer < level)
+                level = finer;
+        }
+        if (level != previous)
+            m_Stats.switches++;
+        m_Stats.objects[level]++;
+        return level;
+    }
+
+    const LodStats& stats() const {
+        return m_Stats;
+    }
+
+private:
+    std::vector<unsigned int> m_Levels; // by scene graph node
+    glm::vec3 m_Eye = glm::vec3(0.0f);
+    float m_PixelsPerUnit = 1.0f;
+    LodStats m_Stats;
+
+    unsigned int levelFor(float pixels) const {
+        unsigned int level = 0;
+        while (level + 1 < kMaxLodLevels && pixels < kLodPixels[level] * bias)
+            level++;
+        return level;
+    }
+};
+
+// the range of `level` in `lods`, or the coarsest one the mesh has
+inline const MeshLod& lodRange(const std::vector<MeshLod>& lods, unsigned int level) {
+    return lods[level < lods.size() ? level : lods.size() - 1];
+}
+
+};
+#endif //PROJECT_BASE_LOD_H
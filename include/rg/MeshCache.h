@@ -0,0 +1,340 @@
+//
+// Binary baked mesh cache.
+//
+// A .rgmesh file stores the already interleaved Vertex array, the index buffer and the
+// texture references of every mesh of a model, keyed by meshSourceHash(): the source file, the
+// material libraries it names and the cache version.
+// At startup the file is mmap-ed and its vertices are packed into the active VertexLayout
+// while they are uploaded, so Assimp (and its tangent/normal generation) only runs on a cache
+// miss or during `--bake`.
+//
+// Layout (all offsets are from the start of the file):
+//   MeshCacheHeader
+//   MeshCacheEntry[meshCount]
+//   MeshCacheTextureRef[textureCount]
+//   Vertex[vertexCount]           (aligned to 16 bytes)
+//   unsigned int[indexCount]     (every mesh's levels of detail, level 0 first)
+//   char strings[stringsSize]     (zero terminated texture types and paths)
+//
+
+#ifndef PROJECT_BASE_MESHCACHE_H
+#define PROJECT_BASE_MESHCACHE_H
+
+#include <learnopengl/mesh.h>
+#include <rg/Bounds.h>
+#include <rg/Hash.h>
+#include <rg/MeshOptimizer.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rg {
+
+// bump whenever the layout, the Vertex struct, the Assimp post-process flags or the import time
+// processing (optimisation, levels of detail) change
+const uint32_t kMeshCacheVersion = 4;
+const char kMeshCacheMagic[4] = {'R', 'G', 'M', 'C'};
+const char* const kMeshCacheExtension = ".rgmesh";
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t vertexStride;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t reserved;
+    uint64_t vertexOffset;
+    uint64_t vertexCount;
+    uint64_t indexOffset;
+    uint64_t indexCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+struct MeshCacheEntry {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    float sphere[4]; // center, radius
+    uint32_t lodCount;
+    MeshLod lods[kMaxLodLevels]; // firstIndex relative to the entry's firstIndex
+};
+
+struct MeshCacheTextureRef {
+    uint32_t typeOffset; // into the string table
+    uint32_t pathOffset; // into the string table, relative to the model directory
+};
+
+// Texture reference of a mesh before it is resolved to a GL texture.
+struct TextureRef {
+    std::string type;
+    std::string path;
+};
+
+// CPU side mesh, produced either by Assimp or by reading the cache.
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;  // all levels of detail
+    std::vector<MeshLod> lods;
+    std::vector<TextureRef> textures;
+    AABB bounds;
+    BoundingSphere sphere;
+    // vertex cache stats of the import, only filled in by Assimp imports
+    MeshOptimization optimization;
+};
+
+inline void entryBounds(const MeshCacheEntry& entry, AABB& bounds, BoundingSphere& sphere) {
+    bounds.min = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+    bounds.max = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+    sphere.center = glm::vec3(entry.sphere[0], entry.sphere[1], entry.sphere[2]);
+    sphere.radius = entry.sphere[3];
+}
+
+inline std::vector<MeshLod> entryLods(const MeshCacheEntry& entry) {
+    return std::vector<MeshLod>(entry.lods, entry.lods + entry.lodCount);
+}
+
+inline std::string meshCachePath(const std::string& sourcePath) {
+    return sourcePath + kMeshCacheExtension;
+}
+
+// Key of the cache of `sourcePath`. Folds in the .mtl files an .obj names with `mtllib` (they hold the
+// texture references stored in the cache) and kMeshCacheVersion. The textures themselves aren't
+// part of it, TextureCache keys them by their own content. Returns 0 if the source can't be read.
+inline uint64_t meshSourceHash(const std::string& sourcePath) {
+    uint64_t hash = hashFile(sourcePath);
+    if (!hash)
+        return 0;
+    hash = hashBytes(&kMeshCacheVersion, sizeof(kMeshCacheVersion), hash);
+    size_t dot = sourcePath.find_last_of('.');
+    if (dot == std::string::npos || sourcePath.compare(dot, std::string::npos, ".obj") != 0)
+        return hash;
+    size_t slash = sourcePath.find_last_of('/');
+    std::string directory = slash == std::string::npos ? std::string() : sourcePath.substr(0, slash + 1);
+    std::ifstream in(sourcePath);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string keyword, library;
+        if (!(fields >> keyword) || keyword != "mtllib")
+            continue;
+        while (fields >> library) {
+            // a missing library hashes as 0, creating it later still invalidates the cache
+            uint64_t libraryHash = hashFile(directory + library);
+            hash = hashBytes(library.data(), library.size(), hash);
+            hash = hashBytes(&libraryHash, sizeof(libraryHash), hash);
+        }
+    }
+    return hash ? hash : 1;
+}
+
+// Read-only, memory mapped view of a .rgmesh file.
+class MeshCacheFile {
+public:
+    MeshCacheFile() = default;
+    MeshCacheFile(const MeshCacheFile&) = delete;
+    MeshCacheFile& operator=(const MeshCacheFile&) = delete;
+    ~MeshCacheFile() {
+        close();
+    }
+
+    // maps the file and validates it against the expected source hash
+    bool open(const std::string& path, uint64_t expectedHash) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MeshCacheHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        m_Data = static_cast<const unsigned char*>(mapped);
+        m_Size = st.st_size;
+
+        if (!validate(expectedHash)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (m_Data)
+            munmap(const_cast<unsigned char*>(m_Data), m_Size);
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+    const MeshCacheHeader& header() const {
+        return *reinterpret_cast<const MeshCacheHeader*>(m_Data);
+    }
+    const MeshCacheEntry* entries() const {
+        return reinterpret_cast<const MeshCacheEntry*>(m_Data + sizeof(MeshCacheHeader));
+    }
+    const MeshCacheTextureRef* textureRefs() const {
+        return reinterpret_cast<const MeshCacheTextureRef*>(entries() + header().meshCount);
+    }
+    const Vertex* vertices() const {
+        return reinterpret_cast<const Vertex*>(m_Data + header().vertexOffset);
+    }
+    const unsigned int* indices() const {
+        return reinterpret_cast<const unsigned int*>(m_Data + header().indexOffset);
+    }
+    // validate() made sure every texture reference points at a zero terminated string
+    const char* string(uint32_t offset) const {
+        return reinterpret_cast<const char*>(m_Data + header().stringsOffset + offset);
+    }
+
+private:
+    const unsigned char* m_Data = nullptr;
+    size_t m_Size = 0;
+
+    bool validate(uint64_t expectedHash) const {
+        const MeshCacheHeader& h = header();
+        if (memcmp(h.magic, kMeshCacheMagic, 4) != 0 || h.version != kMeshCacheVersion)
+            return false;
+        if (h.sourceHash != expectedHash || h.vertexStride != sizeof(Vertex))
+            return false;
+        uint64_t tablesEnd = sizeof(MeshCacheHeader) + (uint64_t)h.meshCount * sizeof(MeshCacheEntry)
+                             + (uint64_t)h.textureCount * sizeof(MeshCacheTextureRef);
+        if (tablesEnd > m_Size
+            || h.vertexOffset + h.vertexCount * sizeof(Vertex) > m_Size
+            || h.indexOffset + h.indexCount * sizeof(unsigned int) > m_Size
+            || h.stringsOffset + h.stringsSize > m_Size)
+            return false;
+        // every entry has to stay inside the shared arrays
+        for (uint32_t i = 0; i < h.meshCount; ++i) {
+            const MeshCacheEntry& e = entries()[i];
+            if ((uint64_t)e.firstVertex + e.vertexCount > h.vertexCount
+                || (uint64_t)e.firstIndex + e.indexCount > h.indexCount
+                || (uint64_t)e.firstTexture + e.textureCount > h.textureCount
+                || e.lodCount == 0 || e.lodCount > kMaxLodLevels)
+                return false;
+            for (uint32_t level = 0; level < e.lodCount; ++level)
+                if ((uint64_t)e.lods[level].firstIndex + e.lods[level].indexCount > e.indexCount)
+                    return false;
+        }
+        // the strings are read with string(), so they have to start inside the table and the table
+        // has to end in a terminator
+        if (h.textureCount > 0
+            && (h.stringsSize == 0 || m_Data[h.stringsOffset + h.stringsSize - 1] != '\0'))
+            return false;
+        for (uint32_t i = 0; i < h.textureCount; ++i) {
+            const MeshCacheTextureRef& ref = textureRefs()[i];
+            if (ref.typeOffset >= h.stringsSize || ref.pathOffset >= h.stringsSize)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Writes the meshes to `path`. The file is written to a temporary of its own first and renamed,
+// so a crashed bake never leaves a half written cache behind and two bakes of the same model
+// can't write into each other's file.
+inline bool writeMeshCache(const std::string& path, uint64_t sourceHash, const std::vector<MeshData>& meshes) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMeshCacheMagic, 4);
+    header.version = kMeshCacheVersion;
+    header.sourceHash = sourceHash;
+    header.vertexStride = sizeof(Vertex);
+    header.meshCount = meshes.size();
+
+    std::vector<MeshCacheEntry> entries;
+    std::vector<MeshCacheTextureRef> refs;
+    std::string strings;
+    for (const MeshData& mesh : meshes) {
+        MeshCacheEntry entry;
+        entry.firstVertex = header.vertexCount;
+        entry.vertexCount = mesh.vertices.size();
+        entry.firstIndex = header.indexCount;
+        entry.indexCount = mesh.indices.size();
+        entry.firstTexture = refs.size();
+        entry.textureCount = mesh.textures.size();
+        for (int k = 0; k < 3; ++k) {
+            entry.boundsMin[k] = mesh.bounds.min[k];
+            entry.boundsMax[k] = mesh.bounds.max[k];
+            entry.sphere[k] = mesh.sphere.center[k];
+        }
+        entry.sphere[3] = mesh.sphere.radius;
+        memset(entry.lods, 0, sizeof(entry.lods));
+        if (mesh.lods.empty()) {
+            entry.lodCount = 1;
+            entry.lods[0] = {0, (uint32_t)mesh.indices.size(), 0.0f};
+        } else {
+            entry.lodCount = std::min<size_t>(mesh.lods.size(), kMaxLodLevels);
+            std::copy(mesh.lods.begin(), mesh.lods.begin() + entry.lodCount, entry.lods);
+        }
+        for (const TextureRef& texture : mesh.textures) {
+            MeshCacheTextureRef ref;
+            ref.typeOffset = strings.size();
+            strings.append(texture.type.c_str(), texture.type.size() + 1);
+            ref.pathOffset = strings.size();
+            strings.append(texture.path.c_str(), texture.path.size() + 1);
+            refs.push_back(ref);
+        }
+        header.vertexCount += mesh.vertices.size();
+        header.indexCount += mesh.indices.size();
+        entries.push_back(entry);
+    }
+    header.textureCount = refs.size();
+
+    uint64_t tablesEnd = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry)
+                         + refs.size() * sizeof(MeshCacheTextureRef);
+    header.vertexOffset = (tablesEnd + 15) & ~uint64_t(15);
+    header.indexOffset = header.vertexOffset + header.vertexCount * sizeof(Vertex);
+    header.stringsOffset = header.indexOffset + header.indexCount * sizeof(unsigned int);
+    header.stringsSize = strings.size();
+
+    std::string tmpPath = temporaryPath(path);
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (!entries.empty())
+        ok = ok && fwrite(entries.data(), sizeof(MeshCacheEntry), entries.size(), f) == entries.size();
+    if (!refs.empty())
+        ok = ok && fwrite(refs.data(), sizeof(MeshCacheTextureRef), refs.size(), f) == refs.size();
+    static const char padding[16] = {};
+    ok = ok && fwrite(padding, 1, header.vertexOffset - tablesEnd, f) == header.vertexOffset - tablesEnd;
+    for (const MeshData& mesh : meshes) {
+        if (!mesh.vertices.empty())
+            ok = ok && fwrite(mesh.vertices.data(), sizeof(Vertex), mesh.vertices.size(), f) == mesh.vertices.size();
+    }
+    for (const MeshData& mesh : meshes) {
+        if (!mesh.indices.empty())
+            ok = ok && fwrite(mesh.indices.data(), sizeof(unsigned int), mesh.indices.size(), f) == mesh.indices.size();
+    }
+    ok = ok && fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+};
+#endif //PROJECT_BASE_MESHCACHE_H
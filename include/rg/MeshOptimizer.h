@@ -0,0 +1,353 @@
+//
+// Index and vertex buffer optimisation of imported meshes.
+//
+// Assimp hands the faces over in file order with a vertex per face corner, so every vertex is
+// transformed three times and the post-transform cache is of no use. At import (and bake) time
+// every mesh goes through:
+//   1. welding: bit-identical vertices are merged
+//   2. vertex cache order: Tipsify (Sander, Nehab and Barczak 2007) - fans around the vertex whose
+//      triangles are most likely to still hit the cache
+//   3. overdraw order: the cache friendly order is cut into clusters which are sorted so the
+//      outward facing ones come first, the clusters stay intact so the cache order is mostly kept
+//   4. vertex fetch order: vertices are renumbered in the order the index buffer first uses them
+//
+// ACMR (transformed vertices per triangle) and ATVR (transformed vertices per vertex, 1 is ideal)
+// are measured with a FIFO cache of kVertexCacheSize entries before and after.
+//
+
+#ifndef PROJECT_BASE_MESHOPTIMIZER_H
+#define PROJECT_BASE_MESHOPTIMIZER_H
+
+#include <glm/glm.hpp>
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+const unsigned int kVertexCacheSize = 16;
+// clusters are cut where their ACMR is within this factor of the whole cluster's
+const float kOverdrawThreshold = 1.05f;
+
+struct VertexCacheStats {
+    unsigned int triangles = 0;
+    unsigned int vertices = 0;     // vertices the index buffer references
+    unsigned int transformed = 0;  // cache misses, i.e. vertex shader runs
+
+    float acmr() const {
+        return triangles ? (float)transformed / triangles : 0.0f;
+    }
+    float atvr() const {
+        return vertices ? (float)transformed / vertices : 0.0f;
+    }
+    void add(const VertexCacheStats& other) {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        transformed += other.transformed;
+    }
+};
+
+// level 0 of a mesh as imported and after optimizeMesh()
+struct MeshOptimization {
+    VertexCacheStats before;
+    VertexCacheStats after;
+
+    // ATVR of the input against the welded vertex count: unwelded every vertex is transformed
+    // exactly once, which says nothing about the work done
+    float atvrBefore() const {
+        return after.vertices ? (float)before.transformed / after.vertices : 0.0f;
+    }
+
+    void add(const MeshOptimization& other) {
+        before.add(other.before);
+        after.add(other.after);
+    }
+};
+
+namespace detail {
+
+// FIFO post-transform cache
+class VertexCacheSimulator {
+public:
+    explicit VertexCacheSimulator(size_t vertexCount) : m_Time(vertexCount, 0) {}
+
+    // whether `vertex` had to be transformed
+    bool access(unsigned int vertex) {
+        if (m_Time[vertex] && m_Clock - m_Time[vertex] < kVertexCacheSize)
+            return false;
+        m_Time[vertex] = ++m_Clock;
+        return true;
+    }
+    // empties the cache
+    void reset() {
+        m_Clock += kVertexCacheSize;
+    }
+
+private:
+    std::vector<uint64_t> m_Time; // clock of the vertex's last miss, 0 when never transformed
+    uint64_t m_Clock = 0;
+};
+
+struct VertexHash {
+    size_t operator()(const Vertex& vertex) const {
+        uint32_t words[sizeof(Vertex) / 4];
+        memcpy(words, &vertex, sizeof(Vertex));
+        uint32_t hash = 2166136261u;
+        for (uint32_t word : words)
+            hash = (hash ^ word) * 16777619u;
+        return hash;
+    }
+};
+struct VertexEqual {
+    bool operator()(const Vertex& a, const Vertex& b) const {
+        return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+// triangles around each vertex, as offsets into one array
+struct TriangleAdjacency {
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> triangles;
+
+    TriangleAdjacency(const std::vector<unsigned int>& indices, size_t begin, size_t end, size_t vertexCount)
+        : first(vertexCount + 1, 0), triangles(end - begin) {
+        for (size_t i = begin; i < end; ++i)
+            first[indices[i] + 1]++;
+        for (size_t v = 1; v < first.size(); ++v)
+            first[v] += first[v - 1];
+        std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+        for (size_t i = begin; i < end; ++i)
+            triangles[fill[indices[i]]++] = (uint32_t)((i - begin) / 3);
+    }
+};
+
+};
+
+inline VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount) {
+    VertexCacheStats stats;
+    stats.triangles = indexCount / 3;
+    detail::VertexCacheSimulator cache(vertexCount);
+    std::vector<bool> used(vertexCount, false);
+    for (size_t i = 0; i < indexCount; ++i) {
+        if (cache.access(indices[i]))
+            stats.transformed++;
+        if (!used[indices[i]]) {
+            used[indices[i]] = true;
+            stats.vertices++;
+        }
+    }
+    return stats;
+}
+
+// merges bit-identical vertices
+inline void weldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+    std::unordered_map<Vertex, unsigned int, detail::VertexHash, detail::VertexEqual> unique;
+    unique.reserve(vertices.size());
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        auto inserted = unique.insert(std::make_pair(vertices[i], (unsigned int)welded.size()));
+        if (inserted.second)
+            welded.push_back(vertices[i]);
+        remap[i] = inserted.first->second;
+    }
+    for (unsigned int& index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+}
+
+// Tipsify: reorders the triangles of indices[begin, end) for the vertex cache. Appends the index of
+// the first triangle of every run that had to restart from a dead end (the hard cluster boundaries
+// of the overdraw pass) to `restarts`, if given.
+inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t begin, size_t end, size_t vertexCount,
+                                std::vector<uint32_t>* restarts = nullptr) {
+    size_t triangleCount = (end - begin) / 3;
+    if (triangleCount == 0)
+        return;
+    detail::TriangleAdjacency adjacency(indices, begin, end, vertexCount);
+    std::vector<uint32_t> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        live[v] = adjacency.first[v + 1] - adjacency.first[v];
+    std::vector<uint64_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> deadEnds;
+    std::vector<unsigned int> candidates;
+    std::vector<unsigned int> result;
+    result.reserve(end - begin);
+    uint64_t time = kVertexCacheSize + 1;
+    size_t cursor = 0;
+
+    // the next vertex with triangles left, from the dead-end stack or else in input order
+    auto skipDeadEnd = [&]() -> long {
+        while (!deadEnds.empty()) {
+            unsigned int vertex = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[vertex] > 0)
+                return vertex;
+        }
+        for (; cursor < end - begin; ++cursor) {
+            unsigned int vertex = indices[begin + cursor];
+            if (live[vertex] > 0)
+                return vertex;
+        }
+        return -1;
+    };
+
+    long fan = skipDeadEnd();
+    bool restarted = true;
+    while (fan >= 0) {
+        if (restarted && restarts)
+            restarts->push_back((uint32_t)(result.size() / 3));
+        candidates.clear();
+        for (uint32_t i = adjacency.first[fan]; i < adjacency.first[fan + 1]; ++i) {
+            uint32_t triangle = adjacency.triangles[i];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+            for (int k = 0; k < 3; ++k) {
+                unsigned int vertex = indices[begin + triangle * 3 + k];
+                result.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+                if (time - cacheTime[vertex] > kVertexCacheSize)
+                    cacheTime[vertex] = time++;
+            }
+        }
+        // the candidate that will still be in the cache after its remaining triangles, oldest first
+        long next = -1;
+        long best = -1;
+        for (unsigned int vertex : candidates) {
+            if (live[vertex] == 0)
+                continue;
+            long priority = 0;
+            if (time - cacheTime[vertex] + 2 * live[vertex] <= kVertexCacheSize)
+                priority = (long)(time - cacheTime[vertex]);
+            if (priority > best) {
+                best = priority;
+                next = vertex;
+            }
+        }
+        restarted = next < 0;
+        fan = restarted ? skipDeadEnd() : next;
+    }
+    std::copy(result.begin(), result.end(), indices.begin() + begin);
+}
+
+// Reorders clusters of the (cache optimised) triangles so the ones facing outwards from the mesh
+// center are drawn first and hide the rest. `restarts` are the hard boundaries optimizeVertexCache()
+// reported; clusters are cut further where that keeps the ACMR within kOverdrawThreshold.
+inline void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices,
+                             const std::vector<uint32_t>& restarts) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+    // soft boundaries: inside each hard cluster, wherever the running ACMR is good enough
+    std::vector<uint32_t> clusters;
+    std::vector<bool> hard(triangleCount + 1, false);
+    for (uint32_t restart : restarts)
+        hard[restart] = true;
+    hard[0] = hard[triangleCount] = true;
+    detail::VertexCacheSimulator cache(vertices.size());
+    for (size_t start = 0; start < triangleCount;) {
+        size_t stop = start + 1;
+        while (!hard[stop])
+            stop++;
+        unsigned int misses = 0;
+        cache.reset();
+        for (size_t i = start * 3; i < stop * 3; ++i)
+            misses += cache.access(indices[i]) ? 1 : 0;
+        float clusterAcmr = (float)misses / (stop - start);
+        cache.reset();
+        misses = 0;
+        clusters.push_back(start);
+        for (size_t t = start; t < stop; ++t) {
+            for (int k = 0; k < 3; ++k)
+                misses += cache.access(indices[t * 3 + k]) ? 1 : 0;
+            size_t done = t + 1 - clusters.back();
+            if (t + 1 < stop && (float)misses / done <= clusterAcmr * kOverdrawThreshold) {
+                clusters.push_back(t + 1);
+                cache.reset();
+                misses = 0;
+            }
+        }
+        start = stop;
+    }
+    clusters.push_back(triangleCount);
+
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> centers(clusters.size() - 1), normals(clusters.size() - 1, glm::vec3(0.0f));
+    for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+        glm::vec3 center(0.0f);
+        float area = 0.0f;
+        for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+            const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(normal);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            area += triangleArea;
+            normals[c] += normal;
+        }
+        meshCenter += center;
+        meshArea += area;
+        centers[c] = area > 0.0f ? center / area : vertices[indices[clusters[c] * 3]].Position;
+        float length = glm::length(normals[c]);
+        normals[c] = length > 0.0f ? normals[c] / length : glm::vec3(0.0f);
+    }
+    if (meshArea > 0.0f)
+        meshCenter /= meshArea;
+
+    std::vector<uint32_t> order(clusters.size() - 1);
+    std::vector<float> outwards(order.size());
+    for (uint32_t c = 0; c < order.size(); ++c) {
+        order[c] = c;
+        outwards[c] = glm::dot(centers[c] - meshCenter, normals[c]);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return outwards[a] > outwards[b]; });
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order)
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    indices.swap(result);
+}
+
+// renumbers the vertices in the order the index buffer first uses them, unused ones are dropped
+inline void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+    const unsigned int unused = (unsigned int)-1;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+// the whole pipeline on a freshly imported mesh, with the cache stats of both ends
+inline MeshOptimization optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+    MeshOptimization result;
+    result.before = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    weldVertices(vertices, indices);
+    std::vector<uint32_t> restarts;
+    optimizeVertexCache(indices, 0, indices.size(), vertices.size(), &restarts);
+    optimizeOverdraw(indices, vertices, restarts);
+    optimizeVertexFetch(vertices, indices);
+    result.after = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    return result;
+}
+
+};
+#endif //PROJECT_BASE_MESHOPTIMIZER_H
@@ -0,0 +1,151 @@
+//
+// Parallel model loading: the CPU phase (Model::Import - cache/ASSIMP read) of every model runs
+// on the worker pool, the GL phase (Model::Upload) runs on the calling thread as soon as each
+// import is done, so uploads overlap with the remaining imports. Texture decodes are jobs of the
+// shared TextureCache on the same pool; finished ones are uploaded while waiting for imports.
+//
+
+#ifndef PROJECT_BASE_MODELLOADER_H
+#define PROJECT_BASE_MODELLOADER_H
+
+#include <learnopengl/model.h>
+#include <rg/TextureCache.h>
+#include <rg/ThreadPool.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rg {
+
+struct AssetTiming {
+    std::string path;
+    bool fromCache = false;
+    double importMs = 0.0;
+    double uploadMs = 0.0;
+    std::thread::id worker;
+};
+
+struct LoadReport {
+    std::vector<AssetTiming> assets;
+    unsigned int threads = 0;
+    double wallMs = 0.0;
+    double textureWaitMs = 0.0; // waiting for the last texture decodes after all models were uploaded
+    TextureCache::Stats textures;
+
+    // CPU time summed over all assets divided by the wall time; ~1 when loading is serial
+    double parallelism() const {
+        double total = 0.0;
+        for (const AssetTiming& asset : assets)
+            total += asset.importMs + asset.uploadMs;
+        total += textures.decodeMs;
+        return wallMs > 0.0 ? total / wallMs : 0.0;
+    }
+
+    void print() const {
+        std::map<std::thread::id, int> workerIndex;
+        printf("model loading on %u worker thread(s):\n", threads);
+        printf("  %-52s %-7s %6s %10s %10s\n", "asset", "source", "worker", "import ms", "upload ms");
+        for (const AssetTiming& asset : assets) {
+            int index = workerIndex.insert(std::make_pair(asset.worker, (int)workerIndex.size())).first->second;
+            printf("  %-52s %-7s %6d %10.1f %10.1f\n", asset.path.c_str(), asset.fromCache ? "cache" : "assimp",
+                   index, asset.importMs, asset.uploadMs);
+        }
+        printf("  textures: %u files (%u content duplicates), %.1f ms decode on workers, %.1f ms final wait\n",
+               textures.files, textures.contentHits, textures.decodeMs, textureWaitMs);
+        printf("  texture memory: %.1f MB, %u of %u textures block compressed\n",
+               textures.gpuBytes / (1024.0 * 1024.0), textures.compressed, textures.uploads);
+        printf("  total %.1f ms wall, parallelism %.2fx\n", wallMs, parallelism());
+    }
+};
+
+// Loads `paths` in parallel and returns the models in the same order.
+inline std::vector<Model> loadModels(const std::vector<std::string>& paths, ThreadPool& pool, LoadReport* report = nullptr) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+
+    std::vector<ModelData> imported(paths.size());
+    std::queue<size_t> finished;
+    std::mutex mutex;
+    std::condition_variable ready;
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        pool.submit([&, i] {
+            // a throwing import still has to finish its slot, or the loop below waits for it forever;
+            // the model is then uploaded empty like one Assimp couldn't read
+            ModelData data;
+            try {
+                data = Model::Import(paths[i]);
+            } catch (const std::exception& e) {
+                std::cout << "ERROR::MODEL_LOADER:: importing " << paths[i] << " failed: " << e.what() << std::endl;
+                data = ModelData();
+            } catch (...) {
+                std::cout << "ERROR::MODEL_LOADER:: importing " << paths[i] << " failed" << std::endl;
+                data = ModelData();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            imported[i] = std::move(data);
+            finished.push(i);
+            ready.notify_one();
+        });
+    }
+
+    TextureCache& textures = TextureCache::instance();
+    std::vector<Model> models(paths.size());
+    std::vector<AssetTiming> timings(paths.size());
+    for (size_t done = 0; done < paths.size(); ++done) {
+        size_t i;
+        // upload finished texture decodes while waiting for the next import
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!finished.empty()) {
+                    i = finished.front();
+                    finished.pop();
+                    break;
+                }
+            }
+            bool progress = textures.processUploads(1) > 0;
+            progress = textures.processUploadBytes() > 0 || progress;
+            if (!progress) {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait_for(lock, std::chrono::milliseconds(1), [&] { return !finished.empty(); });
+            }
+        }
+        AssetTiming& timing = timings[i];
+        timing.path = paths[i];
+        timing.fromCache = imported[i].cache != nullptr;
+        timing.importMs = imported[i].importMs;
+        timing.worker = imported[i].worker;
+
+        clock::time_point uploadStart = clock::now();
+        models[i].Upload(imported[i]);
+        timing.uploadMs = std::chrono::duration<double, std::milli>(clock::now() - uploadStart).count();
+    }
+
+    clock::time_point waitStart = clock::now();
+    textures.finish();
+    // every content duplicate is known now
+    for (Model& model : models)
+        model.resolveTextures();
+
+    if (report) {
+        report->textureWaitMs = std::chrono::duration<double, std::milli>(clock::now() - waitStart).count();
+        report->textures = textures.stats();
+        report->assets = timings;
+        report->threads = pool.size();
+        report->wallMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+    return models;
+}
+
+};
+#endif //PROJECT_BASE_MODELLOADER_H
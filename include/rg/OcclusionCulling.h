@@ -0,0 +1,200 @@
+//
+// Hardware occlusion culling with temporal coherence.
+//
+// After the opaque passes have filled the depth buffer, every object that passed the frustum test
+// gets its world box drawn (no color, no depth writes) inside a GL_ANY_SAMPLES_PASSED query. The
+// answer is never waited for: each frame starts by collecting the queries whose result is
+// available, and the next frames draw or skip the object by the latest answer. An object whose
+// query is still in flight keeps its previous state and gets no new query.
+//
+// Hidden objects are skipped, but their box is still tested, so they come back (one or two frames
+// late) once they are uncovered. Objects that weren't tested last frame (they just entered the
+// frustum) and objects whose box contains the camera, where the box would be clipped by the near
+// plane, always count as visible.
+//
+
+#ifndef PROJECT_BASE_OCCLUSIONCULLING_H
+#define PROJECT_BASE_OCCLUSIONCULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/GLState.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+struct OcclusionStats {
+    unsigned int tested = 0;    // objects asked about this frame
+    unsigned int occluded = 0;  // of those, skipped because their last result was "hidden"
+    unsigned int queries = 0;   // new queries issued this frame
+    unsigned int inFlight = 0;  // queries whose result hasn't come back yet
+};
+
+class OcclusionCuller {
+public:
+    // boxes are grown by this much (world units) so an object never hides behind its own surface
+    static constexpr float kBoxMargin = 0.05f;
+
+    bool enabled = true;
+
+    // `box` is the program that draws the cube: Frame block plus a `model` matrix
+    void create(Shader& box) {
+        m_Box = &box;
+        m_BoxModel = box.uniform<glm::mat4>("model");
+        // unit cube, 8 corners and 12 triangles
+        const float corners[24] = {0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1};
+        const unsigned char indices[36] = {0, 1, 2, 2, 3, 0, 4, 6, 5, 6, 4, 7, 0, 4, 5, 5, 1, 0,
+                                           3, 2, 6, 6, 7, 3, 0, 3, 7, 7, 4, 0, 1, 5, 6, 6, 2, 1};
+        glGenVertexArrays(1, &m_VAO);
+        glGenBuffers(1, &m_VBO);
+        glGenBuffers(1, &m_EBO);
+        glBindVertexArray(m_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+    }
+
+    // call before the context is destroyed
+    void release() {
+        for (NodeState& state : m_States)
+            if (state.query)
+                glDeleteQueries(1, &state.query);
+        m_States.clear();
+        m_InFlight.clear();
+        if (m_VAO) {
+            glDeleteVertexArrays(1, &m_VAO);
+            glDeleteBuffers(1, &m_VBO);
+            glDeleteBuffers(1, &m_EBO);
+        }
+        m_VAO = m_VBO = m_EBO = 0;
+    }
+
+    // starts a frame for a scene of `nodes` nodes seen from `eye`: picks up every result that is ready
+    void beginFrame(size_t nodes, const glm::vec3& eye) {
+        m_Frame++;
+        m_Eye = eye;
+        m_Stats = OcclusionStats();
+        m_Tests.clear();
+        if (m_States.size() < nodes)
+            m_States.resize(nodes);
+        size_t kept = 0;
+        for (uint32_t node : m_InFlight) {
+            NodeState& state = m_States[node];
+            GLuint available = 0;
+            glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                m_InFlight[kept++] = node;
+                continue;
+            }
+            GLuint anySamples = 0;
+            glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &anySamples);
+            state.visible = anySamples != 0;
+            state.pending = false;
+        }
+        m_InFlight.resize(kept);
+    }
+
+    // whether `node` (world box `box`, already inside the frustum) should be drawn this frame.
+    // Also queues its box for the queries issued by issueQueries().
+    bool visible(uint32_t node, const AABB& box) {
+        if (!enabled)
+            return true;
+        m_Stats.tested++;
+        NodeState& state = m_States[node];
+        bool tracked = state.lastTested + 1 == m_Frame;
+        AABB grown = box;
+        grown.min -= glm::vec3(kBoxMargin);
+        grown.max += glm::vec3(kBoxMargin);
+        bool inside = true;
+        for (int axis = 0; axis < 3; ++axis)
+            inside = inside && m_Eye[axis] >= grown.min[axis] && m_Eye[axis] <= grown.max[axis];
+        state.lastTested = m_Frame;
+        if (inside) {
+            // no query could see it, and it can't be hidden anyway
+            state.visible = true;
+            return true;
+        }
+        m_Tests.push_back({node, grown});
+        if (!tracked)
+            state.visible = true;
+        if (!state.visible)
+            m_Stats.occluded++;
+        return state.visible;
+    }
+
+    // draws the queued boxes against the current depth buffer, one query each. Call after the
+    // opaque geometry, with the framebuffer that holds its depth bound.
+    void issueQueries(GLStateCache& glState) {
+        if (!enabled || m_Tests.empty()) {
+            m_Stats.inFlight = m_InFlight.size();
+            return;
+        }
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        glState.useProgram(m_Box->ID);
+        glState.bindVertexArray(m_VAO);
+        for (const Test& test : m_Tests) {
+            NodeState& state = m_States[test.node];
+            if (state.pending)
+                continue;
+            if (!state.query)
+                glGenQueries(1, &state.query);
+            // the unit cube scaled and moved onto the box
+            glm::mat4 model(1.0f);
+            glm::vec3 size = test.box.max - test.box.min;
+            model[0][0] = size.x;
+            model[1][1] = size.y;
+            model[2][2] = size.z;
+            model[3] = glm::vec4(test.box.min, 1.0f);
+            m_BoxModel.set(model);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, state.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            state.pending = true;
+            m_InFlight.push_back(test.node);
+            m_Stats.queries++;
+        }
+        glEnable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        m_Stats.inFlight = m_InFlight.size();
+    }
+
+    const OcclusionStats& stats() const {
+        return m_Stats;
+    }
+
+private:
+    struct NodeState {
+        GLuint query = 0;
+        bool pending = false;
+        bool visible = true;   // latest answer
+        uint64_t lastTested = 0;
+    };
+    struct Test {
+        uint32_t node;
+        AABB box;
+    };
+
+    Shader* m_Box = nullptr; // its ID changes when the shaders are reloaded
+    Uniform<glm::mat4> m_BoxModel;
+    GLuint m_VAO = 0, m_VBO = 0, m_EBO = 0;
+    std::vector<NodeState> m_States;  // by scene graph node
+    std::vector<uint32_t> m_InFlight; // nodes with a pending query
+    std::vector<Test> m_Tests;
+    glm::vec3 m_Eye = glm::vec3(0.0f);
+    uint64_t m_Frame = 0;
+    OcclusionStats m_Stats;
+};
+
+};
+#endif //PROJECT_BASE_OCCLUSIONCULLING_H
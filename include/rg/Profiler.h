@@ -0,0 +1,333 @@
+//
+// Scoped CPU/GPU profiler.
+//
+// ProfileScope marks a part of the frame; scopes nest into a tree under the "frame" root opened
+// by beginFrame(). Each scope takes the CPU time (steady clock) and the GPU time between two
+// GL_TIMESTAMP queries issued where it opens and closes. Timestamps rather than GL_TIME_ELAPSED:
+// elapsed queries can't nest, and the shadow cascades keep theirs running inside the shadows scope.
+//
+// Queries are kept per frame for kProfilerFrames frames. A frame's results are only read when the
+// same slot comes round again and only if they are already available, so the profiler never waits
+// for the GPU; a frame whose results aren't ready by then is dropped. What is shown is therefore
+// kProfilerFrames frames old.
+//
+// The resolved frames can be captured into a Chrome trace (chrome://tracing, Perfetto) with one
+// track for the CPU and one for the GPU, the GPU scopes placed relative to the start of their frame.
+//
+
+#ifndef PROJECT_BASE_PROFILER_H
+#define PROJECT_BASE_PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+// frames the queries of one frame stay in flight for
+const int kProfilerFrames = 3;
+// scopes per frame, deeper or later ones are not recorded
+const unsigned int kProfilerMaxScopes = 64;
+// frames kept for the rolling graphs
+const int kProfilerHistory = 240;
+
+struct ProfileScopeResult {
+    const char* name;
+    int depth;                // 0 is the frame
+    double cpuStartMs, cpuMs; // start relative to the frame
+    double gpuStartMs, gpuMs; // -1 without timer queries
+    double cpuAverageMs, gpuAverageMs;
+};
+
+struct ProfileFrame {
+    uint64_t number = 0;
+    std::vector<ProfileScopeResult> scopes; // depth first, a scope's children follow it
+};
+
+class Profiler {
+public:
+    // smoothing of the averages shown next to the latest values
+    static constexpr double kAverageWeight = 0.05;
+
+    bool enabled = true;
+
+    // call with the context current
+    void create() {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        if (bits > 0) {
+            for (Slot& slot : m_Slots) {
+                slot.queries.resize(kProfilerMaxScopes * 2);
+                glGenQueries((GLsizei)slot.queries.size(), slot.queries.data());
+            }
+        }
+        m_Epoch = clock::now();
+        m_CpuHistory.assign(kProfilerHistory, 0.0f);
+        m_GpuHistory.assign(kProfilerHistory, 0.0f);
+    }
+
+    // call before the context is destroyed
+    void release() {
+        for (Slot& slot : m_Slots) {
+            if (!slot.queries.empty())
+                glDeleteQueries((GLsizei)slot.queries.size(), slot.queries.data());
+            slot = Slot();
+        }
+    }
+
+    // collects the slot's results from kProfilerFrames frames ago if they are ready, opens the frame scope
+    void beginFrame() {
+        m_InFrame = enabled;
+        if (!enabled)
+            return;
+        m_Current = (m_Current + 1) % kProfilerFrames;
+        Slot& slot = m_Slots[m_Current];
+        if (slot.pending) {
+            if (available(slot))
+                resolve(slot);
+            else
+                m_Dropped++;
+        }
+        slot.records.clear();
+        slot.pending = false;
+        slot.number = m_Frame++;
+        slot.start = clock::now();
+        m_Stack.clear();
+        push("frame");
+    }
+
+    // closes the frame scope
+    void endFrame() {
+        if (!m_InFrame)
+            return;
+        while (!m_Stack.empty())
+            pop();
+        m_Slots[m_Current].pending = true;
+        m_InFrame = false;
+    }
+
+    // `name` has to outlive the profiler, a string literal
+    void push(const char* name) {
+        if (!m_InFrame)
+            return;
+        Slot& slot = m_Slots[m_Current];
+        if (slot.records.size() >= kProfilerMaxScopes) {
+            m_Stack.push_back(-1);
+            return;
+        }
+        Record record;
+        record.name = name;
+        record.depth = (int)m_Stack.size();
+        record.cpuStart = clock::now();
+        m_Stack.push_back((int)slot.records.size());
+        if (!slot.queries.empty())
+            glQueryCounter(slot.queries[slot.records.size() * 2], GL_TIMESTAMP);
+        slot.records.push_back(record);
+    }
+
+    void pop() {
+        if (!m_InFrame || m_Stack.empty())
+            return;
+        int index = m_Stack.back();
+        m_Stack.pop_back();
+        if (index < 0)
+            return;
+        Slot& slot = m_Slots[m_Current];
+        slot.records[index].cpuEnd = clock::now();
+        if (!slot.queries.empty())
+            glQueryCounter(slot.queries[index * 2 + 1], GL_TIMESTAMP);
+    }
+
+    // the newest frame with results
+    const ProfileFrame& latest() const {
+        return m_Latest;
+    }
+    // frame times of the last kProfilerHistory resolved frames, oldest first from historyOffset()
+    const std::vector<float>& cpuHistory() const {
+        return m_CpuHistory;
+    }
+    const std::vector<float>& gpuHistory() const {
+        return m_GpuHistory;
+    }
+    int historyOffset() const {
+        return m_HistoryNext;
+    }
+    // frames whose results weren't ready in time
+    uint64_t dropped() const {
+        return m_Dropped;
+    }
+
+    // captures the next `frames` resolved frames (0: until finishTrace()) and then writes them to `path`
+    void startTrace(const std::string& path, unsigned int frames = 0) {
+        m_TracePath = path;
+        m_TraceFrames = frames;
+        m_TracedFrames = 0;
+        m_Trace.clear();
+        m_Tracing = true;
+    }
+    bool tracing() const {
+        return m_Tracing;
+    }
+    unsigned int tracedFrames() const {
+        return m_TracedFrames;
+    }
+
+    // writes the captured frames as a Chrome trace. False if nothing was traced or the file can't be written.
+    bool finishTrace() {
+        if (!m_Tracing)
+            return false;
+        m_Tracing = false;
+        std::ofstream out(m_TracePath);
+        if (!out) {
+            std::cout << "ERROR::PROFILER:: can't write " << m_TracePath << std::endl;
+            return false;
+        }
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n";
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+        out.setf(std::ios::fixed);
+        out.precision(3);
+        for (const TraceEvent& event : m_Trace) {
+            out << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << (event.gpu ? "gpu" : "cpu")
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << (event.gpu ? 2 : 1) << ", \"ts\": " << event.startUs
+                << ", \"dur\": " << event.durationUs << ", \"args\": {\"frame\": " << event.frame << "}}";
+        }
+        out << "\n]}\n";
+        std::cout << "profiler: wrote " << m_TracedFrames << " frames to " << m_TracePath << std::endl;
+        m_Trace.clear();
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Record {
+        const char* name;
+        int depth;
+        clock::time_point cpuStart, cpuEnd;
+    };
+    struct Slot {
+        std::vector<GLuint> queries; // begin and end timestamp per record, empty without timer queries
+        std::vector<Record> records;
+        clock::time_point start;
+        uint64_t number = 0;
+        bool pending = false;
+    };
+    struct TraceEvent {
+        const char* name;
+        bool gpu;
+        double startUs, durationUs;
+        uint64_t frame;
+    };
+    struct Average {
+        double cpuMs = -1.0, gpuMs = -1.0;
+    };
+
+    Slot m_Slots[kProfilerFrames];
+    int m_Current = 0;
+    uint64_t m_Frame = 0;
+    uint64_t m_Dropped = 0;
+    bool m_InFrame = false;
+    std::vector<int> m_Stack; // open records, -1 for scopes past kProfilerMaxScopes
+    ProfileFrame m_Latest;
+    std::unordered_map<const char*, Average> m_Averages; // by name
+    std::vector<float> m_CpuHistory, m_GpuHistory;
+    int m_HistoryNext = 0;
+    clock::time_point m_Epoch;
+
+    std::string m_TracePath;
+    bool m_Tracing = false;
+    unsigned int m_TraceFrames = 0, m_TracedFrames = 0;
+    std::vector<TraceEvent> m_Trace;
+
+    static double ms(clock::time_point from, clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    bool available(const Slot& slot) const {
+        if (slot.queries.empty() || slot.records.empty())
+            return true;
+        // the frame's end timestamp is the last one issued
+        GLuint ready = 0;
+        glGetQueryObjectuiv(slot.queries[1], GL_QUERY_RESULT_AVAILABLE, &ready);
+        return ready != 0;
+    }
+
+    void resolve(const Slot& slot) {
+        m_Latest.number = slot.number;
+        m_Latest.scopes.clear();
+        GLuint64 frameStart = 0;
+        for (size_t i = 0; i < slot.records.size(); ++i) {
+            const Record& record = slot.records[i];
+            ProfileScopeResult result;
+            result.name = record.name;
+            result.depth = record.depth;
+            result.cpuStartMs = ms(slot.start, record.cpuStart);
+            result.cpuMs = ms(record.cpuStart, record.cpuEnd);
+            result.gpuStartMs = result.gpuMs = -1.0;
+            if (!slot.queries.empty()) {
+                GLuint64 start = 0, end = 0;
+                glGetQueryObjectui64v(slot.queries[i * 2], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(slot.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+                if (i == 0)
+                    frameStart = start;
+                result.gpuStartMs = start > frameStart ? (double)(start - frameStart) / 1e6 : 0.0;
+                result.gpuMs = end > start ? (double)(end - start) / 1e6 : 0.0;
+            }
+            Average& average = m_Averages[record.name];
+            average.cpuMs = average.cpuMs < 0.0 ? result.cpuMs
+                                                : average.cpuMs + (result.cpuMs - average.cpuMs) * kAverageWeight;
+            average.gpuMs = average.gpuMs < 0.0 ? result.gpuMs
+                                                : average.gpuMs + (result.gpuMs - average.gpuMs) * kAverageWeight;
+            result.cpuAverageMs = average.cpuMs;
+            result.gpuAverageMs = average.gpuMs;
+            m_Latest.scopes.push_back(result);
+        }
+        if (m_Latest.scopes.empty())
+            return;
+        m_CpuHistory[m_HistoryNext] = (float)m_Latest.scopes[0].cpuMs;
+        m_GpuHistory[m_HistoryNext] = (float)std::max(m_Latest.scopes[0].gpuMs, 0.0);
+        m_HistoryNext = (m_HistoryNext + 1) % kProfilerHistory;
+        if (m_Tracing)
+            trace(slot);
+    }
+
+    void trace(const Slot& slot) {
+        double frameUs = ms(m_Epoch, slot.start) * 1000.0;
+        for (const ProfileScopeResult& scope : m_Latest.scopes) {
+            m_Trace.push_back({scope.name, false, frameUs + scope.cpuStartMs * 1000.0, scope.cpuMs * 1000.0,
+                               slot.number});
+            if (scope.gpuMs >= 0.0)
+                m_Trace.push_back({scope.name, true, frameUs + scope.gpuStartMs * 1000.0, scope.gpuMs * 1000.0,
+                                   slot.number});
+        }
+        if (++m_TracedFrames == m_TraceFrames)
+            finishTrace();
+    }
+};
+
+// profiles the enclosing block
+class ProfileScope {
+public:
+    ProfileScope(Profiler& profiler, const char* name) : m_Profiler(profiler) {
+        m_Profiler.push(name);
+    }
+    ~ProfileScope() {
+        m_Profiler.pop();
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    Profiler& m_Profiler;
+};
+
+};
+#endif //PROJECT_BASE_PROFILER_H
@@ -0,0 +1,316 @@
+//
+// Per-frame render queue.
+//
+// Instead of drawing in the order the render loop is written, meshes are submitted as DrawItems
+// and flushed once: sorted by a packed 64 bit key so draws sharing a program, then a material
+// (texture set), then a VAO end up next to each other, and submitted through a GLStateCache
+// that drops the binds that wouldn't change anything.
+//
+// Key layout, most significant first:
+//   63..60  layer     (opaque, then alpha tested, then everything else)
+//   59..48  program
+//   47..24  material  (hash of the texture ids)
+//   23..8   VAO
+//    7..0   view depth (front to back among draws sharing all of the above)
+//
+// Programs and VAOs go into the key as the order they were first submitted in since the last
+// flush, not as their GL names, so names above the field widths don't collide. Grouping is all the
+// key is for; past 4096 programs or 65536 VAOs in a frame the last index is shared, which costs
+// state changes but never draws anything wrong.
+//
+// Opaque materials are split from alpha tested ones (diffuse texture with transparent texels):
+// only the latter are drawn with a program that has `discard`, everything else keeps early-Z.
+// With a depth pre-pass the opaque layer is first drawn depth only, nearest first, and then
+// shaded against that depth with GL_LEQUAL and depth writes off, so every pixel is shaded once.
+//
+// Items carry the level of detail they are drawn with; a level is an index range of the mesh's
+// own index buffer, so levels of one mesh share the key and still sort next to each other.
+//
+
+#ifndef PROJECT_BASE_RENDERQUEUE_H
+#define PROJECT_BASE_RENDERQUEUE_H
+
+#include <learnopengl/model.h>
+#include <rg/GLState.h>
+#include <rg/InstanceBuffer.h>
+#include <rg/Lod.h>
+#include <rg/TextureCache.h>
+#include <rg/Uniform.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+enum class RenderLayer : uint64_t {
+    Opaque = 0,
+    AlphaTested = 1,
+    Transparent = 8,
+};
+
+struct DrawItem {
+    uint64_t key;
+    Shader* shader;
+    Mesh* mesh;
+    GLint modelLocation;              // -1 for instanced items
+    GLint normalMatrixLocation;       // -1 for instanced items and programs without normals
+    glm::mat4 transform;
+    const InstanceBuffer* instances;  // null for single draws
+    float depth;                      // view depth of the mesh center, 0 for instanced items
+    unsigned int lod;                 // level of detail, clamped to the levels the mesh has
+};
+
+// the programs opaque geometry is drawn with: `alphaTested*` are built with ALPHA_TEST (they discard
+// transparent texels), the others aren't and keep early-Z
+struct OpaquePrograms {
+    Shader* opaque;
+    Uniform<glm::mat4> opaqueModel;
+    Uniform<glm::mat3> opaqueNormalMatrix;
+    Shader* opaqueInstanced;
+    Shader* alphaTested;
+    Uniform<glm::mat4> alphaTestedModel;
+    Uniform<glm::mat3> alphaTestedNormalMatrix;
+    Shader* alphaTestedInstanced;
+};
+
+// whether the mesh needs the alpha test, i.e. its diffuse texture has transparent texels
+inline bool alphaTested(const Mesh& mesh) {
+    for (const Texture& texture : mesh.textures)
+        if (texture.type == "texture_diffuse")
+            return TextureCache::instance().transparent(texture.id);
+    return false;
+}
+
+inline uint32_t materialKey(const std::vector<Texture>& textures) {
+    uint32_t hash = 2166136261u;
+    for (const Texture& texture : textures)
+        hash = (hash ^ texture.id) * 16777619u;
+    return (hash ^ (hash >> 24)) & 0xFFFFFFu;
+}
+
+// `program` and `vertexArray` are the per frame indices described above, not GL names
+inline uint64_t makeSortKey(RenderLayer layer, uint32_t program, uint32_t material, uint32_t vertexArray,
+                            uint32_t depth = 0) {
+    return (uint64_t)layer << 60 | (uint64_t)std::min(program, 0xFFFu) << 48
+           | (uint64_t)(material & 0xFFFFFFu) << 24 | (uint64_t)std::min(vertexArray, 0xFFFFu) << 8
+           | (depth & 0xFFu);
+}
+
+// per-frame counts of the opaque pipeline
+struct OpaqueStats {
+    unsigned int opaque = 0;       // draw items without the alpha test
+    unsigned int alphaTested = 0;
+    unsigned int prepassDraws = 0;
+};
+
+class RenderQueue {
+public:
+    // camera the depth of the following submits is measured from; `far` maps to the last depth bucket
+    void setView(const glm::vec3& position, const glm::vec3& forward, float far) {
+        m_ViewPosition = position;
+        m_ViewForward = forward;
+        m_Far = far;
+    }
+
+    // every mesh of `model` once, with `transform` in the shader's `model` uniform and its
+    // normalMatrix() in `normalMatrixUniform` (if the shader has one)
+    void submit(Shader& shader, const Uniform<glm::mat4>& modelUniform, const Uniform<glm::mat3>& normalMatrixUniform,
+                Model& model, const glm::mat4& transform, RenderLayer layer = RenderLayer::Opaque,
+                unsigned int lod = 0) {
+        for (Mesh& mesh : model.meshes)
+            submit(shader, modelUniform, normalMatrixUniform, mesh, transform, layer, lod);
+    }
+
+    // a single mesh, e.g. the visible part of a model
+    void submit(Shader& shader, const Uniform<glm::mat4>& modelUniform, const Uniform<glm::mat3>& normalMatrixUniform,
+                Mesh& mesh, const glm::mat4& transform, RenderLayer layer = RenderLayer::Opaque,
+                unsigned int lod = 0) {
+        float depth = glm::dot(glm::vec3(transform * glm::vec4(mesh.bounds.center(), 1.0f)) - m_ViewPosition,
+                               m_ViewForward);
+        m_Items.push_back({key(layer, shader, mesh, depth), &shader, &mesh, modelUniform.location(),
+                           normalMatrixUniform.location(), transform, nullptr, depth, lod});
+    }
+
+    // every mesh of `model` once per transform in `instances`, one draw per mesh
+    void submitInstanced(Shader& shader, Model& model, const InstanceBuffer& instances,
+                         RenderLayer layer = RenderLayer::Opaque, unsigned int lod = 0) {
+        for (Mesh& mesh : model.meshes)
+            submitInstanced(shader, mesh, instances, layer, lod);
+    }
+
+    // one mesh once per transform in `instances`
+    void submitInstanced(Shader& shader, Mesh& mesh, const InstanceBuffer& instances,
+                         RenderLayer layer = RenderLayer::Opaque, unsigned int lod = 0) {
+        if (instances.count() == 0)
+            return;
+        m_Items.push_back({key(layer, shader, mesh, 0.0f), &shader, &mesh, -1, -1, glm::mat4(1.0f), &instances,
+                           0.0f, lod});
+    }
+
+    // a mesh of opaque geometry, with the program (and layer) its material needs
+    void submitOpaque(const OpaquePrograms& programs, Mesh& mesh, const glm::mat4& transform, unsigned int lod = 0) {
+        if (alphaTested(mesh))
+            submit(*programs.alphaTested, programs.alphaTestedModel, programs.alphaTestedNormalMatrix, mesh, transform,
+                   RenderLayer::AlphaTested, lod);
+        else
+            submit(*programs.opaque, programs.opaqueModel, programs.opaqueNormalMatrix, mesh, transform,
+                   RenderLayer::Opaque, lod);
+    }
+
+    void submitOpaqueInstanced(const OpaquePrograms& programs, Model& model, const InstanceBuffer& instances,
+                               unsigned int lod = 0) {
+        for (Mesh& mesh : model.meshes) {
+            if (alphaTested(mesh))
+                submitInstanced(*programs.alphaTestedInstanced, mesh, instances, RenderLayer::AlphaTested, lod);
+            else
+                submitInstanced(*programs.opaqueInstanced, mesh, instances, RenderLayer::Opaque, lod);
+        }
+    }
+
+    size_t size() const {
+        return m_Items.size();
+    }
+
+    // draws the opaque layer depth only, nearest first, with `depth` (a `model` uniform) and
+    // `depthInstanced`, which have to compute gl_Position exactly like the shading programs
+    // (invariant, same expression). Call before flush(..., true).
+    void depthPrepass(GLStateCache& state, Shader& depth, const Uniform<glm::mat4>& depthModel,
+                      Shader& depthInstanced) {
+        m_Order.clear();
+        for (uint32_t i = 0; i < m_Items.size(); ++i)
+            if (m_Items[i].key >> 60 == (uint64_t)RenderLayer::Opaque)
+                m_Order.push_back(i);
+        std::sort(m_Order.begin(), m_Order.end(),
+                  [this](uint32_t a, uint32_t b) { return m_Items[a].depth < m_Items[b].depth; });
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (uint32_t index : m_Order) {
+            const DrawItem& item = m_Items[index];
+            Mesh& mesh = *item.mesh;
+            state.useProgram(item.instances ? depthInstanced.ID : depth.ID);
+            state.bindVertexArray(mesh.VAO);
+            drawGeometry(state, item, depthModel.location(), -1);
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        m_Stats.prepassDraws = m_Order.size();
+    }
+
+    // sorts and draws everything submitted since the last flush, then empties the queue.
+    // `depthPrepassed`: depthPrepass() already laid down the opaque layer's depth.
+    // The storage is kept, so a steady frame doesn't allocate.
+    void flush(GLStateCache& state, bool depthPrepassed = false) {
+        std::sort(m_Items.begin(), m_Items.end(),
+                  [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+        if (depthPrepassed) {
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        bool opaqueLayer = true;
+        for (const DrawItem& item : m_Items) {
+            if (opaqueLayer && item.key >> 60 != (uint64_t)RenderLayer::Opaque) {
+                opaqueLayer = false;
+                if (depthPrepassed) {
+                    glDepthFunc(GL_LESS);
+                    glDepthMask(GL_TRUE);
+                }
+            }
+            if (item.key >> 60 == (uint64_t)RenderLayer::Opaque)
+                m_Stats.opaque++;
+            else if (item.key >> 60 == (uint64_t)RenderLayer::AlphaTested)
+                m_Stats.alphaTested++;
+            draw(state, item);
+        }
+        if (depthPrepassed && opaqueLayer) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+        m_Items.clear();
+        m_Programs.reset();
+        m_VertexArrays.reset();
+    }
+
+    // counts of the last flush; reset with resetStats() at the start of a frame
+    const OpaqueStats& stats() const {
+        return m_Stats;
+    }
+    void resetStats() {
+        m_Stats = OpaqueStats();
+    }
+
+private:
+    // numbers GL names in the order they are first seen since the last reset(). Slots are indexed by
+    // the name and kept between frames, so a steady frame doesn't allocate.
+    class DenseIndex {
+    public:
+        uint32_t operator()(GLuint name) {
+            if (name >= m_Slots.size())
+                m_Slots.resize(name + 1);
+            Slot& slot = m_Slots[name];
+            if (slot.generation != m_Generation) {
+                slot.generation = m_Generation;
+                slot.index = m_Count++;
+            }
+            return slot.index;
+        }
+        void reset() {
+            m_Generation++;
+            m_Count = 0;
+        }
+
+    private:
+        struct Slot {
+            uint32_t generation = 0;
+            uint32_t index = 0;
+        };
+        std::vector<Slot> m_Slots;
+        uint32_t m_Generation = 1;
+        uint32_t m_Count = 0;
+    };
+
+    std::vector<DrawItem> m_Items;
+    std::vector<uint32_t> m_Order;
+    DenseIndex m_Programs;
+    DenseIndex m_VertexArrays;
+    glm::vec3 m_ViewPosition = glm::vec3(0.0f);
+    glm::vec3 m_ViewForward = glm::vec3(0.0f, 0.0f, -1.0f);
+    float m_Far = 100.0f;
+    OpaqueStats m_Stats;
+
+    uint64_t key(RenderLayer layer, Shader& shader, const Mesh& mesh, float depth) {
+        uint32_t bucket = (uint32_t)(std::min(std::max(depth / m_Far, 0.0f), 1.0f) * 255.0f);
+        return makeSortKey(layer, m_Programs(shader.ID), materialKey(mesh.textures), m_VertexArrays(mesh.VAO), bucket);
+    }
+
+    static void draw(GLStateCache& state, const DrawItem& item) {
+        Mesh& mesh = *item.mesh;
+        state.useProgram(item.shader->ID);
+        const std::vector<GLint>& samplers = mesh.SamplerLocations(*item.shader);
+        for (unsigned int i = 0; i < mesh.textures.size(); ++i) {
+            state.setSampler(samplers[i], i);
+            state.bindTexture(i, GL_TEXTURE_2D, mesh.textures[i].id);
+        }
+        state.bindVertexArray(mesh.VAO);
+        drawGeometry(state, item, item.modelLocation, item.normalMatrixLocation);
+    }
+
+    static void drawGeometry(GLStateCache& state, const DrawItem& item, GLint modelLocation,
+                             GLint normalMatrixLocation) {
+        Mesh& mesh = *item.mesh;
+        const MeshLod& range = lodRange(mesh.lods, item.lod);
+        const void* offset = (const void*)(range.firstIndex * sizeof(unsigned int));
+        if (item.instances) {
+            mesh.AttachInstances(*item.instances);
+            glDrawElementsInstanced(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, offset, item.instances->count());
+            state.countDraw(item.instances->count(), range.indexCount / 3);
+        } else {
+            uploadUniform(modelLocation, item.transform);
+            if (normalMatrixLocation >= 0)
+                uploadUniform(normalMatrixLocation, normalMatrix(item.transform));
+            glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, offset);
+            state.countDraw(1, range.indexCount / 3);
+        }
+    }
+};
+
+};
+#endif //PROJECT_BASE_RENDERQUEUE_H
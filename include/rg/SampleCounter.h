@@ -0,0 +1,91 @@
+//
+// Counts the fragments a part of the frame shades.
+//
+// begin()/end() wrap the passes with a GL_SAMPLES_PASSED query: every sample that passes the depth
+// test is counted, so with early-Z that is the number of fragment shader invocations that reached
+// the framebuffer. Queries rotate through a small ring and are only read once the result is
+// available, a few frames late, so counting never stalls the CPU; a frame whose slot is still
+// in flight simply isn't counted.
+//
+
+#ifndef PROJECT_BASE_SAMPLECOUNTER_H
+#define PROJECT_BASE_SAMPLECOUNTER_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+namespace rg {
+
+class SampleCounter {
+public:
+    static const int kQueries = 4;
+
+    void create() {
+        glGenQueries(kQueries, m_Queries);
+    }
+
+    // call before the context is destroyed
+    void release() {
+        if (m_Queries[0])
+            glDeleteQueries(kQueries, m_Queries);
+        for (int i = 0; i < kQueries; ++i) {
+            m_Queries[i] = 0;
+            m_Pending[i] = false;
+        }
+    }
+
+    void begin() {
+        collect();
+        m_Active = !m_Pending[m_Next];
+        if (m_Active)
+            glBeginQuery(GL_SAMPLES_PASSED, m_Queries[m_Next]);
+    }
+
+    void end() {
+        if (!m_Active)
+            return;
+        glEndQuery(GL_SAMPLES_PASSED);
+        m_Pending[m_Next] = true;
+        m_Frame[m_Next] = m_Issued++;
+        m_Next = (m_Next + 1) % kQueries;
+        m_Active = false;
+    }
+
+    // the newest result that came back, 0 until the first one does
+    uint64_t samples() const {
+        return m_Samples;
+    }
+
+private:
+    GLuint m_Queries[kQueries] = {};
+    bool m_Pending[kQueries] = {};
+    uint64_t m_Frame[kQueries] = {};
+    uint64_t m_Issued = 0;
+    uint64_t m_Latest = 0;   // issue number of the result in m_Samples, + 1
+    uint64_t m_Samples = 0;
+    int m_Next = 0;
+    bool m_Active = false;
+
+    // reads every query whose result is ready, without waiting
+    void collect() {
+        for (int i = 0; i < kQueries; ++i) {
+            if (!m_Pending[i])
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(m_Queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint64 samples = 0;
+            glGetQueryObjectui64v(m_Queries[i], GL_QUERY_RESULT, &samples);
+            m_Pending[i] = false;
+            if (m_Frame[i] + 1 > m_Latest) {
+                m_Latest = m_Frame[i] + 1;
+                m_Samples = samples;
+            }
+        }
+    }
+};
+
+};
+#endif //PROJECT_BASE_SAMPLECOUNTER_H
@@ -0,0 +1,99 @@
+//
+// A loaded scene: the models of a scene description, the scene graph placing them and the
+// instance batches of the nodes that are drawn instanced.
+//
+// loadScene() reads the description (compiled form when it is up to date), loads the models
+// through loadModels(), so meshes come from the mesh cache and textures from the shared texture
+// cache, and then builds the graph and the batches in one pass over the nodes.
+//
+
+#ifndef PROJECT_BASE_SCENE_H
+#define PROJECT_BASE_SCENE_H
+
+#include <rg/InstanceBuffer.h>
+#include <rg/Lod.h>
+#include <rg/ModelLoader.h>
+#include <rg/SceneFile.h>
+#include <rg/SceneGraph.h>
+
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// the visible instances of one model, uploaded and drawn once per frame, one buffer per level of detail
+struct InstanceBatch {
+    Model* model;
+    InstanceBuffer buffers[kMaxLodLevels];
+    std::vector<glm::mat4> visible[kMaxLodLevels];
+};
+
+class Scene {
+public:
+    SceneDescription description;
+    std::vector<Model> models; // same order as description.models
+    SceneGraph graph;
+    std::vector<InstanceBatch> batches;
+
+    Scene() = default;
+    // the graph and the batches point into `models`
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    Model* model(const std::string& id) {
+        uint32_t index = description.findModel(id);
+        return index != SceneGraph::kNone ? &models[index] : nullptr;
+    }
+
+    // adds a node to the graph, instanced nodes also get a batch for their model
+    uint32_t place(const std::string& name, uint32_t parent, const Transform& local, Model* model = nullptr,
+                   uint32_t flags = 0) {
+        if (model && (flags & SceneGraph::kInstanced)) {
+            uint32_t index = model - models.data();
+            if (m_BatchOfModel.size() < models.size())
+                m_BatchOfModel.resize(models.size(), SceneGraph::kNone);
+            if (m_BatchOfModel[index] == SceneGraph::kNone) {
+                m_BatchOfModel[index] = batches.size();
+                batches.push_back(InstanceBatch());
+                batches.back().model = model;
+            }
+        }
+        return graph.add(name, parent, local, model, flags);
+    }
+
+    // batch the node is drawn through; only valid for instanced nodes
+    InstanceBatch& batch(uint32_t node) {
+        return batches[m_BatchOfModel[graph.model(node) - models.data()]];
+    }
+
+    void release() {
+        for (InstanceBatch& batch : batches)
+            for (InstanceBuffer& buffer : batch.buffers)
+                buffer.release();
+    }
+
+private:
+    std::vector<uint32_t> m_BatchOfModel;
+};
+
+// Loads the scene at `path` into `scene`, which has to be empty. Returns false when the description
+// can't be read; models that fail to load are reported by the model loader and stay empty.
+inline bool loadScene(const std::string& path, ThreadPool& pool, Scene& scene, LoadReport* report = nullptr) {
+    if (!readScene(path, scene.description))
+        return false;
+    std::vector<std::string> paths;
+    for (const SceneModelRef& model : scene.description.models)
+        paths.push_back(model.path);
+    scene.models = loadModels(paths, pool, report);
+
+    // description node indices map one to one to graph nodes, parents always come first
+    for (const SceneNodeDesc& node : scene.description.nodes) {
+        Model* model = node.model != SceneGraph::kNone ? &scene.models[node.model] : nullptr;
+        scene.place(node.name, node.parent, node.transform, model, node.flags);
+    }
+    scene.graph.update();
+    return true;
+}
+
+};
+#endif //PROJECT_BASE_SCENE_H
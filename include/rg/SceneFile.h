@@ -0,0 +1,561 @@
+//
+// Scene description files.
+//
+// A .scene file is the text form for authoring: the models the scene uses, the nodes placing
+// them, the vegetation billboards and the lights, one entry per line:
+//
+//   model <id> <path>
+//   group <name> <parent> [transform]
+//   object <name> <parent> <model id> [transform] [instanced]
+//   billboard [transform]
+//   dirlight direction x y z ambient r g b diffuse r g b specular r g b
+//   spotlight ambient r g b diffuse r g b specular r g b attenuation c l q cutoff inner outer
+//   light position x y z color r g b radius r
+//
+// where [transform] is any of `position x y z`, `rotation x y z` (degrees, yaw/pitch/roll order of
+// rotationDegrees) and `scale s` or `scale x y z`. A parent is named by an earlier group or object,
+// `-` places the node at the root. `light` adds one of the many small point lights of the clustered
+// pass (any number of them), the other two are the single lights of the Lights block. `#` starts
+// a comment.
+//
+// The compiled .rgscene form stores the same description as flat tables next to the text file and
+// is keyed by a hash of it, like the mesh cache. Layout (all offsets from the start of the file):
+//   CompiledSceneHeader
+//   CompiledSceneModel[modelCount]
+//   CompiledSceneNode[nodeCount]
+//   CompiledTransform[billboardCount]
+//   CompiledSceneLight[lightCount]
+//   char strings[stringsSize]     (zero terminated ids, paths and names)
+//
+
+#ifndef PROJECT_BASE_SCENEFILE_H
+#define PROJECT_BASE_SCENEFILE_H
+
+#include <rg/ClusteredLights.h>
+#include <rg/Hash.h>
+#include <rg/SceneGraph.h>
+#include <rg/UniformBuffer.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// bump whenever the compiled layout changes
+const uint32_t kCompiledSceneVersion = 3;
+const char kCompiledSceneMagic[4] = {'R', 'G', 'S', 'C'};
+const char* const kCompiledSceneExtension = ".rgscene";
+
+struct SceneModelRef {
+    std::string id;
+    std::string path;
+};
+
+struct SceneNodeDesc {
+    std::string name;
+    uint32_t parent = SceneGraph::kNone; // index of an earlier node
+    uint32_t model = SceneGraph::kNone;  // index into SceneDescription::models, kNone for groups
+    uint32_t flags = 0;                  // SceneGraph node flags
+    Transform transform;
+};
+
+struct SceneDescription {
+    std::vector<SceneModelRef> models;
+    std::vector<SceneNodeDesc> nodes;
+    std::vector<Transform> billboards;
+    // the lights as they are when switched on, the spotlight position and direction follow the camera
+    LightsBlock lights = LightsBlock();
+    std::vector<ClusterLight> pointLights;
+
+    uint32_t findModel(const std::string& id) const {
+        for (uint32_t i = 0; i < models.size(); ++i)
+            if (models[i].id == id)
+                return i;
+        return SceneGraph::kNone;
+    }
+    uint32_t findNode(const std::string& name) const {
+        for (uint32_t i = 0; i < nodes.size(); ++i)
+            if (nodes[i].name == name)
+                return i;
+        return SceneGraph::kNone;
+    }
+};
+
+struct CompiledSceneHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t modelCount;
+    uint32_t nodeCount;
+    uint32_t billboardCount;
+    uint32_t lightCount;
+    uint32_t stringsSize;
+    LightsBlock lights;
+};
+
+struct CompiledSceneModel {
+    uint32_t idOffset;   // into the string table
+    uint32_t pathOffset;
+};
+
+struct CompiledTransform {
+    float position[3];
+    float rotation[4]; // w, x, y, z
+    float scale[3];
+};
+
+struct CompiledSceneLight {
+    float position[3];
+    float radius;
+    float color[3];
+};
+
+struct CompiledSceneNode {
+    uint32_t nameOffset;
+    uint32_t parent;
+    uint32_t model;
+    uint32_t flags;
+    CompiledTransform transform;
+};
+
+inline std::string compiledScenePath(const std::string& sourcePath) {
+    return sourcePath + kCompiledSceneExtension;
+}
+
+namespace detail {
+
+// word by word reader of one line of a .scene file
+class SceneLine {
+public:
+    SceneLine(const std::string& line, const std::string& path, int number) : m_Path(path), m_Number(number) {
+        std::istringstream in(line.substr(0, line.find('#')));
+        std::string word;
+        while (in >> word)
+            m_Words.push_back(word);
+    }
+
+    bool empty() const {
+        return m_Words.empty();
+    }
+    bool done() const {
+        return m_Next >= m_Words.size();
+    }
+    const std::string& peek() const {
+        static const std::string none;
+        return done() ? none : m_Words[m_Next];
+    }
+    bool peekNumber() const {
+        float value;
+        return !done() && toFloat(m_Words[m_Next], value);
+    }
+
+    bool word(std::string& value) {
+        if (done())
+            return fail("missing word");
+        value = m_Words[m_Next++];
+        return true;
+    }
+    bool number(float& value) {
+        if (done() || !toFloat(m_Words[m_Next], value))
+            return fail("expected a number");
+        m_Next++;
+        return true;
+    }
+    bool vec3(glm::vec3& value) {
+        return number(value.x) && number(value.y) && number(value.z);
+    }
+
+    // consumes a `position`, `rotation` or `scale` option if the next word is one
+    bool transformOption(Transform& transform, bool& matched) {
+        matched = true;
+        const std::string& option = peek();
+        if (option == "position") {
+            m_Next++;
+            return vec3(transform.position);
+        }
+        if (option == "rotation") {
+            m_Next++;
+            glm::vec3 degrees;
+            if (!vec3(degrees))
+                return false;
+            transform.rotation = rotationDegrees(degrees);
+            return true;
+        }
+        if (option == "scale") {
+            m_Next++;
+            if (!number(transform.scale.x))
+                return false;
+            if (!peekNumber()) {
+                transform.scale = glm::vec3(transform.scale.x);
+                return true;
+            }
+            return number(transform.scale.y) && number(transform.scale.z);
+        }
+        matched = false;
+        return true;
+    }
+
+    bool fail(const std::string& message) const {
+        std::cout << "ERROR::SCENE:: " << m_Path << ':' << m_Number << ": " << message << std::endl;
+        return false;
+    }
+
+private:
+    std::vector<std::string> m_Words;
+    size_t m_Next = 0;
+    std::string m_Path;
+    int m_Number;
+
+    static bool toFloat(const std::string& word, float& value) {
+        char* end = nullptr;
+        value = strtof(word.c_str(), &end);
+        return end != word.c_str() && *end == '\0';
+    }
+};
+
+inline bool parseSceneNode(SceneLine& line, bool object, SceneDescription& scene) {
+    SceneNodeDesc node;
+    std::string parent;
+    if (!line.word(node.name) || !line.word(parent))
+        return false;
+    if (parent != "-") {
+        node.parent = scene.findNode(parent);
+        if (node.parent == SceneGraph::kNone)
+            return line.fail("unknown parent '" + parent + "'");
+    }
+    if (object) {
+        std::string model;
+        if (!line.word(model))
+            return false;
+        node.model = scene.findModel(model);
+        if (node.model == SceneGraph::kNone)
+            return line.fail("unknown model '" + model + "'");
+    }
+    while (!line.done()) {
+        bool matched;
+        if (!line.transformOption(node.transform, matched))
+            return false;
+        if (matched)
+            continue;
+        if (object && line.peek() == "instanced") {
+            std::string flag;
+            line.word(flag);
+            node.flags |= SceneGraph::kInstanced;
+            continue;
+        }
+        return line.fail("unexpected '" + line.peek() + "'");
+    }
+    scene.nodes.push_back(node);
+    return true;
+}
+
+// `name x y z`-style light properties, until the end of the line
+inline bool parseLight(SceneLine& line, const std::string& kind, SceneDescription& scene) {
+    LightsBlock& lights = scene.lights;
+    while (!line.done()) {
+        std::string property;
+        line.word(property);
+        bool ok;
+        if (kind == "dirlight") {
+            DirLightBlock& light = lights.dirLight;
+            if (property == "direction") ok = line.vec3(light.direction);
+            else if (property == "ambient") ok = line.vec3(light.ambient);
+            else if (property == "diffuse") ok = line.vec3(light.diffuse);
+            else if (property == "specular") ok = line.vec3(light.specular);
+            else return line.fail("unknown dirlight property '" + property + "'");
+        } else {
+            SpotlightBlock& light = lights.light;
+            if (property == "ambient") ok = line.vec3(light.ambient);
+            else if (property == "diffuse") ok = line.vec3(light.diffuse);
+            else if (property == "specular") ok = line.vec3(light.specular);
+            else if (property == "attenuation")
+                ok = line.number(light.constant) && line.number(light.linear) && line.number(light.quadratic);
+            else if (property == "cutoff") {
+                // degrees in the file, cosines in the block
+                ok = line.number(light.cutOff) && line.number(light.outerCutOff);
+                light.cutOff = std::cos(glm::radians(light.cutOff));
+                light.outerCutOff = std::cos(glm::radians(light.outerCutOff));
+            } else return line.fail("unknown spotlight property '" + property + "'");
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+inline bool parsePointLight(SceneLine& line, SceneDescription& scene) {
+    ClusterLight light = ClusterLight();
+    light.color = glm::vec3(1.0f);
+    light.radius = 10.0f;
+    while (!line.done()) {
+        std::string property;
+        line.word(property);
+        bool ok;
+        if (property == "position") ok = line.vec3(light.position);
+        else if (property == "color") ok = line.vec3(light.color);
+        else if (property == "radius") ok = line.number(light.radius);
+        else return line.fail("unknown light property '" + property + "'");
+        if (!ok)
+            return false;
+    }
+    if (light.radius <= 0.0f)
+        return line.fail("light radius has to be positive");
+    scene.pointLights.push_back(light);
+    return true;
+}
+
+inline void packTransform(const Transform& transform, CompiledTransform& packed) {
+    for (int k = 0; k < 3; ++k) {
+        packed.position[k] = transform.position[k];
+        packed.scale[k] = transform.scale[k];
+    }
+    packed.rotation[0] = transform.rotation.w;
+    packed.rotation[1] = transform.rotation.x;
+    packed.rotation[2] = transform.rotation.y;
+    packed.rotation[3] = transform.rotation.z;
+}
+
+inline Transform unpackTransform(const CompiledTransform& packed) {
+    Transform transform;
+    transform.position = glm::vec3(packed.position[0], packed.position[1], packed.position[2]);
+    transform.rotation = glm::quat(packed.rotation[0], packed.rotation[1], packed.rotation[2], packed.rotation[3]);
+    transform.scale = glm::vec3(packed.scale[0], packed.scale[1], packed.scale[2]);
+    return transform;
+}
+
+};
+
+// parses the text form
+inline bool parseSceneText(const std::string& path, SceneDescription& scene) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "ERROR::SCENE:: can't read " << path << std::endl;
+        return false;
+    }
+    scene = SceneDescription();
+    std::string text;
+    for (int number = 1; std::getline(in, text); ++number) {
+        detail::SceneLine line(text, path, number);
+        if (line.empty())
+            continue;
+        std::string keyword;
+        line.word(keyword);
+        bool ok;
+        if (keyword == "model") {
+            SceneModelRef model;
+            ok = line.word(model.id) && line.word(model.path);
+            if (ok && scene.findModel(model.id) != SceneGraph::kNone)
+                ok = line.fail("model '" + model.id + "' defined twice");
+            if (ok)
+                scene.models.push_back(model);
+        } else if (keyword == "group" || keyword == "object") {
+            ok = detail::parseSceneNode(line, keyword == "object", scene);
+        } else if (keyword == "billboard") {
+            Transform transform;
+            bool matched = true;
+            ok = true;
+            while (ok && matched && !line.done())
+                ok = line.transformOption(transform, matched);
+            if (ok && !matched)
+                ok = line.fail("unexpected '" + line.peek() + "'");
+            if (ok)
+                scene.billboards.push_back(transform);
+        } else if (keyword == "light") {
+            ok = detail::parsePointLight(line, scene);
+        } else if (keyword == "dirlight" || keyword == "spotlight") {
+            ok = detail::parseLight(line, keyword, scene);
+        } else {
+            ok = line.fail("unknown keyword '" + keyword + "'");
+        }
+        if (ok && !line.done())
+            ok = line.fail("unexpected '" + line.peek() + "'");
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+// Writes the compiled form. Like the mesh cache it goes to a temporary first and is renamed.
+inline bool writeCompiledScene(const std::string& path, uint64_t sourceHash, const SceneDescription& scene) {
+    CompiledSceneHeader header;
+    memset(static_cast<void*>(&header), 0, sizeof(header)); // padding included, the file is hashed byte for byte
+    memcpy(header.magic, kCompiledSceneMagic, 4);
+    header.version = kCompiledSceneVersion;
+    header.sourceHash = sourceHash;
+    header.modelCount = scene.models.size();
+    header.nodeCount = scene.nodes.size();
+    header.billboardCount = scene.billboards.size();
+    header.lightCount = scene.pointLights.size();
+    header.lights = scene.lights;
+
+    std::string strings;
+    auto addString = [&strings](const std::string& value) {
+        uint32_t offset = strings.size();
+        strings.append(value.c_str(), value.size() + 1);
+        return offset;
+    };
+    std::vector<CompiledSceneModel> models;
+    for (const SceneModelRef& model : scene.models)
+        models.push_back({addString(model.id), addString(model.path)});
+    std::vector<CompiledSceneNode> nodes;
+    for (const SceneNodeDesc& node : scene.nodes) {
+        CompiledSceneNode packed;
+        packed.nameOffset = addString(node.name);
+        packed.parent = node.parent;
+        packed.model = node.model;
+        packed.flags = node.flags;
+        detail::packTransform(node.transform, packed.transform);
+        nodes.push_back(packed);
+    }
+    std::vector<CompiledTransform> billboards(scene.billboards.size());
+    for (size_t i = 0; i < billboards.size(); ++i)
+        detail::packTransform(scene.billboards[i], billboards[i]);
+    std::vector<CompiledSceneLight> lights(scene.pointLights.size());
+    for (size_t i = 0; i < lights.size(); ++i) {
+        const ClusterLight& light = scene.pointLights[i];
+        for (int k = 0; k < 3; ++k) {
+            lights[i].position[k] = light.position[k];
+            lights[i].color[k] = light.color[k];
+        }
+        lights[i].radius = light.radius;
+    }
+    header.stringsSize = strings.size();
+
+    std::string tmpPath = temporaryPath(path);
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (!models.empty())
+        ok = ok && fwrite(models.data(), sizeof(CompiledSceneModel), models.size(), f) == models.size();
+    if (!nodes.empty())
+        ok = ok && fwrite(nodes.data(), sizeof(CompiledSceneNode), nodes.size(), f) == nodes.size();
+    if (!billboards.empty())
+        ok = ok && fwrite(billboards.data(), sizeof(CompiledTransform), billboards.size(), f) == billboards.size();
+    if (!lights.empty())
+        ok = ok && fwrite(lights.data(), sizeof(CompiledSceneLight), lights.size(), f) == lights.size();
+    ok = ok && fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reads the compiled form. `expectedHash` is the hash of the text it was compiled from, 0 accepts
+// any (a compiled scene shipped without its text).
+inline bool readCompiledScene(const std::string& path, uint64_t expectedHash, SceneDescription& scene) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    std::vector<char> data;
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+    fclose(f);
+    if (data.size() < sizeof(CompiledSceneHeader))
+        return false;
+
+    CompiledSceneHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, kCompiledSceneMagic, 4) != 0 || header.version != kCompiledSceneVersion)
+        return false;
+    if (expectedHash && header.sourceHash != expectedHash)
+        return false;
+    uint64_t modelsOffset = sizeof(CompiledSceneHeader);
+    uint64_t nodesOffset = modelsOffset + (uint64_t)header.modelCount * sizeof(CompiledSceneModel);
+    uint64_t billboardsOffset = nodesOffset + (uint64_t)header.nodeCount * sizeof(CompiledSceneNode);
+    uint64_t lightsOffset = billboardsOffset + (uint64_t)header.billboardCount * sizeof(CompiledTransform);
+    uint64_t stringsOffset = lightsOffset + (uint64_t)header.lightCount * sizeof(CompiledSceneLight);
+    if (stringsOffset + header.stringsSize != data.size() || header.stringsSize == 0
+        || data.back() != '\0')
+        return false;
+    auto string = [&](uint32_t offset) -> const char* {
+        return offset < header.stringsSize ? data.data() + stringsOffset + offset : nullptr;
+    };
+
+    scene = SceneDescription();
+    scene.lights = header.lights;
+    for (uint32_t i = 0; i < header.modelCount; ++i) {
+        CompiledSceneModel model;
+        memcpy(&model, data.data() + modelsOffset + i * sizeof(model), sizeof(model));
+        if (!string(model.idOffset) || !string(model.pathOffset))
+            return false;
+        scene.models.push_back({string(model.idOffset), string(model.pathOffset)});
+    }
+    for (uint32_t i = 0; i < header.nodeCount; ++i) {
+        CompiledSceneNode packed;
+        memcpy(&packed, data.data() + nodesOffset + i * sizeof(packed), sizeof(packed));
+        // parents have to come first, models have to exist
+        if (!string(packed.nameOffset) || (packed.parent != SceneGraph::kNone && packed.parent >= i)
+            || (packed.model != SceneGraph::kNone && packed.model >= header.modelCount))
+            return false;
+        SceneNodeDesc node;
+        node.name = string(packed.nameOffset);
+        node.parent = packed.parent;
+        node.model = packed.model;
+        node.flags = packed.flags;
+        node.transform = detail::unpackTransform(packed.transform);
+        scene.nodes.push_back(node);
+    }
+    for (uint32_t i = 0; i < header.billboardCount; ++i) {
+        CompiledTransform packed;
+        memcpy(&packed, data.data() + billboardsOffset + i * sizeof(packed), sizeof(packed));
+        scene.billboards.push_back(detail::unpackTransform(packed));
+    }
+    for (uint32_t i = 0; i < header.lightCount; ++i) {
+        CompiledSceneLight packed;
+        memcpy(&packed, data.data() + lightsOffset + i * sizeof(packed), sizeof(packed));
+        ClusterLight light = ClusterLight();
+        light.position = glm::vec3(packed.position[0], packed.position[1], packed.position[2]);
+        light.color = glm::vec3(packed.color[0], packed.color[1], packed.color[2]);
+        light.radius = packed.radius;
+        scene.pointLights.push_back(light);
+    }
+    return true;
+}
+
+// Reads a scene: the compiled form when it is up to date, otherwise the text, which is then
+// compiled for the next launch. A path ending in .rgscene is read as is.
+inline bool readScene(const std::string& path, SceneDescription& scene) {
+    size_t extension = strlen(kCompiledSceneExtension);
+    if (path.size() > extension && path.compare(path.size() - extension, extension, kCompiledSceneExtension) == 0) {
+        if (readCompiledScene(path, 0, scene))
+            return true;
+        std::cout << "ERROR::SCENE:: can't read " << path << std::endl;
+        return false;
+    }
+    uint64_t hash = hashFile(path);
+    if (hash && readCompiledScene(compiledScenePath(path), hash, scene))
+        return true;
+    if (!parseSceneText(path, scene))
+        return false;
+    if (hash && !writeCompiledScene(compiledScenePath(path), hash, scene))
+        std::cout << "WARNING::SCENE:: can't write " << compiledScenePath(path) << std::endl;
+    return true;
+}
+
+// compiles the text form, for `--bake`
+inline bool bakeScene(const std::string& path) {
+    uint64_t hash = hashFile(path);
+    SceneDescription scene;
+    if (!hash || !parseSceneText(path, scene))
+        return false;
+    if (!writeCompiledScene(compiledScenePath(path), hash, scene)) {
+        std::cout << "ERROR::SCENE:: can't write " << compiledScenePath(path) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+};
+#endif //PROJECT_BASE_SCENEFILE_H
@@ -0,0 +1,179 @@
+//
+// Scene graph: placed nodes with parent/child transforms.
+//
+// Nodes live in flat parallel arrays in topological order: a node can only be added under a node
+// that already exists, so every parent comes before its children and one forward pass over the
+// arrays updates the whole hierarchy. World matrices and world bounds are cached; update() only
+// recomputes nodes marked dirty (and everything below them) and returns right away when nothing
+// moved, so a static scene costs no matrix math per frame.
+//
+
+#ifndef PROJECT_BASE_SCENEGRAPH_H
+#define PROJECT_BASE_SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <learnopengl/model.h>
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// local transform of a node, composed as translate * rotate * scale
+struct Transform {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+    glm::mat4 matrix() const {
+        glm::mat4 m = glm::mat4_cast(rotation);
+        m[0] *= scale.x;
+        m[1] *= scale.y;
+        m[2] *= scale.z;
+        m[3] = glm::vec4(position, 1.0f);
+        return m;
+    }
+};
+
+// rotation from angles in degrees, applied as yaw (y), then pitch (x), then roll (z)
+inline glm::quat rotationDegrees(const glm::vec3& degrees) {
+    return glm::angleAxis(glm::radians(degrees.y), glm::vec3(0.0f, 1.0f, 0.0f))
+           * glm::angleAxis(glm::radians(degrees.x), glm::vec3(1.0f, 0.0f, 0.0f))
+           * glm::angleAxis(glm::radians(degrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+class SceneGraph {
+public:
+    static const uint32_t kNone = ~0u;
+    // node flags
+    static const uint32_t kInstanced = 1u; // drawn through the instance buffer of its model
+
+    // adds a node under `parent` (kNone for a root). Group nodes have no model.
+    uint32_t add(const std::string& name, uint32_t parent, const Transform& local, Model* model = nullptr,
+                 uint32_t flags = 0) {
+        uint32_t node = m_Parent.size();
+        m_Names.push_back(name);
+        m_Parent.push_back(parent < node ? parent : kNone);
+        m_Local.push_back(local);
+        m_World.push_back(glm::mat4(1.0f));
+        m_Bounds.push_back(AABB());
+        m_Model.push_back(model);
+        m_Flags.push_back(flags);
+        m_FirstMeshBounds.push_back(m_MeshBounds.size());
+        if (model)
+            m_MeshBounds.resize(m_MeshBounds.size() + model->meshes.size());
+        m_Dirty.push_back(1);
+        markDirty(node);
+        return node;
+    }
+
+    void setLocal(uint32_t node, const Transform& local) {
+        m_Local[node] = local;
+        markDirty(node);
+    }
+
+    void markDirty(uint32_t node) {
+        m_Dirty[node] = 1;
+        if (node < m_FirstDirty)
+            m_FirstDirty = node;
+    }
+
+    // recomputes the world matrices and bounds of dirty nodes and their descendants.
+    // Returns the number of nodes recomputed, 0 when nothing moved.
+    unsigned int update() {
+        if (m_FirstDirty == kNone)
+            return 0;
+        unsigned int updated = 0;
+        uint32_t count = m_Parent.size();
+        for (uint32_t node = m_FirstDirty; node < count; ++node) {
+            uint32_t parent = m_Parent[node];
+            // parents come first, their flag is final by the time the children look at it
+            if (parent != kNone && m_Dirty[parent])
+                m_Dirty[node] = 1;
+            if (!m_Dirty[node])
+                continue;
+            m_World[node] = parent != kNone ? m_World[parent] * m_Local[node].matrix() : m_Local[node].matrix();
+            if (Model* model = m_Model[node]) {
+                m_Bounds[node] = model->bounds.transformed(m_World[node]);
+                AABB* meshBounds = &m_MeshBounds[m_FirstMeshBounds[node]];
+                for (size_t i = 0; i < model->meshes.size(); ++i)
+                    meshBounds[i] = model->meshes[i].bounds.transformed(m_World[node]);
+            }
+            updated++;
+        }
+        std::fill(m_Dirty.begin() + m_FirstDirty, m_Dirty.end(), 0);
+        m_FirstDirty = kNone;
+        return updated;
+    }
+
+    size_t size() const {
+        return m_Parent.size();
+    }
+
+    uint32_t find(const std::string& name) const {
+        for (uint32_t node = 0; node < m_Names.size(); ++node)
+            if (m_Names[node] == name)
+                return node;
+        return kNone;
+    }
+
+    const std::string& name(uint32_t node) const {
+        return m_Names[node];
+    }
+    uint32_t parent(uint32_t node) const {
+        return m_Parent[node];
+    }
+    const Transform& local(uint32_t node) const {
+        return m_Local[node];
+    }
+    Model* model(uint32_t node) const {
+        return m_Model[node];
+    }
+    uint32_t flags(uint32_t node) const {
+        return m_Flags[node];
+    }
+
+    // cached values, current as of the last update()
+    const glm::mat4& world(uint32_t node) const {
+        return m_World[node];
+    }
+    const AABB& bounds(uint32_t node) const {
+        return m_Bounds[node];
+    }
+    // world space box of mesh `mesh` of the node's model
+    const AABB& meshBounds(uint32_t node, size_t mesh) const {
+        return m_MeshBounds[m_FirstMeshBounds[node] + mesh];
+    }
+
+    // the nodes that have a model and their world boxes, in node order (input for the BVH)
+    void collectDrawable(std::vector<uint32_t>& nodes, std::vector<AABB>& boxes) const {
+        nodes.clear();
+        boxes.clear();
+        for (uint32_t node = 0; node < m_Model.size(); ++node) {
+            if (!m_Model[node])
+                continue;
+            nodes.push_back(node);
+            boxes.push_back(m_Bounds[node]);
+        }
+    }
+
+private:
+    std::vector<std::string> m_Names;
+    std::vector<uint32_t> m_Parent;
+    std::vector<Transform> m_Local;
+    std::vector<glm::mat4> m_World;
+    std::vector<AABB> m_Bounds;
+    std::vector<Model*> m_Model;
+    std::vector<uint32_t> m_Flags;
+    std::vector<uint32_t> m_FirstMeshBounds;
+    std::vector<AABB> m_MeshBounds;
+    std::vector<uint8_t> m_Dirty;
+    uint32_t m_FirstDirty = kNone;
+};
+
+};
+#endif //PROJECT_BASE_SCENEGRAPH_H
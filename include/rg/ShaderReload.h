@@ -0,0 +1,166 @@
+//
+// Hot reload of shaders.
+//
+// ShaderReloader watches a directory of shader sources with inotify on a background thread, which
+// does nothing but collect the names of the files that were written (or moved in, as editors that
+// save through a temporary file do). The GL side stays on the render thread: update(), called
+// between frames, rebuilds every registered program that reads one of those files with
+// Shader::reload(). A program swaps only if all its stages compile and it links, otherwise the
+// error is printed and the old program keeps drawing until the file is fixed.
+//
+// Changes are picked up once the directory has been quiet for kShaderReloadDelay, so a save that
+// writes several times (or touches the .vs and the .fs together) reloads each program once.
+//
+
+#ifndef PROJECT_BASE_SHADERRELOAD_H
+#define PROJECT_BASE_SHADERRELOAD_H
+
+#include <learnopengl/shader.h>
+#include <rg/GLState.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace rg {
+
+// seconds without new changes before they are reloaded
+const float kShaderReloadDelay = 0.2f;
+
+class ShaderReloader {
+public:
+    ShaderReloader() = default;
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    ~ShaderReloader() {
+        stop();
+    }
+
+    // `shader` has to outlive the reloader; `name` is only used in messages
+    void add(Shader& shader, const char* name) {
+        m_Programs.push_back({&shader, name});
+    }
+
+    // starts watching `directory`, the path the shaders' files start with. False if it can't be watched.
+    bool start(const std::string& directory) {
+        stop();
+        m_Directory = directory;
+#ifdef __linux__
+        m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_Fd < 0 || inotify_add_watch(m_Fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            std::cout << "ERROR::SHADER_RELOAD:: can't watch " << directory << std::endl;
+            if (m_Fd >= 0)
+                close(m_Fd);
+            m_Fd = -1;
+            return false;
+        }
+        m_Stopping = false;
+        m_Thread = std::thread([this] { watch(); });
+        return true;
+#else
+        std::cout << "ERROR::SHADER_RELOAD:: watching files needs inotify (Linux)" << std::endl;
+        return false;
+#endif
+    }
+
+    void stop() {
+        if (!m_Thread.joinable())
+            return;
+        m_Stopping = true;
+        m_Thread.join();
+#ifdef __linux__
+        close(m_Fd);
+        m_Fd = -1;
+#endif
+    }
+
+    // render thread, between frames: rebuilds the programs whose files changed. Returns how many
+    // were replaced. The old programs are deleted, `state` forgets what it knew about them.
+    unsigned int update(GLStateCache& state) {
+        std::set<std::string> changed;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (m_Changed.empty()
+                || std::chrono::duration<float>(clock::now() - m_LastChange).count() < kShaderReloadDelay)
+                return 0;
+            changed.swap(m_Changed);
+        }
+        unsigned int reloaded = 0;
+        for (const Program& program : m_Programs) {
+            bool affected = false;
+            for (const std::string& file : changed)
+                affected = affected || program.shader->readsFile(file);
+            if (!affected)
+                continue;
+            GLuint previous = program.shader->ID;
+            if (program.shader->reload()) {
+                state.forgetProgram(previous);
+                std::cout << "shaders: reloaded " << program.name << std::endl;
+                reloaded++;
+            } else {
+                std::cout << "ERROR::SHADER_RELOAD:: " << program.name << " failed, keeping the old program"
+                          << std::endl;
+            }
+        }
+        if (reloaded)
+            state.invalidate();
+        return reloaded;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Program {
+        Shader* shader;
+        const char* name;
+    };
+
+    std::vector<Program> m_Programs;
+    std::string m_Directory;
+    std::thread m_Thread;
+    std::atomic<bool> m_Stopping{false};
+    int m_Fd = -1;
+
+    std::mutex m_Mutex;
+    std::set<std::string> m_Changed; // paths as the shaders name them, guarded by m_Mutex
+    clock::time_point m_LastChange;
+
+#ifdef __linux__
+    void watch() {
+        // large enough for a few events, inotify never splits one
+        alignas(inotify_event) char buffer[4096];
+        pollfd descriptor = {m_Fd, POLLIN, 0};
+        while (!m_Stopping) {
+            // wakes up now and then to notice stop()
+            if (poll(&descriptor, 1, 100) <= 0)
+                continue;
+            ssize_t length;
+            while ((length = read(m_Fd, buffer, sizeof(buffer))) > 0) {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                for (char* at = buffer; at < buffer + length;) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(at);
+                    if (event->len > 0 && !(event->mask & IN_ISDIR))
+                        m_Changed.insert(m_Directory + "/" + event->name);
+                    at += sizeof(inotify_event) + event->len;
+                }
+                m_LastChange = clock::now();
+            }
+        }
+    }
+#endif
+};
+
+};
+#endif //PROJECT_BASE_SHADERRELOAD_H
@@ -0,0 +1,355 @@
+//
+// Cascaded shadow maps for the directional light.
+//
+// The view frustum up to the shadow distance is split into cascades (a blend of logarithmic and
+// uniform splits). Each cascade gets an orthographic light projection fitted to the bounding
+// sphere of its slice, which keeps its size constant while the camera turns, and snapped to whole
+// shadow map texels, which keeps edges from shimmering while it moves. All cascades are layers of
+// one depth texture array, sampled with hardware PCF through a sampler2DArrayShadow.
+//
+// Depth passes use their own program with no fragment work and no texture binds. Casters are
+// culled per cascade through the scene BVH with the cascade's own frustum. A cascade is only
+// re-rendered when its slice no longer fits what it rendered last time or the scene moved, the
+// outer cascades are fitted with some slack so small camera moves keep them cached.
+//
+// Per cascade CPU and GPU times are kept; GPU times come from timer queries read back a frame or
+// two later, so they never stall.
+//
+
+#ifndef PROJECT_BASE_SHADOWS_H
+#define PROJECT_BASE_SHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <learnopengl/shader.h>
+#include <rg/BVH.h>
+#include <rg/Frustum.h>
+#include <rg/GLState.h>
+#include <rg/Scene.h>
+#include <rg/UniformBuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+// texture unit the shadow map stays bound to, above the material textures
+const GLuint kShadowMapUnit = 8;
+
+struct CascadeStats {
+    bool rendered = false;     // this frame, otherwise the cached layer was used
+    unsigned int renders = 0;  // since startup
+    unsigned int draws = 0;
+    unsigned int casters = 0;  // objects that passed the cascade's culling
+    unsigned int tests = 0;
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;        // last measured render, not necessarily this frame's
+    float splitFar = 0.0f;
+};
+
+class CascadedShadowMap {
+public:
+    // outer cascades cover this much more than their slice, so they survive small camera moves
+    static constexpr float kCacheMargin = 1.25f;
+    // how far behind a cascade casters are still rendered, in world units
+    static constexpr float kCasterDistance = 60.0f;
+    static constexpr float kSplitLambda = 0.75f;
+
+    void create(GLsizei size, int cascades, Shader& depth, Shader& depthInstanced) {
+        m_Size = size;
+        m_Cascades = std::max(1, std::min(cascades, kMaxShadowCascades));
+        m_Depth = &depth;
+        m_DepthInstanced = &depthInstanced;
+        m_Model = depth.uniform<glm::mat4>("model");
+        m_LightSpace = depth.uniform<glm::mat4>("lightSpace");
+        m_LightSpaceInstanced = depthInstanced.uniform<glm::mat4>("lightSpace");
+
+        glGenTextures(1, &m_Texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_Texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, m_Cascades, 0, GL_DEPTH_COMPONENT,
+                     GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        const float border[] = {1.0f, 1.0f, 1.0f, 1.0f}; // outside the map is lit
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(1, &m_Framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_Texture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOWS:: shadow map framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenQueries(kMaxShadowCascades * 2, &m_Queries[0][0]);
+        m_Cascade.assign(m_Cascades, Cascade());
+        m_Stats.assign(m_Cascades, CascadeStats());
+    }
+
+    // call before the context is destroyed
+    void release() {
+        if (m_Texture)
+            glDeleteTextures(1, &m_Texture);
+        if (m_Framebuffer)
+            glDeleteFramebuffers(1, &m_Framebuffer);
+        if (m_Texture)
+            glDeleteQueries(kMaxShadowCascades * 2, &m_Queries[0][0]);
+        for (auto& cascade : m_Instances)
+            for (InstanceBuffer& buffer : cascade)
+                buffer.release();
+        m_Texture = m_Framebuffer = 0;
+    }
+
+    // Fits the cascades to the camera (perspective with `fovY` radians, `aspect`, `near`, up to
+    // `distance`) and marks the ones that have to be re-rendered. `sceneMoved` invalidates all.
+    void fit(const glm::mat4& view, float fovY, float aspect, float near, float distance,
+             const glm::vec3& lightDirection, bool sceneMoved) {
+        glm::vec3 direction = glm::normalize(lightDirection);
+        if (direction != m_LightDirection) {
+            glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            m_LightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+            m_LightDirection = direction;
+            sceneMoved = true;
+        }
+        glm::mat4 cameraToWorld = glm::inverse(view);
+        float tanHalfFov = std::tan(fovY * 0.5f);
+        float splitNear = near;
+        for (int i = 0; i < m_Cascades; ++i) {
+            float t = (float)(i + 1) / m_Cascades;
+            float splitFar = kSplitLambda * near * std::pow(distance / near, t)
+                             + (1.0f - kSplitLambda) * (near + (distance - near) * t);
+            Cascade& cascade = m_Cascade[i];
+            cascade.splitFar = splitFar;
+
+            // bounding sphere of the slice, in light space. The radius only depends on the split.
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int c = 0; c < 8; ++c) {
+                float z = c < 4 ? splitNear : splitFar;
+                glm::vec3 corner((c & 1 ? 1.0f : -1.0f) * z * tanHalfFov * aspect,
+                                 (c & 2 ? 1.0f : -1.0f) * z * tanHalfFov, -z);
+                corners[c] = glm::vec3(cameraToWorld * glm::vec4(corner, 1.0f));
+                center += corners[c];
+            }
+            center /= 8.0f;
+            float radius = 0.0f;
+            for (const glm::vec3& corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+            glm::vec3 lightCenter = glm::vec3(m_LightRotation * glm::vec4(center, 1.0f));
+
+            m_Stats[i].rendered = false;
+            m_Stats[i].splitFar = splitFar;
+            cascade.dirty = cascade.dirty || sceneMoved || !covers(cascade, lightCenter, radius);
+            if (cascade.dirty)
+                place(cascade, lightCenter, i == 0 ? radius : radius * kCacheMargin);
+            splitNear = splitFar;
+        }
+    }
+
+    // renders the dirty cascades. `drawable` maps BVH indices to scene graph nodes.
+    void render(Scene& scene, const BVH& bvh, const std::vector<uint32_t>& drawable, GLStateCache& state) {
+        readTimers();
+        glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffer);
+        glViewport(0, 0, m_Size, m_Size);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        if (m_Instances.size() < (size_t)m_Cascades)
+            m_Instances.resize(m_Cascades);
+        for (int i = 0; i < m_Cascades; ++i) {
+            if (m_Cascade[i].dirty)
+                renderCascade(i, scene, bvh, drawable, state);
+        }
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // what the lighting shaders read; cascadeCount is 0 when `enabled` is false
+    ShadowsBlock block(bool enabled) const {
+        ShadowsBlock block = {};
+        block.cascadeCount = enabled ? m_Cascades : 0;
+        block.bias = 0.0005f;
+        for (int i = 0; i < m_Cascades; ++i) {
+            block.lightSpace[i] = m_Cascade[i].lightSpace;
+            block.splits[i] = m_Cascade[i].splitFar;
+        }
+        return block;
+    }
+
+    // forces every cascade to be re-rendered next frame
+    void invalidate() {
+        for (Cascade& cascade : m_Cascade)
+            cascade.dirty = true;
+    }
+
+    GLuint texture() const {
+        return m_Texture;
+    }
+    int cascades() const {
+        return m_Cascades;
+    }
+    const std::vector<CascadeStats>& stats() const {
+        return m_Stats;
+    }
+
+private:
+    struct Cascade {
+        glm::vec3 center = glm::vec3(0.0f); // light space, texel snapped
+        float radius = 0.0f;                // half size of the rendered area
+        glm::mat4 lightSpace = glm::mat4(1.0f);
+        Frustum frustum;
+        float splitFar = 0.0f;
+        bool dirty = true;
+    };
+
+    GLsizei m_Size = 0;
+    int m_Cascades = 0;
+    GLuint m_Texture = 0;
+    GLuint m_Framebuffer = 0;
+    GLuint m_Queries[kMaxShadowCascades][2] = {};
+    bool m_QueryPending[kMaxShadowCascades][2] = {};
+    Shader* m_Depth = nullptr;
+    Shader* m_DepthInstanced = nullptr;
+    Uniform<glm::mat4> m_Model;
+    Uniform<glm::mat4> m_LightSpace;
+    Uniform<glm::mat4> m_LightSpaceInstanced;
+    glm::vec3 m_LightDirection = glm::vec3(0.0f);
+    glm::mat4 m_LightRotation = glm::mat4(1.0f);
+    std::vector<Cascade> m_Cascade;
+    std::vector<CascadeStats> m_Stats;
+    // per cascade and instance batch, the casters drawn instanced
+    std::vector<std::vector<InstanceBuffer>> m_Instances;
+    std::vector<uint32_t> m_Visible;
+    std::vector<std::vector<glm::mat4>> m_Transforms; // per instance batch
+
+    static bool covers(const Cascade& cascade, const glm::vec3& center, float radius) {
+        glm::vec3 offset = glm::abs(center - cascade.center);
+        return cascade.radius > 0.0f && offset.x + radius <= cascade.radius && offset.y + radius <= cascade.radius
+               && offset.z + radius <= cascade.radius;
+    }
+
+    void place(Cascade& cascade, glm::vec3 center, float radius) {
+        // two texels of slack for the snapping below, or a still camera would never fit again
+        radius *= 1.0f + 4.0f / m_Size;
+        // whole texels, so the same world point always lands on the same texel
+        float texel = 2.0f * radius / m_Size;
+        center.x = std::floor(center.x / texel) * texel;
+        center.y = std::floor(center.y / texel) * texel;
+        cascade.center = center;
+        cascade.radius = radius;
+        // light space looks down -z; the depth range reaches back towards the light for casters
+        glm::mat4 projection = glm::ortho(center.x - radius, center.x + radius, center.y - radius,
+                                          center.y + radius, -(center.z + radius + kCasterDistance),
+                                          -(center.z - radius));
+        cascade.lightSpace = projection * m_LightRotation;
+        cascade.frustum.set(cascade.lightSpace);
+    }
+
+    void renderCascade(int index, Scene& scene, const BVH& bvh, const std::vector<uint32_t>& drawable,
+                       GLStateCache& state) {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+        Cascade& cascade = m_Cascade[index];
+        CascadeStats& stats = m_Stats[index];
+        stats.rendered = true;
+        stats.renders++;
+        stats.draws = 0;
+
+        // a free query slot, if both are still in flight this render goes untimed
+        int slot = !m_QueryPending[index][0] ? 0 : !m_QueryPending[index][1] ? 1 : -1;
+        if (slot >= 0)
+            glBeginQuery(GL_TIME_ELAPSED, m_Queries[index][slot]);
+
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_Texture, 0, index);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        m_Visible.clear();
+        stats.tests = bvh.query(cascade.frustum, m_Visible);
+        stats.casters = m_Visible.size();
+
+        // single draws first, instanced casters are collected per batch on the way
+        m_Transforms.resize(scene.batches.size());
+        for (std::vector<glm::mat4>& transforms : m_Transforms)
+            transforms.clear();
+        state.useProgram(m_Depth->ID);
+        m_LightSpace.set(cascade.lightSpace);
+        for (uint32_t object : m_Visible) {
+            uint32_t node = drawable[object];
+            if (scene.graph.flags(node) & SceneGraph::kInstanced) {
+                m_Transforms[&scene.batch(node) - scene.batches.data()].push_back(scene.graph.world(node));
+                continue;
+            }
+            Model& model = *scene.graph.model(node);
+            m_Model.set(scene.graph.world(node));
+            for (size_t i = 0; i < model.meshes.size(); ++i) {
+                stats.tests++;
+                if (!cascade.frustum.visible(scene.graph.meshBounds(node, i)))
+                    continue;
+                state.bindVertexArray(model.meshes[i].VAO);
+                glDrawElements(GL_TRIANGLES, model.meshes[i].indexCount, GL_UNSIGNED_INT, 0);
+                state.countDraw(1, model.meshes[i].indexCount / 3);
+                stats.draws++;
+            }
+        }
+
+        // one buffer per cascade and batch, the main pass and the other cascades keep theirs
+        std::vector<InstanceBuffer>& buffers = m_Instances[index];
+        if (buffers.size() < scene.batches.size())
+            buffers.resize(scene.batches.size());
+        bool programBound = false;
+        for (size_t b = 0; b < scene.batches.size(); ++b) {
+            if (m_Transforms[b].empty())
+                continue;
+            buffers[b].upload(m_Transforms[b]);
+            if (!programBound) {
+                state.useProgram(m_DepthInstanced->ID);
+                m_LightSpaceInstanced.set(cascade.lightSpace);
+                programBound = true;
+            }
+            for (Mesh& mesh : scene.batches[b].model->meshes) {
+                state.bindVertexArray(mesh.VAO);
+                mesh.AttachInstances(buffers[b]);
+                glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, 0, buffers[b].count());
+                state.countDraw(buffers[b].count(), mesh.indexCount / 3);
+                stats.draws++;
+            }
+        }
+
+        if (slot >= 0) {
+            glEndQuery(GL_TIME_ELAPSED);
+            m_QueryPending[index][slot] = true;
+        }
+        cascade.dirty = false;
+        stats.cpuMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    // collects the timer results that are ready, never waits for the others
+    void readTimers() {
+        for (int i = 0; i < m_Cascades; ++i) {
+            for (int slot = 0; slot < 2; ++slot) {
+                if (!m_QueryPending[i][slot])
+                    continue;
+                GLint available = 0;
+                glGetQueryObjectiv(m_Queries[i][slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(m_Queries[i][slot], GL_QUERY_RESULT, &elapsed);
+                m_Stats[i].gpuMs = elapsed / 1.0e6;
+                m_QueryPending[i][slot] = false;
+            }
+        }
+    }
+};
+
+};
+#endif //PROJECT_BASE_SHADOWS_H
@@ -0,0 +1,288 @@
+//
+// Mesh simplification with the quadric error metric (Garland & Heckbert), for the LOD chain.
+//
+// Every position accumulates the planes of the triangles around it, weighted by their area. An
+// edge collapse moves a vertex onto one of its neighbours and costs the mean squared distance of
+// the neighbour to the planes of both, so flat regions go first and silhouettes and creases last.
+// Collapses always keep an existing vertex, so every level indexes the vertex buffer of the full
+// mesh and a level costs only its indices.
+//
+// Collapses are done in passes: all candidate edges are sorted by cost and taken cheapest first,
+// skipping those whose triangles were already changed in the pass, until the target is reached
+// or nothing can collapse any more. A collapse that would flip a triangle is rejected.
+//
+// Vertices on open borders and on seams (one position shared by vertices with different normals
+// or UVs) never move, so levels keep their outline and don't stretch textures over seams. Meshes
+// made mostly of those stop short of the requested triangle count.
+//
+
+#ifndef PROJECT_BASE_SIMPLIFY_H
+#define PROJECT_BASE_SIMPLIFY_H
+
+#include <learnopengl/mesh.h>
+#include <rg/Lod.h>
+#include <rg/MeshOptimizer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace rg {
+
+// each level aims for this fraction of the previous one's triangles
+const float kLodReduction = 0.5f;
+// a level that keeps more than this fraction of the previous one isn't worth its indices
+const float kLodMinGain = 0.8f;
+// meshes with fewer triangles only get level 0
+const size_t kLodMinTriangles = 256;
+
+namespace detail {
+
+// symmetric 4x4 matrix (upper triangle) plus the summed weight of its planes
+struct Quadric {
+    double m[10] = {};
+    double weight = 0.0;
+
+    void addPlane(double a, double b, double c, double d, double w) {
+        m[0] += w * a * a; m[1] += w * a * b; m[2] += w * a * c; m[3] += w * a * d;
+        m[4] += w * b * b; m[5] += w * b * c; m[6] += w * b * d;
+        m[7] += w * c * c; m[8] += w * c * d;
+        m[9] += w * d * d;
+        weight += w;
+    }
+    void add(const Quadric& other) {
+        for (int i = 0; i < 10; ++i)
+            m[i] += other.m[i];
+        weight += other.weight;
+    }
+    // weighted sum of the squared distances of `p` to the planes
+    double evaluate(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x
+               + m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y
+               + m[7] * z * z + 2.0 * m[8] * z
+               + m[9];
+    }
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const {
+        uint32_t bits[3];
+        memcpy(bits, &p[0], sizeof(float));
+        memcpy(bits + 1, &p[1], sizeof(float));
+        memcpy(bits + 2, &p[2], sizeof(float));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+};
+
+class Simplifier {
+public:
+    Simplifier(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+        : m_Vertices(vertices), m_Indices(indices) {
+        weldPositions();
+        findLockedPositions();
+        m_Quadrics.resize(m_PositionCount);
+        for (size_t t = 0; t + 2 < m_Indices.size(); t += 3) {
+            const glm::vec3& p0 = m_Vertices[m_Indices[t]].Position;
+            const glm::vec3& p1 = m_Vertices[m_Indices[t + 1]].Position;
+            const glm::vec3& p2 = m_Vertices[m_Indices[t + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length <= 0.0f)
+                continue;
+            normal /= length;
+            double d = -glm::dot(normal, p0);
+            // area weighted, the corners share the triangle
+            for (int k = 0; k < 3; ++k)
+                m_Quadrics[m_Position[m_Indices[t + k]]].addPlane(normal.x, normal.y, normal.z, d, length * 0.5);
+        }
+    }
+
+    // collapses edges until at most `targetIndexCount` indices are left or no edge can collapse.
+    // Can be called again with a smaller target to continue from the current result.
+    void simplify(size_t targetIndexCount) {
+        while (m_Indices.size() > targetIndexCount) {
+            if (!collapsePass((m_Indices.size() - targetIndexCount) / 3))
+                break;
+        }
+    }
+
+    const std::vector<unsigned int>& indices() const {
+        return m_Indices;
+    }
+    // distance the result deviates from the input by, see MeshLod::error
+    float error() const {
+        return (float)std::sqrt(m_Error);
+    }
+
+private:
+    struct Collapse {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+
+    const std::vector<Vertex>& m_Vertices;
+    std::vector<unsigned int> m_Indices;
+    std::vector<uint32_t> m_Position;   // vertex -> welded position
+    std::vector<bool> m_Locked;         // by position
+    std::vector<detail::Quadric> m_Quadrics; // by position
+    size_t m_PositionCount = 0;
+    double m_Error = 0.0;
+
+    // vertices at exactly the same position share one quadric
+    void weldPositions() {
+        std::unordered_map<glm::vec3, uint32_t, detail::PositionHash> positions;
+        m_Position.resize(m_Vertices.size());
+        for (size_t i = 0; i < m_Vertices.size(); ++i)
+            m_Position[i] = positions.insert(std::make_pair(m_Vertices[i].Position, (uint32_t)positions.size()))
+                                .first->second;
+        m_PositionCount = positions.size();
+    }
+
+    // seams: positions used by more than one vertex; borders: edges without a twin
+    void findLockedPositions() {
+        m_Locked.assign(m_PositionCount, false);
+        std::vector<unsigned int> used(m_PositionCount, (unsigned int)-1);
+        for (unsigned int index : m_Indices) {
+            uint32_t position = m_Position[index];
+            if (used[position] != (unsigned int)-1 && used[position] != index)
+                m_Locked[position] = true;
+            used[position] = index;
+        }
+        std::unordered_set<uint64_t> edges;
+        for (size_t t = 0; t + 2 < m_Indices.size(); t += 3)
+            for (int k = 0; k < 3; ++k)
+                edges.insert(edgeKey(m_Position[m_Indices[t + k]], m_Position[m_Indices[t + (k + 1) % 3]]));
+        for (uint64_t edge : edges) {
+            uint32_t a = (uint32_t)(edge >> 32), b = (uint32_t)edge;
+            if (!edges.count(edgeKey(b, a)))
+                m_Locked[a] = m_Locked[b] = true;
+        }
+    }
+
+    static uint64_t edgeKey(uint32_t a, uint32_t b) {
+        return (uint64_t)a << 32 | b;
+    }
+
+    // one round of independent collapses, at most `triangles` triangles removed. False if none was possible.
+    bool collapsePass(size_t triangles) {
+        detail::TriangleAdjacency adjacency(m_Indices, 0, m_Indices.size(), m_Vertices.size());
+        const std::vector<uint32_t>& first = adjacency.first;
+        const std::vector<uint32_t>& around = adjacency.triangles;
+
+        std::vector<Collapse> candidates;
+        for (size_t t = 0; t + 2 < m_Indices.size(); t += 3) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int a = m_Indices[t + k], b = m_Indices[t + (k + 1) % 3];
+                if (!m_Locked[m_Position[a]])
+                    candidates.push_back({a, b, cost(a, b)});
+                if (!m_Locked[m_Position[b]])
+                    candidates.push_back({b, a, cost(b, a)});
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        std::vector<unsigned int> remap(m_Vertices.size());
+        for (size_t i = 0; i < remap.size(); ++i)
+            remap[i] = (unsigned int)i;
+        std::vector<bool> touched(m_Vertices.size(), false);
+        size_t removed = 0;
+        for (const Collapse& collapse : candidates) {
+            if (removed >= triangles)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+            if (flips(collapse, first, around))
+                continue;
+            // the triangles around `from` change, none of their vertices may move again this pass
+            for (uint32_t i = first[collapse.from]; i < first[collapse.from + 1]; ++i) {
+                const unsigned int* triangle = &m_Indices[around[i] * 3];
+                bool degenerate = false;
+                for (int k = 0; k < 3; ++k) {
+                    touched[triangle[k]] = true;
+                    degenerate = degenerate || triangle[k] == collapse.to;
+                }
+                if (degenerate)
+                    removed++;
+            }
+            remap[collapse.from] = collapse.to;
+            m_Quadrics[m_Position[collapse.to]].add(m_Quadrics[m_Position[collapse.from]]);
+            m_Error = std::max(m_Error, collapse.cost);
+        }
+        if (removed == 0)
+            return false;
+
+        size_t kept = 0;
+        for (size_t t = 0; t + 2 < m_Indices.size(); t += 3) {
+            unsigned int a = remap[m_Indices[t]], b = remap[m_Indices[t + 1]], c = remap[m_Indices[t + 2]];
+            if (m_Position[a] == m_Position[b] || m_Position[b] == m_Position[c] || m_Position[a] == m_Position[c])
+                continue;
+            m_Indices[kept++] = a;
+            m_Indices[kept++] = b;
+            m_Indices[kept++] = c;
+        }
+        m_Indices.resize(kept);
+        return true;
+    }
+
+    // mean squared distance of `to` to the planes of both ends
+    double cost(unsigned int from, unsigned int to) const {
+        detail::Quadric quadric = m_Quadrics[m_Position[from]];
+        quadric.add(m_Quadrics[m_Position[to]]);
+        if (quadric.weight <= 0.0)
+            return 0.0;
+        return std::max(quadric.evaluate(m_Vertices[to].Position), 0.0) / quadric.weight;
+    }
+
+    // whether moving `from` onto `to` turns a remaining triangle around `from` over (or to a sliver)
+    bool flips(const Collapse& collapse, const std::vector<uint32_t>& first, const std::vector<uint32_t>& around) const {
+        const glm::vec3& target = m_Vertices[collapse.to].Position;
+        for (uint32_t i = first[collapse.from]; i < first[collapse.from + 1]; ++i) {
+            const unsigned int* triangle = &m_Indices[around[i] * 3];
+            if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                continue;
+            glm::vec3 before[3], after[3];
+            for (int k = 0; k < 3; ++k) {
+                before[k] = m_Vertices[triangle[k]].Position;
+                after[k] = triangle[k] == collapse.from ? target : before[k];
+            }
+            glm::vec3 oldNormal = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 newNormal = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(oldNormal, newNormal) <= 0.25f * glm::length(oldNormal) * glm::length(newNormal))
+                return true;
+        }
+        return false;
+    }
+};
+
+// Appends the simplified levels of the mesh to `indices` and returns the ranges of all levels,
+// level 0 (the indices as they were) first. Each level is reordered for the vertex cache.
+inline std::vector<MeshLod> generateLods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+    std::vector<MeshLod> lods;
+    lods.push_back({0, (uint32_t)indices.size(), 0.0f});
+    if (indices.size() / 3 < kLodMinTriangles)
+        return lods;
+    Simplifier simplifier(vertices, indices);
+    while (lods.size() < kMaxLodLevels) {
+        size_t previous = lods.back().indexCount;
+        simplifier.simplify((size_t)(previous / 3 * kLodReduction) * 3);
+        size_t count = simplifier.indices().size();
+        if (count == 0 || count > previous * kLodMinGain)
+            break;
+        lods.push_back({(uint32_t)indices.size(), (uint32_t)count, simplifier.error()});
+        indices.insert(indices.end(), simplifier.indices().begin(), simplifier.indices().end());
+        optimizeVertexCache(indices, lods.back().firstIndex, indices.size(), vertices.size());
+    }
+    return lods;
+}
+
+};
+#endif //PROJECT_BASE_SIMPLIFY_H
@@ -8,5 +8,115 @@
 #include <stb_image.h>
 #include <rg/Error.h>
 
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+// Decoded image that hasn't been uploaded yet. Owns the stb_image pixel memory, so it can be
+// produced on a worker thread and handed over to the GL thread.
+struct ImageData {
+    unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+
+    ImageData() = default;
+    ImageData(const ImageData&) = delete;
+    ImageData& operator=(const ImageData&) = delete;
+    ImageData(ImageData&& other) noexcept {
+        *this = std::move(other);
+    }
+    ImageData& operator=(ImageData&& other) noexcept {
+        if (this != &other) {
+            stbi_image_free(pixels);
+            pixels = other.pixels;
+            width = other.width;
+            height = other.height;
+            components = other.components;
+            other.pixels = nullptr;
+        }
+        return *this;
+    }
+    ~ImageData() {
+        stbi_image_free(pixels);
+    }
+
+    bool valid() const {
+        return pixels != nullptr;
+    }
+};
+
+// CPU only, safe to call from worker threads
+inline ImageData decodeImage(const std::string& path) {
+    ImageData image;
+    image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &image.components, 0);
+    return image;
+}
+inline ImageData decodeImage(const unsigned char* encoded, size_t size) {
+    ImageData image;
+    image.pixels = stbi_load_from_memory(encoded, (int)size, &image.width, &image.height, &image.components, 0);
+    return image;
+}
+
+inline GLenum imageFormat(int components) {
+    switch (components) {
+        case 1: return GL_RED;
+        case 2: return GL_RG;
+        case 4: return GL_RGBA;
+        default: return GL_RGB;
+    }
+}
+
+// one level of a mip chain below the base image
+struct MipLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// Builds levels 1..n (down to 1x1) with a box filter (2x2, 3 taps wide on the edge of odd sizes),
+// so the GL thread doesn't have to call glGenerateMipmap. CPU only, meant to run on the worker that
+// decoded the image.
+inline std::vector<MipLevel> generateMipChain(const ImageData& base) {
+    std::vector<MipLevel> levels;
+    const int c = base.components;
+    const unsigned char* src = base.pixels;
+    int srcWidth = base.width;
+    int srcHeight = base.height;
+    while (src && (srcWidth > 1 || srcHeight > 1)) {
+        MipLevel level;
+        level.width = std::max(1, srcWidth / 2);
+        level.height = std::max(1, srcHeight / 2);
+        level.pixels.resize((size_t)level.width * level.height * c);
+        for (int y = 0; y < level.height; ++y) {
+            // a box over the texels the output covers: 2x2, or 3 wide/high on the last column/row of an
+            // odd size so no texel is dropped, 1 along a side that is already a single texel
+            int y0 = std::min(2 * y, srcHeight - 1);
+            int y1 = y == level.height - 1 ? srcHeight - 1 : 2 * y + 1;
+            for (int x = 0; x < level.width; ++x) {
+                int x0 = std::min(2 * x, srcWidth - 1);
+                int x1 = x == level.width - 1 ? srcWidth - 1 : 2 * x + 1;
+                unsigned count = (unsigned)((x1 - x0 + 1) * (y1 - y0 + 1));
+                for (int k = 0; k < c; ++k) {
+                    unsigned sum = 0;
+                    for (int sy = y0; sy <= y1; ++sy)
+                        for (int sx = x0; sx <= x1; ++sx)
+                            sum += src[((size_t)sy * srcWidth + sx) * c + k];
+                    level.pixels[((size_t)y * level.width + x) * c + k] = (unsigned char)((sum + count / 2) / count);
+                }
+            }
+        }
+        levels.push_back(std::move(level));
+        src = levels.back().pixels.data();
+        srcWidth = levels.back().width;
+        srcHeight = levels.back().height;
+    }
+    return levels;
+}
+
+};
 
 #endif //PROJECT_BASE_TEXTURE2D_H
@@ -0,0 +1,352 @@
+//
+// Process-wide texture cache with asynchronous decoding.
+//
+// Textures are keyed by canonical path, and additionally by a hash of the file contents so
+// identical images under different names (e.g. copies in two model folders) are decoded and
+// uploaded once. Reading, hashing, decoding and building the mip chain run as jobs on the worker
+// pool; the GL thread hands the results to the PBO TextureStreamer in processUploads(), and
+// processUploadBytes() streams them within a per-frame byte budget.
+//
+// When a baked `<image>.ktx` (see TextureCompression.h) matches the source hash, its blocks are
+// streamed instead and the decode is skipped.
+//
+// acquire() hands out a GL texture name right away, without waiting for the file to be read, so
+// meshes can be built while their textures are still loading. Until the upload the texture is
+// incomplete and samples as black. If the file turns out to have the same contents as one
+// already cached, the name handed out was only a placeholder: processUploads() maps it to the
+// other texture and resolve() turns it into that one, holders of the name replace it once the
+// loads are done (Model::resolveTextures()).
+//
+
+#ifndef PROJECT_BASE_TEXTURECACHE_H
+#define PROJECT_BASE_TEXTURECACHE_H
+
+#include <rg/Hash.h>
+#include <rg/Texture2D.h>
+#include <rg/TextureCompression.h>
+#include <rg/TextureStreamer.h>
+#include <rg/ThreadPool.h>
+
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+class TextureCache {
+public:
+    struct Stats {
+        unsigned int requests = 0;    // every prefetch/acquire call
+        unsigned int files = 0;       // distinct canonical paths
+        unsigned int contentHits = 0; // files whose contents matched an already cached file
+        unsigned int uploads = 0;     // textures handed to the streamer
+        unsigned int failures = 0;
+        unsigned int compressed = 0;  // uploads that came from a baked .ktx
+        double decodeMs = 0.0;        // summed over all workers
+        size_t decodedBytes = 0;
+        size_t gpuBytes = 0;          // texture memory of the uploads, all mip levels
+    };
+
+    // bytes streamed per processUploads() call while the scene is running
+    static const size_t kFrameUploadBudget = 8 << 20;
+
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // without a pool the jobs run inline on the calling thread
+    void setThreadPool(ThreadPool* pool) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Pool = pool;
+    }
+
+    // whether baked .ktx files may be used; BC1/BC3 need GL_EXT_texture_compression_s3tc,
+    // BC5 is always available. Off until the GL thread has checked the extensions.
+    void setCompressedFormats(bool enabled, bool s3tc) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_UseCompressed = enabled;
+        m_S3tc = s3tc;
+    }
+
+    // starts loading `path` in the background. Thread-safe, doesn't touch GL.
+    void prefetch(const std::string& path) {
+        request(path);
+    }
+
+    // returns the GL texture for `path`, starting the load if needed. Never waits for the load;
+    // while the contents aren't hashed yet the name may be a placeholder, see resolve(). GL thread only.
+    unsigned int acquire(const std::string& path) {
+        std::shared_ptr<Entry> entry = request(path);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        while (entry->alias)
+            entry = entry->alias;
+        if (!entry->id)
+            glGenTextures(1, &entry->id);
+        return entry->id;
+    }
+
+    // the texture `id` stands for: the one with the same contents if `id` was a placeholder handed out
+    // before the duplicate was found, `id` otherwise. GL thread only.
+    unsigned int resolve(unsigned int id) const {
+        if (m_Remap.empty())
+            return id;
+        auto it = m_Remap.find(id);
+        return it == m_Remap.end() ? id : it->second;
+    }
+
+    // hands up to `maxTextures` finished decodes to the streamer, which allocates their storage.
+    // Returns how many were handed over. GL thread only.
+    unsigned int processUploads(unsigned int maxTextures = UINT_MAX) {
+        unsigned int progress = 0;
+        while (progress < maxTextures) {
+            std::shared_ptr<Entry> entry;
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (m_Decoded.empty())
+                    break;
+                entry = m_Decoded.front();
+                m_Decoded.pop_front();
+                if (entry->state == Entry::Aliased) {
+                    // a placeholder was handed out, it stands for the texture with the same contents
+                    std::shared_ptr<Entry> owner = entry->alias;
+                    while (owner->alias)
+                        owner = owner->alias;
+                    if (!owner->id)
+                        glGenTextures(1, &owner->id);
+                    m_Remap[entry->id] = owner->id;
+                    progress++;
+                    continue;
+                }
+                if (!entry->id)
+                    glGenTextures(1, &entry->id);
+                if (entry->image.valid() || entry->compressed.valid())
+                    m_Stats.uploads++;
+                else
+                    m_Stats.failures++;
+                if (entry->compressed.valid())
+                    m_Stats.compressed++;
+                entry->state = Entry::Uploaded;
+                m_Transparent[entry->id] = entry->transparent;
+            }
+            if (entry->compressed.valid())
+                m_Streamer.enqueueCompressed(entry->id, std::move(entry->compressed));
+            else if (entry->image.valid())
+                m_Streamer.enqueue(entry->id, std::move(entry->image), std::move(entry->mips));
+            else
+                std::cout << "Texture failed to load at path: " << entry->path << std::endl;
+            progress++;
+        }
+        return progress;
+    }
+
+    // streams up to `budgetBytes` of the handed over textures' pixels, returns how many bytes were
+    // issued. Never waits on the GPU. GL thread only.
+    size_t processUploadBytes(size_t budgetBytes = kFrameUploadBudget) {
+        return m_Streamer.update(budgetBytes);
+    }
+
+    // whether texture `id` has texels that aren't fully opaque, so materials using it need the alpha
+    // test. Textures that haven't been decoded yet count as transparent. GL thread only.
+    bool transparent(unsigned int id) const {
+        auto it = m_Transparent.find(id);
+        return it == m_Transparent.end() || it->second;
+    }
+
+    // blocks until every requested texture is decoded and streamed. GL thread only.
+    void finish() {
+        for (;;) {
+            processUploads();
+            m_Streamer.flush();
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if (m_InFlight == 0 && m_Decoded.empty())
+                return;
+            m_Changed.wait(lock, [this] { return m_InFlight == 0 || !m_Decoded.empty(); });
+        }
+    }
+
+    TextureStreamer& streamer() {
+        return m_Streamer;
+    }
+
+    // frees the GL objects owned by the cache; call before the context is destroyed
+    void release() {
+        m_Streamer.release();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Stats;
+    }
+
+    void printStats() const {
+        Stats s = stats();
+        printf("texture cache: %u requests, %u files, %u content duplicates, %u uploads, %u failures, "
+               "%.1f MB decoded in %.1f ms of worker time\n",
+               s.requests, s.files, s.contentHits, s.uploads, s.failures,
+               s.decodedBytes / (1024.0 * 1024.0), s.decodeMs);
+        printf("texture memory: %.1f MB, %u of %u textures block compressed\n",
+               s.gpuBytes / (1024.0 * 1024.0), s.compressed, s.uploads);
+    }
+
+private:
+    struct Entry {
+        enum State { Queued, Decoding, Decoded, Uploaded, Aliased };
+        std::string path;
+        State state = Queued;
+        uint64_t contentHash = 0;
+        unsigned int id = 0;
+        ImageData image;
+        std::vector<MipLevel> mips;
+        CompressedTexture compressed;
+        bool transparent = true;      // see TextureCache::transparent
+        std::shared_ptr<Entry> alias; // set when another file has the same contents
+    };
+
+    TextureCache() = default;
+
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_Changed;
+    ThreadPool* m_Pool = nullptr;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_ByPath;
+    std::unordered_map<uint64_t, std::shared_ptr<Entry>> m_ByContent;
+    std::deque<std::shared_ptr<Entry>> m_Decoded;
+    std::unordered_map<unsigned int, bool> m_Transparent; // by texture id, GL thread only
+    std::unordered_map<unsigned int, unsigned int> m_Remap; // placeholder to texture, GL thread only
+    unsigned int m_InFlight = 0;
+    bool m_UseCompressed = false;
+    bool m_S3tc = false;
+    Stats m_Stats;
+    TextureStreamer m_Streamer;
+
+    static std::string canonicalPath(const std::string& path) {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved))
+            return resolved;
+        return path;
+    }
+
+    std::shared_ptr<Entry> request(const std::string& path) {
+        std::string key = canonicalPath(path);
+        std::shared_ptr<Entry> entry;
+        ThreadPool* pool;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stats.requests++;
+            auto it = m_ByPath.find(key);
+            if (it != m_ByPath.end())
+                return it->second;
+            entry = std::make_shared<Entry>();
+            entry->path = key;
+            m_ByPath[key] = entry;
+            m_Stats.files++;
+            m_InFlight++;
+            pool = m_Pool;
+        }
+        if (pool)
+            pool->submit([this, entry] { load(entry); });
+        else
+            load(entry);
+        return entry;
+    }
+
+    static bool readFile(const std::string& path, std::vector<unsigned char>& bytes) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        bytes.resize(size > 0 ? size : 0);
+        bool ok = size > 0 && fread(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        fclose(f);
+        return ok;
+    }
+
+    bool supported(GLenum internalFormat) const {
+        return internalFormat == GL_COMPRESSED_RG_RGTC2 || m_S3tc;
+    }
+
+    // worker job: read, hash, then decode unless the same contents are already cached or baked
+    void load(std::shared_ptr<Entry> entry) {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+
+        std::vector<unsigned char> bytes;
+        bool read = readFile(entry->path, bytes);
+        bool useCompressed;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (read) {
+                entry->contentHash = hashBytes(bytes.data(), bytes.size());
+                auto owner = m_ByContent.find(entry->contentHash);
+                if (owner != m_ByContent.end()) {
+                    entry->alias = owner->second;
+                    entry->state = Entry::Aliased;
+                    m_Stats.contentHits++;
+                    // acquire() already gave out a name of its own, the GL thread maps it
+                    if (entry->id)
+                        m_Decoded.push_back(entry);
+                    m_InFlight--;
+                    m_Changed.notify_all();
+                    return;
+                }
+                m_ByContent[entry->contentHash] = entry;
+            }
+            entry->state = Entry::Decoding;
+            useCompressed = m_UseCompressed;
+        }
+        m_Changed.notify_all();
+
+        CompressedTexture compressed;
+        if (read && useCompressed
+            && readKtx(compressedTexturePath(entry->path), entry->contentHash, compressed)
+            && !supported(compressed.internalFormat))
+            compressed = CompressedTexture();
+
+        ImageData image;
+        std::vector<MipLevel> mips;
+        if (read && !compressed.valid())
+            image = decodeImage(bytes.data(), bytes.size());
+        if (image.valid())
+            mips = generateMipChain(image);
+        // baking picked BC3 only for images with alpha
+        bool transparent = compressed.valid() ? compressed.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                                              : !image.valid() || hasTransparency(image);
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stats.decodeMs += ms;
+            if (compressed.valid()) {
+                m_Stats.gpuBytes += compressed.bytes();
+            } else if (image.valid()) {
+                size_t baseBytes = (size_t)image.width * image.height * image.components;
+                m_Stats.decodedBytes += baseBytes;
+                m_Stats.gpuBytes += baseBytes;
+                for (const MipLevel& level : mips)
+                    m_Stats.gpuBytes += level.pixels.size();
+            }
+            entry->compressed = std::move(compressed);
+            entry->transparent = transparent;
+            entry->image = std::move(image);
+            entry->mips = std::move(mips);
+            entry->state = Entry::Decoded;
+            m_Decoded.push_back(entry);
+            m_InFlight--;
+        }
+        m_Changed.notify_all();
+    }
+};
+
+};
+#endif //PROJECT_BASE_TEXTURECACHE_H
@@ -0,0 +1,448 @@
+//
+// Offline block compression (BC1/BC3/BC5) and the KTX 1.1 container the baked textures live in.
+//
+// `--bake` encodes every scene texture with its full mip chain into `<image>.ktx`, next to the
+// source image. The KTX key/value data carries the hash of the source file, so a stale bake is
+// ignored. At runtime the texture cache uploads the blocks with glCompressedTexSubImage2D and
+// skips both the decode and the mip generation.
+//
+// Format choice: normal maps -> BC5, images with alpha -> BC3, everything else -> BC1. BC1/BC3
+// need GL_EXT_texture_compression_s3tc (not core), BC5 is core since 3.0 as RGTC2. BC5 keeps only
+// X and Y and samples with B = 0; no shader reads the normal maps yet, one that does has to
+// rebuild Z as sqrt(1 - dot(xy, xy)) itself.
+//
+
+#ifndef PROJECT_BASE_TEXTURECOMPRESSION_H
+#define PROJECT_BASE_TEXTURECOMPRESSION_H
+
+#include <glad/glad.h>
+#include <rg/Hash.h>
+#include <rg/Texture2D.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// the glad loader is generated for the 3.3 core profile without extensions
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace rg {
+
+enum class BlockFormat { BC1, BC3, BC5 };
+
+inline GLenum blockFormatGL(BlockFormat format) {
+    switch (format) {
+        case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        default: return GL_COMPRESSED_RG_RGTC2;
+    }
+}
+
+inline const char* blockFormatName(GLenum internalFormat) {
+    switch (internalFormat) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+        case GL_COMPRESSED_RG_RGTC2: return "BC5";
+        default: return "?";
+    }
+}
+
+// bytes per 4x4 block
+inline size_t blockBytes(GLenum internalFormat) {
+    return internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+}
+
+inline size_t compressedLevelBytes(GLenum internalFormat, int width, int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(internalFormat);
+}
+
+namespace detail {
+
+inline uint16_t packRGB565(const float c[3]) {
+    int r = (int)std::lround(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f);
+    int g = (int)std::lround(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f);
+    int b = (int)std::lround(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRGB565(uint16_t c, float out[3]) {
+    out[0] = ((c >> 11) & 31) * 255.0f / 31.0f;
+    out[1] = ((c >> 5) & 63) * 255.0f / 63.0f;
+    out[2] = (c & 31) * 255.0f / 31.0f;
+}
+
+// 4x4 RGBA texels of the block at (bx, by); texels outside the image repeat the edge
+inline void fetchBlock(const unsigned char* pixels, int width, int height, int components, int bx, int by,
+                       unsigned char out[16][4]) {
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            int sx = std::min(bx * 4 + x, width - 1);
+            int sy = std::min(by * 4 + y, height - 1);
+            const unsigned char* p = pixels + ((size_t)sy * width + sx) * components;
+            unsigned char* o = out[y * 4 + x];
+            if (components >= 3) {
+                o[0] = p[0]; o[1] = p[1]; o[2] = p[2];
+                o[3] = components == 4 ? p[3] : 255;
+            } else {
+                o[0] = o[1] = o[2] = p[0];
+                o[3] = components == 2 ? p[1] : 255;
+            }
+        }
+    }
+}
+
+// BC1 colour block. Endpoints come from the principal axis of the block's colours.
+inline void encodeColorBlock(const unsigned char texels[16][4], unsigned char out[8]) {
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; ++i)
+        for (int k = 0; k < 3; ++k)
+            mean[k] += texels[i][k] / 16.0f;
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; ++i) {
+        float d[3] = {texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2]};
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    // a few power iterations are plenty for a 3x3 matrix
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int it = 0; it < 8; ++it) {
+        float v[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                      cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                      cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+        float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (len < 1e-6f)
+            break;
+        for (int k = 0; k < 3; ++k)
+            axis[k] = v[k] / len;
+    }
+    float minT = 1e30f, maxT = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1]
+                  + (texels[i][2] - mean[2]) * axis[2];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    float end0[3], end1[3];
+    for (int k = 0; k < 3; ++k) {
+        end0[k] = mean[k] + axis[k] * maxT;
+        end1[k] = mean[k] + axis[k] * minT;
+    }
+    uint16_t c0 = packRGB565(end0);
+    uint16_t c1 = packRGB565(end1);
+    // c0 > c1 selects the 4 colour mode
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        float palette[4][3];
+        unpackRGB565(c0, palette[0]);
+        unpackRGB565(c1, palette[1]);
+        for (int k = 0; k < 3; ++k) {
+            palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+            palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 4; ++p) {
+                float error = 0.0f;
+                for (int k = 0; k < 3; ++k) {
+                    float d = texels[i][k] - palette[p][k];
+                    error += d * d;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+// BC4 block of one channel, 8 value mode
+inline void encodeChannelBlock(const unsigned char texels[16][4], int channel, unsigned char out[8]) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; ++i) {
+        lo = std::min<int>(lo, texels[i][channel]);
+        hi = std::max<int>(hi, texels[i][channel]);
+    }
+    out[0] = (unsigned char)hi;
+    out[1] = (unsigned char)lo;
+    uint64_t indices = 0;
+    if (hi != lo) {
+        float palette[8];
+        palette[0] = hi;
+        palette[1] = lo;
+        for (int p = 2; p < 8; ++p)
+            palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7.0f;
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 8; ++p) {
+                float error = std::fabs(texels[i][channel] - palette[p]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    for (int b = 0; b < 6; ++b)
+        out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+};
+
+// compresses one mip level, returns the blocks in row major order
+inline std::vector<unsigned char> compressLevel(const unsigned char* pixels, int width, int height, int components,
+                                                BlockFormat format) {
+    GLenum gl = blockFormatGL(format);
+    std::vector<unsigned char> blocks(compressedLevelBytes(gl, width, height));
+    unsigned char* out = blocks.data();
+    unsigned char texels[16][4];
+    for (int by = 0; by < (height + 3) / 4; ++by) {
+        for (int bx = 0; bx < (width + 3) / 4; ++bx) {
+            detail::fetchBlock(pixels, width, height, components, bx, by, texels);
+            switch (format) {
+                case BlockFormat::BC1:
+                    detail::encodeColorBlock(texels, out);
+                    out += 8;
+                    break;
+                case BlockFormat::BC3:
+                    detail::encodeChannelBlock(texels, 3, out);
+                    detail::encodeColorBlock(texels, out + 8);
+                    out += 16;
+                    break;
+                case BlockFormat::BC5:
+                    detail::encodeChannelBlock(texels, 0, out);
+                    detail::encodeChannelBlock(texels, 1, out + 8);
+                    out += 16;
+                    break;
+            }
+        }
+    }
+    return blocks;
+}
+
+inline bool hasTransparency(const ImageData& image) {
+    if (image.components != 2 && image.components != 4)
+        return false;
+    size_t count = (size_t)image.width * image.height;
+    for (size_t i = 0; i < count; ++i) {
+        if (image.pixels[i * image.components + image.components - 1] != 255)
+            return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------------------------
+// KTX 1.1 container
+
+const unsigned char kKtxIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+const char* const kKtxExtension = ".ktx";
+const char* const kKtxSourceHashKey = "rg.sourceHash";
+
+struct KtxHeader {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+// a baked texture: every level (0 = full resolution) as compressed blocks
+struct CompressedTexture {
+    GLenum internalFormat = 0;
+    uint64_t sourceHash = 0;
+    std::vector<MipLevel> levels;
+
+    bool valid() const {
+        return !levels.empty();
+    }
+    size_t bytes() const {
+        size_t total = 0;
+        for (const MipLevel& level : levels)
+            total += level.pixels.size();
+        return total;
+    }
+};
+
+inline std::string compressedTexturePath(const std::string& sourcePath) {
+    return sourcePath + kKtxExtension;
+}
+
+inline bool writeKtx(const std::string& path, const CompressedTexture& texture) {
+    // one key/value pair: size, "key\0", 8 byte hash, padded to 4
+    uint32_t keyValueSize = strlen(kKtxSourceHashKey) + 1 + sizeof(uint64_t);
+    uint32_t keyValuePadding = (4 - keyValueSize % 4) % 4;
+
+    KtxHeader header;
+    memcpy(header.identifier, kKtxIdentifier, 12);
+    header.endianness = 0x04030201;
+    header.glType = 0;
+    header.glTypeSize = 1;
+    header.glFormat = 0;
+    header.glInternalFormat = texture.internalFormat;
+    header.glBaseInternalFormat = texture.internalFormat == GL_COMPRESSED_RG_RGTC2 ? GL_RG
+                                  : texture.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? GL_RGB : GL_RGBA;
+    header.pixelWidth = texture.levels[0].width;
+    header.pixelHeight = texture.levels[0].height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = texture.levels.size();
+    header.bytesOfKeyValueData = sizeof(uint32_t) + keyValueSize + keyValuePadding;
+
+    std::string tmpPath = temporaryPath(path);
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+        return false;
+    static const unsigned char padding[4] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(&keyValueSize, sizeof(keyValueSize), 1, f) == 1;
+    ok = ok && fwrite(kKtxSourceHashKey, strlen(kKtxSourceHashKey) + 1, 1, f) == 1;
+    ok = ok && fwrite(&texture.sourceHash, sizeof(uint64_t), 1, f) == 1;
+    ok = ok && fwrite(padding, 1, keyValuePadding, f) == keyValuePadding;
+    for (const MipLevel& level : texture.levels) {
+        // block data is always a multiple of 8 bytes, so no mip padding is needed
+        uint32_t imageSize = level.pixels.size();
+        ok = ok && fwrite(&imageSize, sizeof(imageSize), 1, f) == 1;
+        ok = ok && fwrite(level.pixels.data(), 1, imageSize, f) == imageSize;
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// reads a baked texture; fails if it is missing, malformed or baked from a different source
+inline bool readKtx(const std::string& path, uint64_t expectedSourceHash, CompressedTexture& texture) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    KtxHeader header;
+    memset(&header, 0, sizeof(header));
+    bool ok = fread(&header, sizeof(header), 1, f) == 1
+              && memcmp(header.identifier, kKtxIdentifier, 12) == 0
+              && header.endianness == 0x04030201
+              && header.numberOfFaces == 1 && header.numberOfArrayElements == 0
+              && header.numberOfMipmapLevels > 0 && header.numberOfMipmapLevels <= 32
+              && (header.glInternalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                  || header.glInternalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                  || header.glInternalFormat == GL_COMPRESSED_RG_RGTC2);
+    std::vector<unsigned char> keyValues;
+    if (ok) {
+        keyValues.resize(header.bytesOfKeyValueData);
+        ok = keyValues.empty() || fread(keyValues.data(), 1, keyValues.size(), f) == keyValues.size();
+    }
+    uint64_t sourceHash = 0;
+    for (size_t at = 0; ok && at + 4 <= keyValues.size();) {
+        uint32_t size;
+        memcpy(&size, &keyValues[at], 4);
+        if (at + 4 + size > keyValues.size())
+            break;
+        const char* key = reinterpret_cast<const char*>(&keyValues[at + 4]);
+        size_t keyLength = strnlen(key, size);
+        if (strcmp(key, kKtxSourceHashKey) == 0 && size == keyLength + 1 + sizeof(uint64_t))
+            memcpy(&sourceHash, &keyValues[at + 4 + keyLength + 1], sizeof(uint64_t));
+        at += 4 + size + (4 - size % 4) % 4;
+    }
+    ok = ok && sourceHash == expectedSourceHash;
+
+    texture.levels.clear();
+    int width = header.pixelWidth, height = header.pixelHeight;
+    for (uint32_t l = 0; ok && l < header.numberOfMipmapLevels; ++l) {
+        uint32_t imageSize;
+        ok = fread(&imageSize, sizeof(imageSize), 1, f) == 1
+             && imageSize == compressedLevelBytes(header.glInternalFormat, width, height);
+        if (!ok)
+            break;
+        MipLevel level;
+        level.width = width;
+        level.height = height;
+        level.pixels.resize(imageSize);
+        ok = fread(level.pixels.data(), 1, imageSize, f) == imageSize;
+        texture.levels.push_back(std::move(level));
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    fclose(f);
+    texture.internalFormat = header.glInternalFormat;
+    texture.sourceHash = sourceHash;
+    if (!ok)
+        texture.levels.clear();
+    return ok;
+}
+
+// offline bake of one image: decode, build the mip chain, compress every level and write the KTX
+inline bool bakeCompressedTexture(const std::string& sourcePath, bool normalMap, CompressedTexture* result = nullptr) {
+    uint64_t hash = hashFile(sourcePath);
+    ImageData image = decodeImage(sourcePath);
+    if (!hash || !image.valid())
+        return false;
+    BlockFormat format = normalMap ? BlockFormat::BC5
+                                   : hasTransparency(image) ? BlockFormat::BC3 : BlockFormat::BC1;
+    CompressedTexture texture;
+    texture.internalFormat = blockFormatGL(format);
+    texture.sourceHash = hash;
+
+    std::vector<MipLevel> mips = generateMipChain(image);
+    MipLevel base;
+    base.width = image.width;
+    base.height = image.height;
+    base.pixels = compressLevel(image.pixels, image.width, image.height, image.components, format);
+    texture.levels.push_back(std::move(base));
+    for (const MipLevel& mip : mips) {
+        MipLevel level;
+        level.width = mip.width;
+        level.height = mip.height;
+        level.pixels = compressLevel(mip.pixels.data(), mip.width, mip.height, image.components, format);
+        texture.levels.push_back(std::move(level));
+    }
+    if (!writeKtx(compressedTexturePath(sourcePath), texture))
+        return false;
+    if (result)
+        *result = std::move(texture);
+    return true;
+}
+
+// GL thread only
+inline bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+};
+#endif //PROJECT_BASE_TEXTURECOMPRESSION_H
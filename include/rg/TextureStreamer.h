@@ -0,0 +1,343 @@
+//
+// Texture streaming through a ring of pixel buffer objects.
+//
+// Pixels are copied into a PBO slot and glTexSubImage2D reads them from the buffer, so the
+// driver never has to copy client memory synchronously. Each slot is fenced after its uploads
+// are issued and only reused once the fence has signalled; when the next slot is still busy
+// update() just stops for this frame instead of stalling. The per-frame byte budget keeps the
+// cost of streaming while the scene is running bounded.
+//
+// 2D textures are streamed coarsest mip first and GL_TEXTURE_BASE_LEVEL follows the finest
+// level that has landed, so a texture is usable (blurry) after a few bytes and sharpens as the
+// full resolution arrives. Block compressed textures go the same way, a "row" is then a row of
+// 4x4 blocks.
+//
+
+#ifndef PROJECT_BASE_TEXTURESTREAMER_H
+#define PROJECT_BASE_TEXTURESTREAMER_H
+
+#include <glad/glad.h>
+#include <rg/Texture2D.h>
+#include <rg/TextureCompression.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+namespace rg {
+
+class TextureStreamer {
+public:
+    struct Stats {
+        size_t streamedBytes = 0;     // total so far
+        size_t lastUpdateBytes = 0;
+        unsigned int ringFull = 0;    // updates that stopped early because the next slot was in flight
+        unsigned int completed = 0;   // textures fully uploaded
+    };
+
+    explicit TextureStreamer(size_t slotBytes = 4 << 20, unsigned int slotCount = 4)
+            : m_SlotBytes(slotBytes), m_Slots(slotCount) {
+    }
+
+    // allocates the storage for every level of `texture` and queues the pixels.
+    // The image is the base level, `mips` the levels below it (may be empty).
+    void enqueue(unsigned int texture, ImageData&& image, std::vector<MipLevel>&& mips) {
+        Job job;
+        job.texture = texture;
+        job.bindTarget = GL_TEXTURE_2D;
+        job.imageTarget = GL_TEXTURE_2D;
+        job.format = imageFormat(image.components);
+        job.components = image.components;
+        job.base = std::move(image);
+        job.mips = std::move(mips);
+        job.level = job.mips.size();
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (int level = 0; level <= (int)job.mips.size(); ++level)
+            glTexImage2D(GL_TEXTURE_2D, level, job.format, job.width(level), job.height(level), 0, job.format,
+                         GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, job.mips.empty() ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        setUnresident(job);
+        m_Jobs.push_back(std::move(job));
+    }
+
+    // same for a baked, block compressed texture; it already carries its full mip chain
+    void enqueueCompressed(unsigned int texture, CompressedTexture&& compressed) {
+        Job job;
+        job.texture = texture;
+        job.bindTarget = GL_TEXTURE_2D;
+        job.imageTarget = GL_TEXTURE_2D;
+        job.format = compressed.internalFormat;
+        job.compressed = true;
+        job.mips = std::move(compressed.levels);
+        job.level = job.mips.size() - 1;
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (int level = 0; level <= job.level; ++level)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, job.format, job.width(level), job.height(level), 0,
+                                   job.levelBytes(level), nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, job.level ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        setUnresident(job);
+        m_Jobs.push_back(std::move(job));
+    }
+
+    // queues one face (GL_TEXTURE_CUBE_MAP_POSITIVE_X + face) of a cube map, without mips.
+    // Sampling parameters are left to the caller.
+    void enqueueCubeFace(unsigned int texture, unsigned int face, ImageData&& image) {
+        Job job;
+        job.texture = texture;
+        job.bindTarget = GL_TEXTURE_CUBE_MAP;
+        job.imageTarget = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+        job.format = imageFormat(image.components);
+        job.components = image.components;
+        job.base = std::move(image);
+        job.level = 0;
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexImage2D(job.imageTarget, 0, job.format, job.width(0), job.height(0), 0, job.format,
+                     GL_UNSIGNED_BYTE, nullptr);
+        m_Jobs.push_back(std::move(job));
+    }
+
+    // streams up to `budgetBytes` of queued pixels, returns how many bytes were queued for upload.
+    // Never waits on the GPU.
+    size_t update(size_t budgetBytes) {
+        return stream(budgetBytes, false);
+    }
+
+    // streams everything that is queued, waiting for slots when the ring is full (loading screens)
+    void flush() {
+        while (!m_Jobs.empty())
+            stream(SIZE_MAX, true);
+    }
+
+    bool idle() const {
+        return m_Jobs.empty();
+    }
+
+    size_t pendingBytes() const {
+        size_t bytes = 0;
+        for (const Job& job : m_Jobs) {
+            for (int level = job.level; level >= 0; --level)
+                bytes += job.levelBytes(level);
+            bytes -= (size_t)job.row * job.rowBytes(job.level);
+        }
+        return bytes;
+    }
+
+    const Stats& stats() const {
+        return m_Stats;
+    }
+
+    // frees the PBOs; must be called on the GL thread while the context is still alive
+    void release() {
+        for (Slot& slot : m_Slots) {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            if (slot.pbo)
+                glDeleteBuffers(1, &slot.pbo);
+            slot = Slot();
+        }
+        m_Jobs.clear();
+    }
+
+private:
+    struct Job {
+        unsigned int texture = 0;
+        GLenum bindTarget = GL_TEXTURE_2D;
+        GLenum imageTarget = GL_TEXTURE_2D;
+        GLenum format = GL_RGB; // internal format when compressed
+        int components = 3;
+        bool compressed = false;
+        ImageData base;               // level 0 of an uncompressed texture
+        std::vector<MipLevel> mips;   // levels 1..n, or 0..n when compressed
+        int level = 0; // level being streamed, counts down to 0
+        int row = 0;   // next row (of pixels, or of blocks when compressed) of that level
+
+        const MipLevel& mip(int l) const { return mips[compressed ? l : l - 1]; }
+        int width(int l) const { return l == 0 && !compressed ? base.width : mip(l).width; }
+        int height(int l) const { return l == 0 && !compressed ? base.height : mip(l).height; }
+        const unsigned char* pixels(int l) const { return l == 0 && !compressed ? base.pixels : mip(l).pixels.data(); }
+        int rowCount(int l) const { return compressed ? (height(l) + 3) / 4 : height(l); }
+        size_t rowBytes(int l) const {
+            return compressed ? (size_t)((width(l) + 3) / 4) * blockBytes(format) : (size_t)width(l) * components;
+        }
+        size_t levelBytes(int l) const { return rowCount(l) * rowBytes(l); }
+    };
+
+    // a copy that has been written into the open slot and is issued when the slot closes
+    struct Chunk {
+        unsigned int texture;
+        GLenum bindTarget;
+        GLenum imageTarget;
+        GLenum format;
+        bool compressed;
+        int level;
+        int row;
+        int width;
+        int height; // of the level, compressed uploads clip the last block row to it
+        int rows;
+        size_t offset;
+        bool completesLevel;
+    };
+
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+    };
+
+    size_t m_SlotBytes;
+    std::vector<Slot> m_Slots;
+    unsigned int m_Current = 0;
+    unsigned char* m_Mapped = nullptr;
+    size_t m_Offset = 0;
+    std::vector<Chunk> m_Chunks;
+    std::deque<Job> m_Jobs;
+    Stats m_Stats;
+
+    size_t stream(size_t budgetBytes, bool block) {
+        size_t streamed = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        while (!m_Jobs.empty() && streamed < budgetBytes) {
+            Job& job = m_Jobs.front();
+            int width = job.width(job.level);
+            int height = job.rowCount(job.level);
+            size_t rowBytes = job.rowBytes(job.level);
+
+            if (rowBytes > m_SlotBytes) {
+                // a single row doesn't fit a slot, fall back to a plain client memory upload
+                closeSlot();
+                glBindTexture(job.bindTarget, job.texture);
+                if (job.compressed)
+                    glCompressedTexSubImage2D(job.imageTarget, job.level, 0, 0, width, job.height(job.level),
+                                              job.format, job.levelBytes(job.level), job.pixels(job.level));
+                else
+                    glTexSubImage2D(job.imageTarget, job.level, 0, 0, width, height, job.format, GL_UNSIGNED_BYTE,
+                                    job.pixels(job.level));
+                if (job.bindTarget == GL_TEXTURE_2D)
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+                streamed += job.levelBytes(job.level);
+                job.row = height;
+                finishLevel(job);
+                continue;
+            }
+            if (!m_Mapped && !openSlot(block)) {
+                m_Stats.ringFull++;
+                break;
+            }
+            size_t rowsFit = (m_SlotBytes - m_Offset) / rowBytes;
+            if (rowsFit == 0) {
+                closeSlot();
+                continue;
+            }
+            int rows = (int)std::min<size_t>(rowsFit, height - job.row);
+            memcpy(m_Mapped + m_Offset, job.pixels(job.level) + job.row * rowBytes, rows * rowBytes);
+            Chunk chunk = {job.texture, job.bindTarget, job.imageTarget, job.format, job.compressed, job.level,
+                           job.row, width, job.height(job.level), rows, m_Offset, job.row + rows == height};
+            m_Chunks.push_back(chunk);
+            m_Offset += rows * rowBytes;
+            streamed += rows * rowBytes;
+            job.row += rows;
+            if (job.row == height)
+                finishLevel(job);
+        }
+        closeSlot();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        m_Stats.streamedBytes += streamed;
+        m_Stats.lastUpdateBytes = streamed;
+        return streamed;
+    }
+
+    // nothing has landed yet: a base level past the coarsest one leaves the texture incomplete (it
+    // samples as black) until the coarsest level's upload is issued, finer levels follow as they land
+    static void setUnresident(const Job& job) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level + 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job.level);
+    }
+
+    // moves the job on to the next finer level, or drops it (and its pixels) when done
+    void finishLevel(Job& job) {
+        job.row = 0;
+        if (job.level > 0) {
+            job.level--;
+        } else {
+            m_Jobs.pop_front();
+            m_Stats.completed++;
+        }
+    }
+
+    bool openSlot(bool block) {
+        Slot& slot = m_Slots[m_Current];
+        if (!slot.pbo) {
+            glGenBuffers(1, &slot.pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, m_SlotBytes, nullptr, GL_STREAM_DRAW);
+        }
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        if (slot.fence) {
+            GLenum status = glClientWaitSync(slot.fence, block ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                             block ? 1000000000ull : 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+                return false;
+            if (status == GL_WAIT_FAILED) {
+                // the fence is unusable, waiting on it again would fail every frame. Reuse the slot but
+                // let the driver synchronise (or orphan the buffer) since nothing says the GPU is done.
+                std::cout << "ERROR::TEXTURE_STREAMER:: waiting for an upload slot failed" << std::endl;
+                access &= ~GL_MAP_UNSYNCHRONIZED_BIT;
+            }
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        // unless the wait failed the fence guarantees the GPU is done with this slot, so no implicit
+        // synchronisation is needed
+        m_Mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_SlotBytes, access));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        m_Offset = 0;
+        return m_Mapped != nullptr;
+    }
+
+    // unmaps the open slot, issues its copies and fences it
+    void closeSlot() {
+        if (!m_Mapped)
+            return;
+        Slot& slot = m_Slots[m_Current];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        for (const Chunk& chunk : m_Chunks) {
+            glBindTexture(chunk.bindTarget, chunk.texture);
+            const void* offset = reinterpret_cast<const void*>(chunk.offset);
+            if (chunk.compressed) {
+                int y = chunk.row * 4;
+                int height = std::min(chunk.rows * 4, chunk.height - y);
+                size_t bytes = (size_t)chunk.rows * ((chunk.width + 3) / 4) * blockBytes(chunk.format);
+                glCompressedTexSubImage2D(chunk.imageTarget, chunk.level, 0, y, chunk.width, height, chunk.format,
+                                          bytes, offset);
+            } else {
+                glTexSubImage2D(chunk.imageTarget, chunk.level, 0, chunk.row, chunk.width, chunk.rows, chunk.format,
+                                GL_UNSIGNED_BYTE, offset);
+            }
+            // levels land coarse to fine, let sampling use the new one
+            if (chunk.completesLevel && chunk.bindTarget == GL_TEXTURE_2D)
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, chunk.level);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_Chunks.clear();
+        m_Mapped = nullptr;
+        m_Offset = 0;
+        m_Current = (m_Current + 1) % m_Slots.size();
+    }
+};
+
+};
+#endif //PROJECT_BASE_TEXTURESTREAMER_H
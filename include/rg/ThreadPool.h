@@ -0,0 +1,87 @@
+//
+// Fixed size worker pool for CPU side asset work (imports, image decodes, bakes).
+// Jobs must not touch OpenGL: the context only lives on the main thread.
+//
+
+#ifndef PROJECT_BASE_THREADPOOL_H
+#define PROJECT_BASE_THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace rg {
+
+class ThreadPool {
+public:
+    // 0 threads means one per hardware core
+    explicit ThreadPool(unsigned int threadCount = 0) {
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < threadCount; ++i)
+            m_Workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // finishes the queued jobs, then joins the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stopping = true;
+        }
+        m_Wakeup.notify_all();
+        for (std::thread& worker : m_Workers)
+            worker.join();
+    }
+
+    unsigned int size() const {
+        return m_Workers.size();
+    }
+
+    template<typename F>
+    auto submit(F&& job) -> std::future<typename std::result_of<F()>::type> {
+        using Result = typename std::result_of<F()>::type;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Jobs.push([task] { (*task)(); });
+        }
+        m_Wakeup.notify_one();
+        return result;
+    }
+
+private:
+    std::vector<std::thread> m_Workers;
+    std::queue<std::function<void()>> m_Jobs;
+    std::mutex m_Mutex;
+    std::condition_variable m_Wakeup;
+    bool m_Stopping = false;
+
+    void workerLoop() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Wakeup.wait(lock, [this] { return m_Stopping || !m_Jobs.empty(); });
+                if (m_Jobs.empty())
+                    return;
+                job = std::move(m_Jobs.front());
+                m_Jobs.pop();
+            }
+            job();
+        }
+    }
+};
+
+};
+#endif //PROJECT_BASE_THREADPOOL_H
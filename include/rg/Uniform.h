@@ -0,0 +1,248 @@
+//
+// Uniform location table and typed uniform handles.
+//
+// After a program links, UniformTable reflects every active uniform once (including each element
+// of uniform arrays) into a small open addressing hash table keyed by the name hash. Looking a name
+// up never calls glGetUniformLocation.
+//
+// Uniform<T> is a handle resolved once at setup time. Setting it is a single glUniform* call on the
+// cached location; no strings are built or hashed. Handles go through the table, so they stay
+// valid if the table is re-reflected for a relinked program.
+//
+
+#ifndef PROJECT_BASE_UNIFORM_H
+#define PROJECT_BASE_UNIFORM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <rg/Hash.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+class UniformTable {
+public:
+    struct Entry {
+        std::string name;
+        uint64_t hash;
+        GLint location;
+        GLenum type;
+    };
+
+    // replaces the table with the active uniforms of `program`. GL thread only.
+    void reflect(GLuint program) {
+        m_Entries.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(maxLength + 1);
+        for (GLint i = 0; i < count; ++i) {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+            std::string uniformName(name.data(), length);
+            GLint location = glGetUniformLocation(program, uniformName.c_str());
+            if (location < 0)
+                continue; // uniforms of a block, they have no location
+            add(uniformName, location, type);
+
+            // arrays come back as "name[0]"; also register "name" and every other element
+            size_t bracket = uniformName.size() >= 3 ? uniformName.rfind("[0]") : std::string::npos;
+            if (bracket != std::string::npos && bracket + 3 == uniformName.size()) {
+                std::string base = uniformName.substr(0, bracket);
+                add(base, location, type);
+                for (GLint element = 1; element < size; ++element) {
+                    std::string elementName = base + '[' + std::to_string(element) + ']';
+                    add(elementName, glGetUniformLocation(program, elementName.c_str()), type);
+                }
+            }
+        }
+        rebuildBuckets();
+        // handles resolved against the previous program
+        for (Binding& binding : m_Bindings)
+            binding.location = location(binding.name.c_str(), binding.name.size());
+        static unsigned int generations = 0;
+        m_Generation = ++generations;
+    }
+
+    // -1 if `name` isn't an active uniform, like glGetUniformLocation
+    GLint location(const char* name, size_t length) const {
+        if (m_Buckets.empty())
+            return -1;
+        uint64_t hash = hashBytes(name, length);
+        size_t mask = m_Buckets.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            int index = m_Buckets[i];
+            if (index < 0)
+                return -1;
+            const Entry& entry = m_Entries[index];
+            if (entry.hash == hash && entry.name.size() == length && memcmp(entry.name.data(), name, length) == 0)
+                return entry.location;
+        }
+    }
+    GLint location(const std::string& name) const {
+        return location(name.data(), name.size());
+    }
+
+    // registers `name` for a handle and returns its index. Setup time only, allocates.
+    int bind(const std::string& name) {
+        for (size_t i = 0; i < m_Bindings.size(); ++i) {
+            if (m_Bindings[i].name == name)
+                return (int)i;
+        }
+        m_Bindings.push_back({name, location(name)});
+        return (int)m_Bindings.size() - 1;
+    }
+    GLint boundLocation(int binding) const {
+        return m_Bindings[binding].location;
+    }
+
+    const std::vector<Entry>& entries() const {
+        return m_Entries;
+    }
+    // unique per reflect() across all tables, lets callers notice that cached locations went stale
+    unsigned int generation() const {
+        return m_Generation;
+    }
+
+private:
+    struct Binding {
+        std::string name;
+        GLint location;
+    };
+
+    std::vector<Entry> m_Entries;
+    std::vector<int> m_Buckets; // indices into m_Entries, -1 when empty; power of two sized
+    std::vector<Binding> m_Bindings;
+    unsigned int m_Generation = 0;
+
+    void add(const std::string& name, GLint location, GLenum type) {
+        if (location >= 0)
+            m_Entries.push_back({name, hashBytes(name.data(), name.size()), location, type});
+    }
+
+    void rebuildBuckets() {
+        size_t size = 16;
+        while (size < m_Entries.size() * 2)
+            size *= 2;
+        m_Buckets.assign(size, -1);
+        size_t mask = size - 1;
+        for (size_t index = 0; index < m_Entries.size(); ++index) {
+            size_t i = m_Entries[index].hash & mask;
+            while (m_Buckets[i] >= 0)
+                i = (i + 1) & mask;
+            m_Buckets[i] = (int)index;
+        }
+    }
+};
+
+inline void uploadUniform(GLint location, bool value) { glUniform1i(location, (int)value); }
+inline void uploadUniform(GLint location, int value) { glUniform1i(location, value); }
+inline void uploadUniform(GLint location, float value) { glUniform1f(location, value); }
+inline void uploadUniform(GLint location, const glm::vec2& value) { glUniform2fv(location, 1, &value[0]); }
+inline void uploadUniform(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+inline void uploadUniform(GLint location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+inline void uploadUniform(GLint location, const glm::mat2& value) { glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]); }
+inline void uploadUniform(GLint location, const glm::mat3& value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+inline void uploadUniform(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+// writes the value of the uniform at `fromLocation` in `from` to `toLocation` of the current program.
+// Both are of `type`; types the shaders don't use are skipped.
+inline void copyUniform(GLuint from, GLint fromLocation, GLint toLocation, GLenum type) {
+    GLfloat floats[16];
+    GLint ints[4];
+    switch (type) {
+    case GL_FLOAT:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniform1fv(toLocation, 1, floats);
+        break;
+    case GL_FLOAT_VEC2:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniform2fv(toLocation, 1, floats);
+        break;
+    case GL_FLOAT_VEC3:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniform3fv(toLocation, 1, floats);
+        break;
+    case GL_FLOAT_VEC4:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniform4fv(toLocation, 1, floats);
+        break;
+    case GL_FLOAT_MAT2:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniformMatrix2fv(toLocation, 1, GL_FALSE, floats);
+        break;
+    case GL_FLOAT_MAT3:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniformMatrix3fv(toLocation, 1, GL_FALSE, floats);
+        break;
+    case GL_FLOAT_MAT4:
+        glGetUniformfv(from, fromLocation, floats);
+        glUniformMatrix4fv(toLocation, 1, GL_FALSE, floats);
+        break;
+    case GL_INT_VEC2:
+        glGetUniformiv(from, fromLocation, ints);
+        glUniform2iv(toLocation, 1, ints);
+        break;
+    case GL_INT_VEC3:
+        glGetUniformiv(from, fromLocation, ints);
+        glUniform3iv(toLocation, 1, ints);
+        break;
+    case GL_INT_VEC4:
+        glGetUniformiv(from, fromLocation, ints);
+        glUniform4iv(toLocation, 1, ints);
+        break;
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_BUFFER:
+    case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+        glGetUniformiv(from, fromLocation, ints);
+        glUniform1i(toLocation, ints[0]);
+        break;
+    case GL_UNSIGNED_INT: {
+        GLuint value = 0;
+        glGetUniformuiv(from, fromLocation, &value);
+        glUniform1ui(toLocation, value);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Typed handle to a uniform of one program, get it from Shader::uniform<T>(name).
+// Like the set* functions it writes to the currently bound program.
+template<typename T>
+class Uniform {
+public:
+    Uniform() = default;
+    Uniform(const UniformTable* table, int binding) : m_Table(table), m_Binding(binding) {}
+
+    void set(const T& value) const {
+        uploadUniform(location(), value);
+    }
+    GLint location() const {
+        return m_Table ? m_Table->boundLocation(m_Binding) : -1;
+    }
+    bool active() const {
+        return location() >= 0;
+    }
+
+private:
+    const UniformTable* m_Table = nullptr;
+    int m_Binding = 0;
+};
+
+};
+#endif //PROJECT_BASE_UNIFORM_H
@@ -0,0 +1,153 @@
+//
+// std140 uniform blocks shared by every program.
+//
+// The camera (Frame block), the scene lights (Lights block), the shadow cascades (Shadows block) and
+// the light cluster grid (Clusters block) are written once per frame into one uniform buffer each,
+// bound to fixed binding points. Every program gets its blocks attached to those points right after
+// linking (bindUniformBlocks), so a new shader only has to declare the block to see the data.
+// GLSL 3.30 has no layout(binding = N), hence the glUniformBlockBinding.
+//
+// The structs below mirror the GLSL declarations byte for byte; a vec3 is followed by a float
+// (either a real member or padding) to match the std140 16 byte alignment.
+//
+
+#ifndef PROJECT_BASE_UNIFORMBUFFER_H
+#define PROJECT_BASE_UNIFORMBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+namespace rg {
+
+enum UniformBlockBinding : GLuint {
+    kFrameBlockBinding = 0,
+    kLightsBlockBinding = 1,
+    kShadowsBlockBinding = 2,
+    kClustersBlockBinding = 3,
+};
+
+// layout (std140) uniform Frame
+struct FrameBlock {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPosition;
+    float padding;
+};
+
+// members of the Lights block
+struct DirLightBlock {
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+struct SpotlightBlock {
+    glm::vec3 position;
+    float constant;
+    glm::vec3 direction;
+    float linear;
+    glm::vec3 ambient;
+    float quadratic;
+    glm::vec3 diffuse;
+    float cutOff;
+    glm::vec3 specular;
+    float outerCutOff;
+};
+
+// layout (std140) uniform Lights
+struct LightsBlock {
+    DirLightBlock dirLight;
+    SpotlightBlock light;
+};
+
+const int kMaxShadowCascades = 4;
+
+// layout (std140) uniform Shadows
+struct ShadowsBlock {
+    glm::mat4 lightSpace[kMaxShadowCascades]; // world to shadow map clip space, per cascade
+    glm::vec4 splits;                         // far end of each cascade, view space distance
+    GLint cascadeCount;                       // 0 when shadows are off
+    float bias;
+    float padding[2];
+};
+
+// layout (std140) uniform Clusters
+struct ClustersBlock {
+    GLint grid[4];      // tiles x, tiles y, depth slices, light count (0 skips the cluster loop)
+    glm::vec4 params;   // near, far, slices / log(far / near), unused
+    glm::vec4 tileSize; // pixels per tile in x and y, unused, unused
+};
+
+static_assert(sizeof(FrameBlock) == 144 && offsetof(FrameBlock, viewPosition) == 128, "Frame block isn't std140");
+static_assert(sizeof(DirLightBlock) == 64 && sizeof(SpotlightBlock) == 80, "light structs aren't std140");
+static_assert(offsetof(LightsBlock, light) == 64, "Lights block isn't std140");
+static_assert(offsetof(ShadowsBlock, splits) == 256 && sizeof(ShadowsBlock) == 288, "Shadows block isn't std140");
+static_assert(offsetof(ClustersBlock, tileSize) == 32 && sizeof(ClustersBlock) == 48, "Clusters block isn't std140");
+
+// attaches the blocks `program` declares to their binding points. Blocks it doesn't use are skipped.
+inline void bindUniformBlocks(GLuint program) {
+    static const struct {
+        const char* name;
+        GLuint binding;
+    } blocks[] = {
+            {"Frame", kFrameBlockBinding},
+            {"Lights", kLightsBlockBinding},
+            {"Shadows", kShadowsBlockBinding},
+            {"Clusters", kClustersBlockBinding},
+    };
+    for (const auto& block : blocks) {
+        GLuint index = glGetUniformBlockIndex(program, block.name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, block.binding);
+    }
+}
+
+// One uniform buffer holding a T, bound to a fixed binding point for its whole lifetime.
+template<typename T>
+class UniformBuffer {
+public:
+    explicit UniformBuffer(GLuint binding) : m_Binding(binding) {
+        glGenBuffers(1, &m_Buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, m_Buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, m_Binding, m_Buffer);
+    }
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+    ~UniformBuffer() {
+        release();
+    }
+
+    // whole block in one go; orphaning lets the driver skip waiting for draws still reading it
+    void update(const T& data) {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_Buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    GLuint binding() const {
+        return m_Binding;
+    }
+
+    // call before the context is destroyed
+    void release() {
+        if (m_Buffer)
+            glDeleteBuffers(1, &m_Buffer);
+        m_Buffer = 0;
+    }
+
+private:
+    GLuint m_Buffer = 0;
+    GLuint m_Binding;
+};
+
+};
+#endif //PROJECT_BASE_UNIFORMBUFFER_H
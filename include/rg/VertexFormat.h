@@ -0,0 +1,291 @@
+//
+// GPU vertex layouts.
+//
+// Meshes are imported, optimised and cached as the float Vertex (56 bytes). When a mesh is uploaded
+// the active VertexLayout packs every attribute into its own format:
+//   float       everything as float, 56 bytes, like Vertex
+//   packed      normal and tangent as normalized 10-10-10-2, half float UVs, 24 bytes
+//   octahedral  like packed, but the normal is octahedral encoded in two 16 bit snorms (more
+//               precise than 10 bits per axis); the vertex shaders decode it with OCTAHEDRAL_NORMALS
+// Packed layouts don't store the bitangent: the tangent's w is the handedness, and a shader that
+// needs it rebuilds it as cross(normal, tangent.xyz) * tangent.w.
+//
+// Positions stay float and live in a stream of their own, the other attributes are interleaved in
+// a second one. Programs only read the subset of attributes they declare: the depth only passes
+// (shadows, depth pre-pass) read location 0 and so only ever touch the 12 byte position stream.
+// checkAttributes() reports programs that read an attribute the layout doesn't provide.
+//
+
+#ifndef PROJECT_BASE_VERTEXFORMAT_H
+#define PROJECT_BASE_VERTEXFORMAT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// attribute locations of the mesh shaders, in Vertex order
+enum VertexAttribute : unsigned int {
+    kAttributePosition = 0,
+    kAttributeNormal = 1,
+    kAttributeTexCoords = 2,
+    kAttributeTangent = 3,
+    kAttributeBitangent = 4,
+    kVertexAttributeCount = 5,
+};
+
+enum class AttributeFormat {
+    None,         // not stored, the attribute reads as (0, 0, 0, 1)
+    Float2,
+    Float3,
+    Half2,
+    Int2101010,   // normalized xyz in 10 bits each, w (-1 or 1) in 2
+    Octahedral16, // unit vector folded onto the octahedron, two normalized shorts
+};
+
+inline unsigned int formatSize(AttributeFormat format) {
+    switch (format) {
+        case AttributeFormat::Float2: return 8;
+        case AttributeFormat::Float3: return 12;
+        case AttributeFormat::Half2: return 4;
+        case AttributeFormat::Int2101010: return 4;
+        case AttributeFormat::Octahedral16: return 4;
+        default: return 0;
+    }
+}
+
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    uint32_t exponent = (bits >> 23) & 0xFFu;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+    if (exponent == 0xFF)
+        return sign | 0x7C00u | (mantissa ? 0x200u : 0u);
+    int halfExponent = (int)exponent - 127 + 15;
+    if (halfExponent >= 31)
+        return sign | 0x7C00u;
+    if (halfExponent <= 0) {
+        // denormal, or too small for one
+        if (halfExponent < -10)
+            return sign;
+        mantissa |= 0x800000u;
+        uint32_t shift = 14 - halfExponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1u)))
+            half++;
+        return sign | half;
+    }
+    uint32_t half = sign | (uint32_t)halfExponent << 10 | mantissa >> 13;
+    // round to nearest even, a carry into the exponent is still the right result
+    uint32_t rest = mantissa & 0x1FFFu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+        half++;
+    return (uint16_t)half;
+}
+
+inline uint32_t packInt2101010(const glm::vec4& v) {
+    auto component = [](float x, float scale, uint32_t mask) {
+        float clamped = std::fmax(-1.0f, std::fmin(1.0f, x));
+        return (uint32_t)(int32_t)std::lround(clamped * scale) & mask;
+    };
+    return component(v.x, 511.0f, 0x3FFu) | component(v.y, 511.0f, 0x3FFu) << 10
+           | component(v.z, 511.0f, 0x3FFu) << 20 | component(v.w, 1.0f, 0x3u) << 30;
+}
+
+// octahedral encoding in [-1, 1]^2, decoded by decodeNormal() in the mesh vertex shaders
+inline glm::vec2 encodeOctahedral(const glm::vec3& n) {
+    float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (sum <= 0.0f)
+        return glm::vec2(0.0f);
+    glm::vec2 p(n.x / sum, n.y / sum);
+    if (n.z < 0.0f) {
+        glm::vec2 folded((1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                         (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+        p = folded;
+    }
+    return p;
+}
+
+class VertexLayout {
+public:
+    std::string name;
+    AttributeFormat formats[kVertexAttributeCount];
+
+    static VertexLayout floats() {
+        return VertexLayout("float", AttributeFormat::Float3, AttributeFormat::Float2, AttributeFormat::Float3,
+                            AttributeFormat::Float3);
+    }
+    static VertexLayout packed() {
+        return VertexLayout("packed", AttributeFormat::Int2101010, AttributeFormat::Half2,
+                            AttributeFormat::Int2101010, AttributeFormat::None);
+    }
+    static VertexLayout octahedral() {
+        return VertexLayout("octahedral", AttributeFormat::Octahedral16, AttributeFormat::Half2,
+                            AttributeFormat::Int2101010, AttributeFormat::None);
+    }
+    // one of the layouts above by name, false if there is none
+    static bool byName(const std::string& name, VertexLayout& layout) {
+        for (const VertexLayout& candidate : {floats(), packed(), octahedral()}) {
+            if (candidate.name == name) {
+                layout = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the layout meshes are uploaded with; set it before anything is loaded
+    static VertexLayout& active() {
+        static VertexLayout layout = packed();
+        return layout;
+    }
+
+    // bytes per vertex of the position stream and of the attribute stream
+    unsigned int positionStride() const {
+        return formatSize(formats[kAttributePosition]);
+    }
+    unsigned int attributeStride() const {
+        unsigned int stride = 0;
+        for (unsigned int a = kAttributeNormal; a < kVertexAttributeCount; ++a)
+            stride += formatSize(formats[a]);
+        return stride;
+    }
+    unsigned int vertexSize() const {
+        return positionStride() + attributeStride();
+    }
+
+    // #defines the mesh vertex shaders need to read this layout
+    std::string shaderDefines() const {
+        return formats[kAttributeNormal] == AttributeFormat::Octahedral16 ? "#define OCTAHEDRAL_NORMALS\n" : "";
+    }
+
+    // converts `count` vertices into the two streams
+    template <typename VertexType>
+    void pack(const VertexType* vertices, size_t count, std::vector<unsigned char>& positions,
+              std::vector<unsigned char>& attributes) const {
+        positions.resize(count * positionStride());
+        attributes.resize(count * attributeStride());
+        unsigned char* position = positions.data();
+        unsigned char* attribute = attributes.data();
+        for (size_t i = 0; i < count; ++i) {
+            const VertexType& vertex = vertices[i];
+            position = write(position, formats[kAttributePosition], glm::vec4(vertex.Position, 1.0f));
+            attribute = write(attribute, formats[kAttributeNormal], glm::vec4(vertex.Normal, 0.0f));
+            attribute = write(attribute, formats[kAttributeTexCoords],
+                              glm::vec4(vertex.TexCoords.x, vertex.TexCoords.y, 0.0f, 0.0f));
+            // w: which way the bitangent points, for layouts that rebuild it
+            float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f
+                                                                                                             : 1.0f;
+            attribute = write(attribute, formats[kAttributeTangent], glm::vec4(vertex.Tangent, handedness));
+            attribute = write(attribute, formats[kAttributeBitangent], glm::vec4(vertex.Bitangent, 0.0f));
+        }
+    }
+
+    // points the attributes of the bound VAO at the two streams
+    void setAttributes(GLuint positionBuffer, GLuint attributeBuffer) const {
+        glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        setAttribute(kAttributePosition, positionStride(), 0);
+        glBindBuffer(GL_ARRAY_BUFFER, attributeBuffer);
+        size_t offset = 0;
+        for (unsigned int a = kAttributeNormal; a < kVertexAttributeCount; ++a) {
+            setAttribute(a, attributeStride(), offset);
+            offset += formatSize(formats[a]);
+        }
+    }
+
+private:
+    VertexLayout(const char* name, AttributeFormat normal, AttributeFormat texCoords, AttributeFormat tangent,
+                 AttributeFormat bitangent)
+        : name(name), formats{AttributeFormat::Float3, normal, texCoords, tangent, bitangent} {}
+
+    static unsigned char* write(unsigned char* out, AttributeFormat format, const glm::vec4& value) {
+        switch (format) {
+            case AttributeFormat::Float2:
+            case AttributeFormat::Float3:
+                memcpy(out, &value[0], formatSize(format));
+                break;
+            case AttributeFormat::Half2: {
+                uint16_t half[2] = {floatToHalf(value.x), floatToHalf(value.y)};
+                memcpy(out, half, sizeof(half));
+                break;
+            }
+            case AttributeFormat::Int2101010: {
+                uint32_t packed = packInt2101010(value);
+                memcpy(out, &packed, sizeof(packed));
+                break;
+            }
+            case AttributeFormat::Octahedral16: {
+                glm::vec2 encoded = encodeOctahedral(glm::vec3(value));
+                int16_t snorm[2] = {(int16_t)std::lround(encoded.x * 32767.0f),
+                                    (int16_t)std::lround(encoded.y * 32767.0f)};
+                memcpy(out, snorm, sizeof(snorm));
+                break;
+            }
+            default:
+                break;
+        }
+        return out + formatSize(format);
+    }
+
+    void setAttribute(GLuint location, unsigned int stride, size_t offset) const {
+        const void* pointer = (const void*)offset;
+        switch (formats[location]) {
+            case AttributeFormat::Float2:
+                glVertexAttribPointer(location, 2, GL_FLOAT, GL_FALSE, stride, pointer);
+                break;
+            case AttributeFormat::Float3:
+                glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride, pointer);
+                break;
+            case AttributeFormat::Half2:
+                glVertexAttribPointer(location, 2, GL_HALF_FLOAT, GL_FALSE, stride, pointer);
+                break;
+            case AttributeFormat::Int2101010:
+                glVertexAttribPointer(location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, pointer);
+                break;
+            case AttributeFormat::Octahedral16:
+                glVertexAttribPointer(location, 2, GL_SHORT, GL_TRUE, stride, pointer);
+                break;
+            default:
+                glDisableVertexAttribArray(location);
+                return;
+        }
+        glEnableVertexAttribArray(location);
+    }
+};
+
+// Prints an error for every mesh attribute (locations below `firstInstanceAttribute`) the program
+// reads but `layout` doesn't store. False if there was any.
+inline bool checkAttributes(GLuint program, const char* programName, const VertexLayout& layout,
+                            GLuint firstInstanceAttribute) {
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    bool complete = true;
+    for (GLint i = 0; i < count; ++i) {
+        char name[64];
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(program, i, sizeof(name), nullptr, &size, &type, name);
+        GLint location = glGetAttribLocation(program, name);
+        if (location < 0 || (GLuint)location >= firstInstanceAttribute || location >= (GLint)kVertexAttributeCount)
+            continue;
+        if (layout.formats[location] == AttributeFormat::None) {
+            std::cout << "ERROR::VERTEX_LAYOUT:: " << programName << " reads " << name << ", the " << layout.name
+                      << " layout doesn't store it" << std::endl;
+            complete = false;
+        }
+    }
+    return complete;
+}
+
+};
+#endif //PROJECT_BASE_VERTEXFORMAT_H
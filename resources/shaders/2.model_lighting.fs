@@ -8,6 +8,7 @@ struct Material {
     float shininess;
 };
 
+// light structs are laid out for std140, every vec3 is followed by a float
 struct DirLight {
     vec3 direction;
 
@@ -16,64 +17,82 @@ struct DirLight {
     vec3 specular;
 };
 
-struct PointLight {
-    vec3 position;
-
-    vec3 specular;
-    vec3 diffuse;
-    vec3 ambient;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
 struct Spotlight {
     vec3 position;
+    float constant;
     vec3 direction;
-    float cutOff;
-    float outerCutOff;
+    float linear;
 
     vec3 ambient;
+    float quadratic;
     vec3 diffuse;
+    float cutOff;
     vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
+    float outerCutOff;
 };
 
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
 
-uniform PointLight pointLight;
-uniform DirLight dirLight;
-uniform Material material;
-uniform Spotlight light;
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+};
+
+layout (std140) uniform Lights {
+    DirLight dirLight;
+    Spotlight light;
+};
+
+// cascaded shadow maps of dirLight, see rg::CascadedShadowMap
+layout (std140) uniform Shadows {
+    mat4 lightSpace[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    float shadowBias;
+};
+
+// light cluster grid, see rg::LightClusters
+layout (std140) uniform Clusters {
+    ivec4 clusterGrid;     // tiles x, tiles y, slices, light count
+    vec4 clusterParams;    // near, far, slices / log(far / near)
+    vec4 clusterTileSize;  // pixels per tile
+};
 
-uniform vec3 viewPosition;
-// calculates the color when using a point light.
+uniform Material material;
+uniform sampler2DArrayShadow shadowMap;
+uniform samplerBuffer clusterLights;   // 2 texels per light: position, radius; color
+uniform usamplerBuffer clusterRanges;  // first index, count per cluster
+uniform usamplerBuffer clusterIndices;
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcSpotLight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+// `albedo` and `specularMask` are the material's texels, sampled once in main()
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, float specularMask);
+float CalcShadow(vec3 fragPos, vec3 normal, vec3 lightDir);
+vec3 CalcSpotLight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask);
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask);
 
 void main()
 {
-    vec3 normal = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
-
-    vec3 result = CalcDirLight(dirLight, normal, viewDir);
     vec4 texColor = texture(material.texture_diffuse1, TexCoords);
+#ifdef ALPHA_TEST
+    // ALPHA_TEST variant only, see the model programs in main.cpp. Before any lighting, so
+    // discarded texels don't pay for it
     if(texColor.a < 0.1)
         discard;
-    //result += CalcPointLight(pointLight, normal, fs_in.FragPos, viewDir);
-    result += CalcSpotLight(light, normal, FragPos, viewDir);
+#endif
+    float specularMask = texture(material.texture_specular1, TexCoords).x;
+    vec3 normal = normalize(Normal);
+    vec3 viewDir = normalize(viewPosition - FragPos);
+
+    vec3 result = CalcDirLight(dirLight, normal, viewDir, texColor.rgb, specularMask);
+    result += CalcSpotLight(light, normal, FragPos, viewDir, texColor.rgb, specularMask);
+    result += CalcClusteredLights(normal, FragPos, viewDir, texColor.rgb, specularMask);
     FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, float specularMask)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
@@ -84,12 +103,43 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 halfwayDir = normalize(lightDir + viewDir);
     float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    return (ambient + diffuse + specular);
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    float shadow = CalcShadow(FragPos, normal, lightDir);
+    return (ambient + (1.0 - shadow) * (diffuse + specular));
+}
+// 0 when lit, 1 when fully in shadow
+float CalcShadow(vec3 fragPos, vec3 normal, vec3 lightDir)
+{
+    if (cascadeCount == 0)
+        return 0.0;
+    // the first cascade whose slice reaches this far from the camera
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int cascade = cascadeCount - 1;
+    for (int i = 0; i < cascadeCount; ++i)
+    {
+        if (depth < cascadeSplits[i])
+        {
+            cascade = i;
+            break;
+        }
+    }
+    vec4 lightPos = lightSpace[cascade] * vec4(fragPos, 1.0);
+    vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+    if (coords.z > 1.0)
+        return 0.0;
+    // steeper surfaces need more bias
+    float bias = shadowBias * (1.0 + 4.0 * (1.0 - max(dot(normal, lightDir), 0.0)));
+    // 3x3 taps, each one already 2x2 filtered by the depth compare
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x)
+        for (int y = -1; y <= 1; ++y)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z - bias));
+    return 1.0 - lit / 9.0;
 }
-vec3 CalcSpotLight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -103,9 +153,9 @@ vec3 CalcSpotLight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -119,29 +169,35 @@ vec3 CalcSpotLight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     return (ambient + diffuse + specular);
 }
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+// the point lights binned into this fragment's cluster
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask)
 {
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    //advanced lighting
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-
-    //float shadow = CalcShadow(FragPos, light.position);
-    vec3 lighting = (ambient + (diffuse + specular));
-
-    return lighting;
-}
\ No newline at end of file
+    if (clusterGrid.w == 0)
+        return vec3(0.0);
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = clamp(int(log(depth / clusterParams.x) * clusterParams.z), 0, clusterGrid.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterTileSize.xy), ivec2(0), clusterGrid.xy - 1);
+    int cluster = (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+    uvec2 range = texelFetch(clusterRanges, cluster).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int index = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(clusterLights, index * 2);
+        vec3 color = texelFetch(clusterLights, index * 2 + 1).rgb;
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance2 = dot(toLight, toLight);
+        // windowed falloff, reaches 0 exactly at the radius the light was binned with
+        float falloff = clamp(1.0 - distance2 / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        falloff *= falloff;
+        if (falloff == 0.0)
+            continue;
+        vec3 lightDir = toLight * inversesqrt(distance2);
+        float diff = max(dot(normal, lightDir), 0.0);
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+        result += color * falloff * (diff * albedo + spec * specularMask);
+    }
+    return result;
+}
@@ -1,20 +1,46 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+#ifdef OCTAHEDRAL_NORMALS
+layout (location = 1) in vec2 aNormal; // octahedral encoded, see rg::VertexLayout
+#else
 layout (location = 1) in vec3 aNormal;
+#endif
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+// matches the depth pre-pass (depth_prepass*.vs) bit for bit
+invariant gl_Position;
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+};
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// transpose(inverse(mat3(model))), computed once per draw, see rg::normalMatrix
+uniform mat3 normalMatrix;
+
+vec3 decodeNormal()
+{
+#ifdef OCTAHEDRAL_NORMALS
+    vec3 n = vec3(aNormal, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+    // unfold the lower hemisphere
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+#else
+    return aNormal;
+#endif
+}
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = aNormal;
+    // to world space; the inverse transpose keeps it perpendicular under non-uniform scale
+    Normal = normalMatrix * decodeNormal();
     TexCoords = aTexCoords;    
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+#ifdef OCTAHEDRAL_NORMALS
+layout (location = 1) in vec2 aNormal; // octahedral encoded, see rg::VertexLayout
+#else
+layout (location = 1) in vec3 aNormal;
+#endif
+layout (location = 2) in vec2 aTexCoords;
+// per instance, see rg::InstanceBuffer
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in mat3 aInstanceNormalMatrix;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+// matches the depth pre-pass (depth_prepass*.vs) bit for bit
+invariant gl_Position;
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+};
+
+vec3 decodeNormal()
+{
+#ifdef OCTAHEDRAL_NORMALS
+    vec3 n = vec3(aNormal, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+    // unfold the lower hemisphere
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+#else
+    return aNormal;
+#endif
+}
+
+void main()
+{
+    FragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    // to world space by the instance's normal matrix, see 2.model_lighting.vs
+    Normal = aInstanceNormalMatrix * decodeNormal();
+    TexCoords = aTexCoords;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
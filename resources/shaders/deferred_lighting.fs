@@ -0,0 +1,194 @@
+#version 330 core
+// lighting pass of the deferred renderer: the same lights as 2.model_lighting.fs, evaluated once
+// per pixel from the G-buffer
+out vec4 FragColor;
+
+// light structs are laid out for std140, every vec3 is followed by a float
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct Spotlight {
+    vec3 position;
+    float constant;
+    vec3 direction;
+    float linear;
+
+    vec3 ambient;
+    float quadratic;
+    vec3 diffuse;
+    float cutOff;
+    vec3 specular;
+    float outerCutOff;
+};
+
+// what the geometry pass left for this pixel
+struct Surface {
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    float specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+};
+
+layout (std140) uniform Lights {
+    DirLight dirLight;
+    Spotlight light;
+};
+
+// cascaded shadow maps of dirLight, see rg::CascadedShadowMap
+layout (std140) uniform Shadows {
+    mat4 lightSpace[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    float shadowBias;
+};
+
+// light cluster grid, see rg::LightClusters
+layout (std140) uniform Clusters {
+    ivec4 clusterGrid;     // tiles x, tiles y, slices, light count
+    vec4 clusterParams;    // near, far, slices / log(far / near)
+    vec4 clusterTileSize;  // pixels per tile
+};
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform float shininess;
+uniform sampler2DArrayShadow shadowMap;
+uniform samplerBuffer clusterLights;   // 2 texels per light: position, radius; color
+uniform usamplerBuffer clusterRanges;  // first index, count per cluster
+uniform usamplerBuffer clusterIndices;
+
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir);
+float CalcShadow(vec3 fragPos, vec3 normal, vec3 lightDir);
+vec3 CalcSpotLight(Spotlight light, Surface surface, vec3 viewDir);
+vec3 CalcClusteredLights(Surface surface, vec3 viewDir);
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // nothing was drawn here, the skybox fills it later
+    if (depth == 1.0)
+        discard;
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+    vec4 position = inverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+
+    Surface surface;
+    surface.position = position.xyz / position.w;
+    surface.normal = normalize(texelFetch(gNormal, pixel, 0).xyz);
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    surface.albedo = albedoSpecular.rgb;
+    surface.specular = albedoSpecular.a;
+
+    vec3 viewDir = normalize(viewPosition - surface.position);
+    vec3 result = CalcDirLight(dirLight, surface, viewDir);
+    result += CalcSpotLight(light, surface, viewDir);
+    result += CalcClusteredLights(surface, viewDir);
+    FragColor = vec4(result, 1.0);
+}
+
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(surface.normal, halfwayDir), 0.0), shininess);
+    vec3 ambient = light.ambient * surface.albedo;
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+    vec3 specular = light.specular * spec * surface.specular;
+    float shadow = CalcShadow(surface.position, surface.normal, lightDir);
+    return (ambient + (1.0 - shadow) * (diffuse + specular));
+}
+// 0 when lit, 1 when fully in shadow
+float CalcShadow(vec3 fragPos, vec3 normal, vec3 lightDir)
+{
+    if (cascadeCount == 0)
+        return 0.0;
+    // the first cascade whose slice reaches this far from the camera
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int cascade = cascadeCount - 1;
+    for (int i = 0; i < cascadeCount; ++i)
+    {
+        if (depth < cascadeSplits[i])
+        {
+            cascade = i;
+            break;
+        }
+    }
+    vec4 lightPos = lightSpace[cascade] * vec4(fragPos, 1.0);
+    vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+    if (coords.z > 1.0)
+        return 0.0;
+    // steeper surfaces need more bias
+    float bias = shadowBias * (1.0 + 4.0 * (1.0 - max(dot(normal, lightDir), 0.0)));
+    // 3x3 taps, each one already 2x2 filtered by the depth compare
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x)
+        for (int y = -1; y <= 1; ++y)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z - bias));
+    return 1.0 - lit / 9.0;
+}
+vec3 CalcSpotLight(Spotlight light, Surface surface, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - surface.position);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(surface.normal, halfwayDir), 0.0), shininess);
+    // attenuation
+    float distance = length(light.position - surface.position);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    vec3 ambient = light.ambient * surface.albedo;
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+    vec3 specular = light.specular * spec * surface.specular;
+    //spotlight
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = (light.cutOff - light.outerCutOff);
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    return (ambient + (diffuse + specular) * intensity) * attenuation;
+}
+
+// the point lights binned into this pixel's cluster
+vec3 CalcClusteredLights(Surface surface, vec3 viewDir)
+{
+    if (clusterGrid.w == 0)
+        return vec3(0.0);
+    float depth = -(view * vec4(surface.position, 1.0)).z;
+    int slice = clamp(int(log(depth / clusterParams.x) * clusterParams.z), 0, clusterGrid.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterTileSize.xy), ivec2(0), clusterGrid.xy - 1);
+    int cluster = (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+    uvec2 range = texelFetch(clusterRanges, cluster).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int index = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(clusterLights, index * 2);
+        vec3 color = texelFetch(clusterLights, index * 2 + 1).rgb;
+        vec3 toLight = positionRadius.xyz - surface.position;
+        float distance2 = dot(toLight, toLight);
+        // windowed falloff, reaches 0 exactly at the radius the light was binned with
+        float falloff = clamp(1.0 - distance2 / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        falloff *= falloff;
+        if (falloff == 0.0)
+            continue;
+        vec3 lightDir = toLight * inversesqrt(distance2);
+        float diff = max(dot(surface.normal, lightDir), 0.0);
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        float spec = pow(max(dot(surface.normal, halfwayDir), 0.0), shininess);
+        result += color * falloff * (diff * surface.albedo + spec * surface.specular);
+    }
+    return result;
+}
@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+// per instance, see rg::InstanceBuffer
+layout (location = 5) in mat4 aInstanceModel;
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+};
+
+// same expression as 2.model_lighting_instanced.vs, both invariant
+invariant gl_Position;
+
+void main()
+{
+    vec3 fragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
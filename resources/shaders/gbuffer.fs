@@ -0,0 +1,29 @@
+#version 330 core
+// geometry pass of the deferred renderer, see rg::GBuffer
+layout (location = 0) out vec4 gAlbedoSpecular;
+layout (location = 1) out vec4 gNormal;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+
+    float shininess;
+};
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform Material material;
+
+void main()
+{
+    vec4 texColor = texture(material.texture_diffuse1, TexCoords);
+#ifdef ALPHA_TEST
+    // ALPHA_TEST variant only, see the model programs in main.cpp
+    if(texColor.a < 0.1)
+        discard;
+#endif
+    gAlbedoSpecular = vec4(texColor.rgb, texture(material.texture_specular1, TexCoords).r);
+    gNormal = vec4(normalize(Normal), 0.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+// unit cube scaled onto a world box, see rg::OcclusionCuller
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+};
+
+uniform mat4 model;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+// per instance, see rg::InstanceBuffer
+layout (location = 5) in mat4 aInstanceModel;
+
+uniform mat4 lightSpace;
+
+void main()
+{
+    gl_Position = lightSpace * aInstanceModel * vec4(aPos, 1.0);
+}
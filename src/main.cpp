@@ -13,9 +13,30 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <rg/Benchmark.h>
+#include <rg/BVH.h>
+#include <rg/CameraPath.h>
+#include <rg/ClusteredLights.h>
+#include <rg/GBuffer.h>
+#include <rg/GLStats.h>
+#include <rg/Headless.h>
+#include <rg/Lod.h>
+#include <rg/ModelLoader.h>
+#include <rg/OcclusionCulling.h>
+#include <rg/Profiler.h>
+#include <rg/RenderQueue.h>
+#include <rg/SampleCounter.h>
+#include <rg/Scene.h>
+#include <rg/ShaderReload.h>
+#include <rg/Shadows.h>
+#include <rg/UniformBuffer.h>
+#include <rg/VertexFormat.h>
+
+#include <chrono>
 #include <iostream>
+#include <cstdio>
 #include <ctime>
+#include <random>
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
@@ -24,11 +45,23 @@ void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path);
 unsigned int loadCubeMap(vector<std::string> faces);
 int randRange(int low,int high);
+int bakeAssets(unsigned int workerThreads);
+int printTextureMemory();
+void printVertexMemory(const rg::Scene &scene);
+int Shutdown(GLFWwindow *window, rg::HeadlessContext &headlessContext, int exitCode);
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
 const unsigned int SCR_HEIGHT = 800;
 
+// scene description loaded at startup (`--scene`), also what `--bake` and `--texture-memory` work on
+std::string scenePath = "resources/scenes/default.scene";
+// textures the scene loads directly, on top of the ones referenced by the models
+const vector<std::string> sceneTextures{
+        "resources/textures/stonefloor1.jpg",
+        "resources/textures/corn.png"
+};
+
 // camera
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
@@ -38,16 +71,6 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-struct PointLight {
-    glm::vec3 position;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
 
 struct ProgramState {
     glm::vec3 clearColor = glm::vec3(0);
@@ -55,9 +78,13 @@ struct ProgramState {
     Camera camera;
     bool CameraMouseMovementUpdateEnabled = true;
     bool spotlight = true;
-    bool plight=true;
-    PointLight pointLight;
     float ambientLight = 0.0f;
+    bool shadows = true;
+    bool clusteredLights = true;
+    bool depthPrepass = true;
+    bool occlusionCulling = true;
+    bool levelsOfDetail = true;
+    float lodBias = 1.0f;
 
     ProgramState()
             : camera(glm::vec3(-0.5f, 5.0f, 100.0f)) {}
@@ -100,41 +127,236 @@ void ProgramState::LoadFromFile(std::string filename) {
 }
 ProgramState *programState;
 
-void DrawImGui(ProgramState *programState);
+// `--light-bench`: the clustered lights of the scene are replaced by 1, 2, 4, ... kMaxLights random
+// lights, each count is drawn from the same fixed camera for a while and the average frame time is
+// printed per step. Frames are timed back to back with vsync off.
+struct LightBenchmark {
+    static const int kMaxLights = 1024;
+    static const int kWarmupFrames = 30;
+    static const int kMeasuredFrames = 120;
+
+    bool active = false;
+
+    void start(rg::LightClusters &clusters) {
+        std::mt19937 random(4321); // fixed seed, every run gets the same lights
+        std::uniform_real_distribution<float> horizontal(-40.0f, 40.0f);
+        std::uniform_real_distribution<float> height(0.5f, 6.0f);
+        std::uniform_real_distribution<float> radius(4.0f, 10.0f);
+        std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+        m_Lights.clear();
+        for (int i = 0; i < kMaxLights; i++) {
+            rg::ClusterLight light = rg::ClusterLight();
+            light.position = glm::vec3(horizontal(random), height(random), horizontal(random));
+            light.radius = radius(random);
+            light.color = glm::vec3(channel(random), channel(random), channel(random));
+            m_Lights.push_back(light);
+        }
+        active = true;
+        m_Count = 1;
+        reset(clusters);
+        printf("%8s %10s %8s %11s %12s %12s\n", "lights", "frame ms", "fps", "binning ms", "in frustum",
+               "light/cluster");
+    }
 
-int main() {
-    // glfw: initialize and configure
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // call once per frame after the clusters were updated, returns true when the last step is done
+    bool frame(float deltaTime, const rg::ClusterStats &stats, rg::LightClusters &clusters) {
+        if (++m_Frame <= kWarmupFrames)
+            return false;
+        m_FrameMs += deltaTime * 1000.0;
+        m_BinMs += stats.binMs;
+        m_Visible += stats.visibleLights;
+        m_Indices += stats.indices;
+        if (m_Frame < kWarmupFrames + kMeasuredFrames)
+            return false;
+        double frameMs = m_FrameMs / kMeasuredFrames;
+        printf("%8d %10.3f %8.1f %11.3f %12.1f %12.1f\n", m_Count, frameMs, 1000.0 / frameMs,
+               m_BinMs / kMeasuredFrames, m_Visible / kMeasuredFrames, m_Indices / kMeasuredFrames);
+        m_Count *= 2;
+        if (m_Count > kMaxLights) {
+            active = false;
+            return true;
+        }
+        reset(clusters);
+        return false;
+    }
 
+private:
+    std::vector<rg::ClusterLight> m_Lights;
+    int m_Count = 0;
+    int m_Frame = 0;
+    double m_FrameMs = 0.0, m_BinMs = 0.0, m_Visible = 0.0, m_Indices = 0.0;
 
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
+    void reset(rg::LightClusters &clusters) {
+        clusters.setLights(std::vector<rg::ClusterLight>(m_Lights.begin(), m_Lights.begin() + m_Count));
+        m_Frame = 0;
+        m_FrameMs = m_BinMs = m_Visible = m_Indices = 0.0;
+    }
+};
+
+// `--benchmark path` and `--headless N`: the camera follows a path (see rg/CameraPath.h) with a
+// fixed time step instead of the input, so every run draws the same frames. After a few warm-up
+// frames at the start of the path the frames are measured (see rg/Benchmark.h), the summary is
+// printed at the end and, with `--benchmark-out prefix`, written to prefix.json and prefix.csv.
+// The path is a file written by `--record-path` or `orbit`, once around the scene. Its frame count
+// is one per kBenchmarkTimeStep, or N when headless: N frames at evenly spaced points of the path.
+// Headless runs use the default settings, not the saved ones, and finish every frame before the
+// next starts since there is no swap to wait for.
+struct CameraBenchmark {
+    static const int kWarmupFrames = 10;
+
+    rg::CameraPath path = rg::CameraPath::orbit(glm::vec3(0.0f, 2.0f, 0.0f), 30.0f, 8.0f, 20.0f);
+    std::string pathName = "orbit";
+    rg::BenchmarkRecorder recorder;
+    bool active = false;
+    bool finished = false;
+
+    // `frames` 0: one per kBenchmarkTimeStep of the path
+    void start(int frames) {
+        m_Frames = frames > 0 ? frames : (int)(path.duration() / rg::kBenchmarkTimeStep) + 1;
+        m_Frame = -kWarmupFrames;
+        recorder.create();
+        active = true;
+    }
+
+    // simulated time between two frames
+    float timeStep() const {
+        return m_Frames > 1 ? path.duration() / (float)(m_Frames - 1) : 0.0f;
+    }
+
+    // the camera of the next frame
+    Camera camera() const {
+        return path.sample(timeStep() * (float)std::max(m_Frame, 0));
+    }
+
+    void beginFrame() {
+        if (m_Frame >= 0)
+            recorder.beginFrame(timeStep() * (float)m_Frame);
+    }
+
+    // call once the frame is issued, before it is swapped or finished
+    void endFrame(const rg::RenderStats &stats, const rg::GLCallStats &calls) {
+        if (m_Frame >= 0)
+            recorder.endFrame(stats, calls);
+        finished = ++m_Frame >= m_Frames;
+    }
+
+private:
+    int m_Frames = 0;
+    int m_Frame = 0;
+};
 
-    // glfw window creation
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Projekat", NULL, NULL);
-    if (window == NULL) {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+void DrawImGui(ProgramState *programState, const rg::RenderStats &renderStats, const rg::CullStats &cullStats,
+               unsigned int sceneNodes, unsigned int sceneUpdated,
+               const std::vector<rg::CascadeStats> &shadowStats, const rg::ClusterStats &clusterStats,
+               size_t gbufferBytes, const rg::OpaqueStats &opaqueStats, uint64_t shadedFragments,
+               const rg::OcclusionStats &occlusionStats, const rg::LodStats &lodStats, rg::Profiler &profiler,
+               const rg::GLCallStats &glCalls);
+
+int main(int argc, char **argv) {
+    bool bake = false;
+    bool textureMemory = false;
+    unsigned int workerThreads = 0; // one per core
+    int stressJars = 0;
+    bool lightBench = false;
+    bool deferred = false;
+    int headlessFrames = 0; // no window when set
+    std::string benchmarkPath, benchmarkOut, recordPath, tracePath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--bake")
+            bake = true;
+        else if (arg == "--texture-memory")
+            textureMemory = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            workerThreads = std::stoi(argv[++i]);
+        else if (arg == "--stress-jars" && i + 1 < argc)
+            stressJars = std::stoi(argv[++i]);
+        else if (arg == "--scene" && i + 1 < argc)
+            scenePath = argv[++i];
+        else if (arg == "--light-bench")
+            lightBench = true;
+        else if (arg == "--deferred")
+            deferred = true;
+        else if (arg == "--vertex-format" && i + 1 < argc) {
+            if (!rg::VertexLayout::byName(argv[++i], rg::VertexLayout::active()))
+                std::cout << "ERROR::VERTEX_LAYOUT:: unknown vertex format " << argv[i]
+                          << ", using " << rg::VertexLayout::active().name << std::endl;
+        } else if (arg == "--headless" && i + 1 < argc)
+            headlessFrames = std::stoi(argv[++i]);
+        else if (arg == "--benchmark" && i + 1 < argc)
+            benchmarkPath = argv[++i];
+        else if (arg == "--benchmark-out" && i + 1 < argc)
+            benchmarkOut = argv[++i];
+        else if (arg == "--record-path" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (arg == "--benchmark-compare" && i + 2 < argc) {
+            // exit code 1 when anything got slower
+            int regressions = rg::compareBenchmarks(argv[i + 1], argv[i + 2]);
+            return regressions < 0 ? -1 : (regressions > 0 ? 1 : 0);
+        }
+    }
+    // offline bake step, doesn't need a window or a GL context
+    if (bake)
+        return bakeAssets(workerThreads);
+    if (textureMemory)
+        return printTextureMemory();
+
+    CameraBenchmark benchmark;
+    if (!benchmarkPath.empty() && benchmarkPath != benchmark.pathName) {
+        if (!benchmark.path.load(benchmarkPath))
+            return -1;
+        benchmark.pathName = benchmarkPath;
     }
-    glfwMakeContextCurrent(window);
 
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-    glfwSetKeyCallback(window, key_callback);
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // headless: an offscreen context, its framebuffer stands in for the window's (0) everywhere below
+    GLFWwindow *window = NULL;
+    rg::HeadlessContext headlessContext;
+    if (headlessFrames > 0) {
+        if (!headlessContext.create(SCR_WIDTH, SCR_HEIGHT)) {
+            headlessContext.release();
+            return -1;
+        }
+    } else {
+        // glfw: initialize and configure
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
 
-    // glad: load all OpenGL function pointers
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        // glfw window creation
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Projekat", NULL, NULL);
+        if (window == NULL) {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+        glfwSetKeyCallback(window, key_callback);
+        // tell GLFW to capture our mouse
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+        // glad: load all OpenGL function pointers
+        if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
     }
+    const GLuint mainFramebuffer = headlessContext.framebuffer();
+    // built with RG_GL_STATS, every GL call from here on is counted
+    rg::installGLStats();
+    // baked .ktx textures: BC5 is core, BC1/BC3 come with the S3TC extension
+    rg::TextureCache::instance().setCompressedFormats(true, rg::hasGLExtension("GL_EXT_texture_compression_s3tc"));
 
     glEnable(GL_BLEND);
     glEnable(GL_DEPTH_TEST);
@@ -147,50 +369,78 @@ int main() {
     stbi_set_flip_vertically_on_load(true);
 
     programState = new ProgramState;
-    programState->LoadFromFile("resources/program_state.txt");
-    if (programState->ImGuiEnabled) {
-        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-    }
+    if (window) {
+        programState->LoadFromFile("resources/program_state.txt");
+        if (programState->ImGuiEnabled) {
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+        }
 
-    // Init Imgui
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO &io = ImGui::GetIO();
-    (void) io;
+        // Init Imgui
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGuiIO &io = ImGui::GetIO();
+        (void) io;
 
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330 core");
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+        ImGui_ImplOpenGL3_Init("#version 330 core");
+    }
 
     // build and compile shaders
-    Shader ourShader("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs");
+    // the model programs come in two variants: ALPHA_TEST discards transparent texels, the opaque
+    // one has no discard and keeps early-Z (a discard anywhere in a shader turns it off, even where it
+    // never runs, hence the #ifdef in the shaders). Both read the vertices in the active layout.
+    const std::string vertexDefines = rg::VertexLayout::active().shaderDefines();
+    const std::string alphaTestDefines = vertexDefines + "#define ALPHA_TEST\n";
+    const char *opaque = vertexDefines.c_str();
+    const char *alphaTest = alphaTestDefines.c_str();
+    Shader ourShader("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs", nullptr, alphaTest);
+    Shader instancedShader("resources/shaders/2.model_lighting_instanced.vs", "resources/shaders/2.model_lighting.fs",
+                           nullptr, alphaTest);
+    Shader ourOpaqueShader("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs", nullptr,
+                           opaque);
+    Shader instancedOpaqueShader("resources/shaders/2.model_lighting_instanced.vs", "resources/shaders/2.model_lighting.fs",
+                                 nullptr, opaque);
     Shader skyboxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
     Shader blendingShader("resources/shaders/blending.vs", "resources/shaders/blanding.fs");
-
-    // load models
-    Model ourModel("resources/objects/backpack/backpack.obj");
-    ourModel.SetShaderTextureNamePrefix("material.");
-
-    Model Jar("resources/objects/AncientJar/Jar.obj");
-    Jar.SetShaderTextureNamePrefix("material.");
-    Model Temple("resources/objects/AncientTemple/obj/objTemple.obj");
-    Temple.SetShaderTextureNamePrefix("material.");
-    Model Well("resources/objects/MedievalWell/Well_OBJ.obj");
-    Well.SetShaderTextureNamePrefix("material.");
-    Model StoneGate("resources/objects/StoneGate/Stonegate.obj");
-    StoneGate.SetShaderTextureNamePrefix("material.");
-    Model Lantern("resources/objects/Lantern/Lantern.obj");
-    Lantern.SetShaderTextureNamePrefix("material.");
-
-    // Point light
-    PointLight& pointLight = programState->pointLight;
-    pointLight.position = glm::vec3(0.0f, 0.0, 0.0);
-    pointLight.ambient = glm::vec3(0.1, 0.1, 0.1);
-    pointLight.diffuse = glm::vec3(0.6, 0.6, 0.6);
-    pointLight.specular = glm::vec3(1.0, 1.0, 1.0);
-
-    pointLight.constant = 1.0f;
-    pointLight.linear = 0.09f;
-    pointLight.quadratic = 0.032f;
+    Shader shadowDepthShader("resources/shaders/shadow_depth.vs", "resources/shaders/shadow_depth.fs");
+    Shader shadowDepthInstancedShader("resources/shaders/shadow_depth_instanced.vs", "resources/shaders/shadow_depth.fs");
+    Shader depthPrepassShader("resources/shaders/depth_prepass.vs", "resources/shaders/shadow_depth.fs");
+    Shader depthPrepassInstancedShader("resources/shaders/depth_prepass_instanced.vs", "resources/shaders/shadow_depth.fs");
+    Shader occlusionBoxShader("resources/shaders/occlusion_box.vs", "resources/shaders/shadow_depth.fs");
+    Shader gbufferShader("resources/shaders/2.model_lighting.vs", "resources/shaders/gbuffer.fs", nullptr, alphaTest);
+    Shader gbufferInstancedShader("resources/shaders/2.model_lighting_instanced.vs", "resources/shaders/gbuffer.fs",
+                                  nullptr, alphaTest);
+    Shader gbufferOpaqueShader("resources/shaders/2.model_lighting.vs", "resources/shaders/gbuffer.fs", nullptr, opaque);
+    Shader gbufferOpaqueInstancedShader("resources/shaders/2.model_lighting_instanced.vs", "resources/shaders/gbuffer.fs",
+                                        nullptr, opaque);
+    Shader deferredLightingShader("resources/shaders/deferred_lighting.vs", "resources/shaders/deferred_lighting.fs");
+    // each program reads its own subset of the mesh attributes, all of them have to be in the layout
+    const std::pair<Shader *, const char *> meshPrograms[] = {
+            {&ourShader, "model"}, {&instancedShader, "model (instanced)"}, {&ourOpaqueShader, "opaque model"},
+            {&instancedOpaqueShader, "opaque model (instanced)"}, {&shadowDepthShader, "shadow depth"},
+            {&shadowDepthInstancedShader, "shadow depth (instanced)"}, {&depthPrepassShader, "depth pre-pass"},
+            {&depthPrepassInstancedShader, "depth pre-pass (instanced)"}, {&gbufferShader, "G-buffer"},
+            {&gbufferInstancedShader, "G-buffer (instanced)"}, {&gbufferOpaqueShader, "opaque G-buffer"},
+            {&gbufferOpaqueInstancedShader, "opaque G-buffer (instanced)"}};
+    for (const auto &program : meshPrograms)
+        rg::checkAttributes(program.first->ID, program.second, rg::VertexLayout::active(),
+                            rg::InstanceBuffer::kFirstAttribute);
+
+    // load the scene: model imports and texture decodes run on the worker pool,
+    // the GL uploads happen here as soon as each import is done
+    rg::ThreadPool workerPool(workerThreads);
+    rg::TextureCache::instance().setThreadPool(&workerPool);
+    rg::LoadReport loadReport;
+    rg::Scene scene;
+    if (!rg::loadScene(scenePath, workerPool, scene, &loadReport)) {
+        rg::TextureCache::instance().setThreadPool(nullptr);
+        rg::TextureCache::instance().release();
+        return Shutdown(window, headlessContext, -1);
+    }
+    loadReport.print();
+    printVertexMemory(scene);
+    for (Model &m : scene.models)
+        m.SetShaderTextureNamePrefix("material.");
 
 
     // plain
@@ -283,18 +533,6 @@ int main() {
     glEnableVertexAttribArray(2);
 
 
-    vector<glm::vec3> stone
-            {
-                    glm::vec3(-1.5f, 0.5f, -0.48f),
-                    glm::vec3( 1.5f, 0.5f, 0.51f),
-                    glm::vec3( 0.0f, 0.5f, 0.7f),
-                    glm::vec3(-0.7f, 0.5f, -2.3f),
-                    glm::vec3 (1.0f, 0.5f, -1.2f),
-                    glm::vec3 (-0.1f, 0.5f, -0.63f),
-                    glm::vec3 (-1.75f, 0.5f, 1.0f),
-                    glm::vec3 (-0.6f, 0.5f, -2.0f)
-            };
-
     unsigned int diffuseMap = loadTexture(FileSystem::getPath("resources/textures/stonefloor1.jpg").c_str());
 
     //load textures
@@ -336,23 +574,10 @@ int main() {
     // load transparent texture
     unsigned int transparentTexture = loadTexture(FileSystem::getPath("resources/textures/corn.png").c_str());
 
-    // transparent objects locations
-    vector<glm::vec3> vegetation
-            {
-                    glm::vec3(-15.0f, 0.0f, -4.8f),
-                    glm::vec3( 15.0f, 0.0f, 5.1f),
-                    glm::vec3( 12.0f, 0.0f, 7.0f),
-                    glm::vec3(-3.0f, 0.0f, -23.0f),
-                    glm::vec3 (5.0f, 0.0f, -6.0f)
-            };
-
     ourShader.use();
     ourShader.setInt("material.texture_diffuse1", 0);
     ourShader.setInt("material.texture_specular1", 1);
 
-    glm::vec3 lightPos(-5.0f, 4.0f, -5.0f);
-    glm::mat4 model = glm::mat4(1.0f);
-
     int randArrayX[50];
     for(int i=0;i<50;i++)
         randArrayX[i]= randRange(-50,50);
@@ -364,189 +589,481 @@ int main() {
     blendingShader.use();
     blendingShader.setInt("texture1", 0);
 
+    for (Shader *shader : {&ourShader, &instancedShader, &ourOpaqueShader, &instancedOpaqueShader}) {
+        shader->use();
+        shader->setFloat("material.shininess", 32.0f);
+        shader->setInt("shadowMap", rg::kShadowMapUnit);
+        shader->setInt("clusterLights", rg::kClusterLightsUnit);
+        shader->setInt("clusterRanges", rg::kClusterRangesUnit);
+        shader->setInt("clusterIndices", rg::kClusterIndicesUnit);
+    }
+    deferredLightingShader.use();
+    deferredLightingShader.setInt("gAlbedoSpecular", rg::kGBufferAlbedoUnit);
+    deferredLightingShader.setInt("gNormal", rg::kGBufferNormalUnit);
+    deferredLightingShader.setInt("gDepth", rg::kGBufferDepthUnit);
+    deferredLightingShader.setFloat("shininess", 32.0f);
+    deferredLightingShader.setInt("shadowMap", rg::kShadowMapUnit);
+    deferredLightingShader.setInt("clusterLights", rg::kClusterLightsUnit);
+    deferredLightingShader.setInt("clusterRanges", rg::kClusterRangesUnit);
+    deferredLightingShader.setInt("clusterIndices", rg::kClusterIndicesUnit);
+
+    // `--deferred`: the opaque geometry only fills the G-buffer, one full screen pass lights it.
+    // The forward shaders are used when the G-buffer can't be created.
+    rg::GBuffer gbuffer;
+    if (deferred && !gbuffer.create(SCR_WIDTH, SCR_HEIGHT)) {
+        gbuffer.release();
+        deferred = false;
+    }
+    std::cout << "renderer: " << (deferred ? "deferred" : "forward") << std::endl;
+    rg::OpaquePrograms opaquePrograms;
+    if (deferred) {
+        opaquePrograms = {&gbufferOpaqueShader, gbufferOpaqueShader.uniform<glm::mat4>("model"),
+                          gbufferOpaqueShader.uniform<glm::mat3>("normalMatrix"), &gbufferOpaqueInstancedShader,
+                          &gbufferShader, gbufferShader.uniform<glm::mat4>("model"),
+                          gbufferShader.uniform<glm::mat3>("normalMatrix"), &gbufferInstancedShader};
+    } else {
+        opaquePrograms = {&ourOpaqueShader, ourOpaqueShader.uniform<glm::mat4>("model"),
+                          ourOpaqueShader.uniform<glm::mat3>("normalMatrix"), &instancedOpaqueShader, &ourShader,
+                          ourShader.uniform<glm::mat4>("model"), ourShader.uniform<glm::mat3>("normalMatrix"),
+                          &instancedShader};
+    }
+    unsigned int fullscreenVAO;
+    glGenVertexArrays(1, &fullscreenVAO);
+
+    // `--stress-jars N` scatters N more jars around the scene, under the jars of the scene file.
+    // Drawn instanced, one draw per mesh no matter how many there are.
+    if (stressJars) {
+        Model *jar = scene.model("jar");
+        uint32_t jars = scene.graph.find("jars");
+        if (jar) {
+            rg::Transform local;
+            local.scale = glm::vec3(0.05f);
+            std::mt19937 stressRandom(1234); // fixed seed, every run scatters the same jars
+            std::uniform_real_distribution<float> stressPosition(-100.0f, 100.0f);
+            std::uniform_real_distribution<float> stressAngle(0.0f, 360.0f);
+            for (int i = 0; i < stressJars; i++) {
+                local.position = glm::vec3(stressPosition(stressRandom), 0.0f, stressPosition(stressRandom));
+                local.rotation = rg::rotationDegrees(glm::vec3(-90.0f, stressAngle(stressRandom), 0.0f));
+                scene.place("jar", jars, local, jar, rg::SceneGraph::kInstanced);
+            }
+            std::cout << "stress mode: " << stressJars << " extra jars, " << jar->meshes.size()
+                      << " draw call(s) per frame for all of them" << std::endl;
+        } else {
+            std::cout << "stress mode: the scene has no model 'jar'" << std::endl;
+        }
+    }
+    // the world matrices are computed here once and cached by the graph,
+    // the render loop only recomputes nodes that were moved
+    scene.graph.update();
+
+    // the nodes with a model are culled as a whole through the BVH, rebuilt when something moves
+    vector<uint32_t> drawableNodes;
+    vector<rg::AABB> sceneBounds;
+    scene.graph.collectDrawable(drawableNodes, sceneBounds);
+    rg::BVH sceneBVH;
+    sceneBVH.build(sceneBounds);
+    vector<uint32_t> visibleObjects;
+    visibleObjects.reserve(drawableNodes.size());
+    unsigned int sceneUpdated = 0;
+    rg::CullStats cullStats;
+
+    // vegetation, one instanced draw
+    vector<glm::mat4> vegetationTransforms;
+    for (const rg::Transform &billboard : scene.description.billboards)
+        vegetationTransforms.push_back(billboard.matrix());
+    rg::InstanceBuffer vegetationInstances;
+    vegetationInstances.upload(vegetationTransforms);
+    glBindVertexArray(transparentVAO);
+    vegetationInstances.attach();
+    glBindVertexArray(0);
+
+    // camera and lights go to every program through the shared uniform blocks
+    rg::UniformBuffer<rg::FrameBlock> frameBlock(rg::kFrameBlockBinding);
+    rg::UniformBuffer<rg::LightsBlock> lightsBlock(rg::kLightsBlockBinding);
+
+    // uniform handles, resolved once so the render loop doesn't look any uniform up by name
+    rg::Uniform<glm::mat4> modelUniform = opaquePrograms.opaqueModel;
+    rg::Uniform<glm::mat3> normalMatrixUniform = opaquePrograms.opaqueNormalMatrix;
+    rg::Uniform<glm::mat4> depthPrepassModel = depthPrepassShader.uniform<glm::mat4>("model");
+    rg::Uniform<int> skyboxSampler = skyboxShader.uniform<int>("skybox");
+    rg::Uniform<int> planeSampler = opaquePrograms.opaque->uniform<int>("material.texture_diffuse1");
+    rg::Uniform<glm::mat4> inverseViewProjection = deferredLightingShader.uniform<glm::mat4>("inverseViewProjection");
+    rg::Uniform<int> vegetationSampler = blendingShader.uniform<int>("texture1");
+
+    // draws are collected per frame and submitted sorted, binds go through the state cache
+    rg::RenderQueue renderQueue;
+    rg::GLStateCache glState;
+    // fragments the opaque passes shade, read a few frames late
+    rg::SampleCounter shadedFragments;
+    shadedFragments.create();
+    // objects hidden behind others (by last frame's box queries) are skipped
+    rg::OcclusionCuller occlusion;
+    occlusion.create(occlusionBoxShader);
+    // distant objects are drawn with their simplified levels of detail
+    rg::LodSelector lodSelector;
+    // CPU and GPU time of the passes below, `--trace` records all frames to a Chrome trace
+    rg::Profiler profiler;
+    profiler.create();
+    if (!tracePath.empty())
+        profiler.startTrace(tracePath);
+
+    // cascaded shadow maps of the directional light, cascades are re-rendered only when needed
+    rg::CascadedShadowMap shadowMap;
+    shadowMap.create(2048, rg::kMaxShadowCascades, shadowDepthShader, shadowDepthInstancedShader);
+    rg::UniformBuffer<rg::ShadowsBlock> shadowsBlock(rg::kShadowsBlockBinding);
+
+    // the small point lights of the scene, binned into view space clusters every frame
+    rg::LightClusters lightClusters;
+    lightClusters.create();
+    lightClusters.setLights(scene.description.pointLights);
+    rg::UniformBuffer<rg::ClustersBlock> clustersBlock(rg::kClustersBlockBinding);
+
+    LightBenchmark lightBenchmark;
+    if (lightBench) {
+        // a fixed view over the scene, no input and no vsync so the frame time is the real cost
+        if (window)
+            glfwSwapInterval(0);
+        programState->camera = Camera(glm::vec3(0.0f, 8.0f, 45.0f));
+        programState->CameraMouseMovementUpdateEnabled = false;
+        lightBenchmark.start(lightClusters);
+    }
+    // the light benchmark runs its own steps and keeps its camera, headless or not
+    if (!lightBench && (!window || !benchmarkPath.empty())) {
+        if (window)
+            glfwSwapInterval(0);
+        benchmark.start(window ? 0 : headlessFrames);
+    }
+    // edited shaders are rebuilt while the window runs, benchmarks keep the programs they started with
+    rg::ShaderReloader shaderReloader;
+    if (window && !lightBench && !benchmark.active) {
+        for (const auto &program : meshPrograms)
+            shaderReloader.add(*program.first, program.second);
+        shaderReloader.add(skyboxShader, "skybox");
+        shaderReloader.add(blendingShader, "blending");
+        shaderReloader.add(occlusionBoxShader, "occlusion box");
+        shaderReloader.add(deferredLightingShader, "deferred lighting");
+        shaderReloader.start("resources/shaders");
+    }
+    rg::CameraPath recordedPath;
+    const float recordStart = window ? (float) glfwGetTime() : 0.0f;
+    typedef std::chrono::steady_clock clock;
+    clock::time_point frameStart = clock::now();
+    bool quit = false; // a benchmark is done
+    // the GL calls of the last frame, loading isn't counted
+    rg::GLCallStats glCalls;
+    rg::endGLStatsFrame();
+
     // render loop
-    while (!glfwWindowShouldClose(window)) {
+    while (!quit && !(window && glfwWindowShouldClose(window))) {
         // per-frame time logic
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        if (window) {
+            float currentFrame = glfwGetTime();
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+        }
 
         // input
-        processInput(window);
+        if (window && !lightBenchmark.active)
+            processInput(window);
+        if (benchmark.active) {
+            // fixed steps along the path, however long the frames take
+            deltaTime = benchmark.timeStep();
+            programState->camera = benchmark.camera();
+            benchmark.beginFrame();
+        }
+        if (window && !recordPath.empty()) {
+            float time = lastFrame - recordStart;
+            if (recordedPath.keys.empty() || time - recordedPath.keys.back().time >= rg::kCameraRecordInterval)
+                recordedPath.append(time, programState->camera);
+        }
+
+        // the scopes below are the passes of the profiler tree, read kProfilerFrames frames later
+        profiler.beginFrame();
+        // textures requested after startup finish decoding in the background
+        profiler.push("texture uploads");
+        rg::TextureCache::instance().processUploads();
+        rg::TextureCache::instance().processUploadBytes();
+        profiler.pop();
+        // swaps in the shaders edited since the last frame
+        shaderReloader.update(glState);
+        // the uploads above and last frame's ImGui bound things behind the cache's back
+        glState.beginFrame();
 
         // render
+        profiler.push("frame setup");
+        glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
         glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        const float nearPlane = 0.1f, farPlane = 100.0f;
         glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, nearPlane, farPlane);
         glm::mat4 view = programState->camera.GetViewMatrix();
         glm::mat4 model = glm::mat4(1.0f);
 
-        // don't forget to enable shader before setting uniforms
-        ourShader.use();
-        ourShader.setVec3("viewPosition", programState->camera.Position);
-        ourShader.setFloat("material.shininess", 32.0f);
-
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
+        // per-frame state, one buffer update per block
+        rg::FrameBlock frame = {};
+        frame.projection = projection;
+        frame.view = view;
+        frame.viewPosition = programState->camera.Position;
+        frameBlock.update(frame);
+
+        // the lights of the scene file, minus the ones switched off
+        rg::LightsBlock lights = scene.description.lights;
+        if(!programState->ambientLight)
+            lights.dirLight.ambient = glm::vec3(0.0f);
+        lights.light.position = programState->camera.Position;
+        lights.light.direction = programState->camera.Front;
+        if (!programState->spotlight) {
+            lights.light.diffuse = glm::vec3(0.0f);
+            lights.light.specular = glm::vec3(0.0f);
+        }
+        lightsBlock.update(lights);
 
+        profiler.pop();
 
-        // directional light
-        ourShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-        if(programState->ambientLight)
-            ourShader.setVec3("dirLight.ambient", 0.5f, 0.5f, 0.5f);
-        else
-            ourShader.setVec3("dirLight.ambient", 0.0f, 0.0f, 0.0f);
-        ourShader.setVec3("dirLight.diffuse", 0.05f, 0.05f, 0.05);
-        ourShader.setVec3("dirLight.specular", 0.2f, 0.2f, 0.2f);
-
-        ourShader.setVec3("pointLight.position", lightPos);
-        if(programState->plight){
-            ourShader.setVec3("pointLight.ambient", glm::vec3(1.0f));
-            ourShader.setVec3("pointLight.diffuse", 0.1f, 0.1f, 0.1);
-            ourShader.setVec3("pointLight.specular", 0.5f, 0.5f, 0.5f);
-        }
-        else{
-            ourShader.setVec3("pointLight.ambient", glm::vec3(0.0f));
-            ourShader.setVec3("pointLight.diffuse", 0.0f, 0.0f, 0.0f);
-            ourShader.setVec3("pointLight.specular", 0.0f, 0.0f, 0.0f);
-        }
-        ourShader.setFloat("pointLight.constant", 1.0f);
-        ourShader.setFloat("pointLight.linear", 0.09f);
-        ourShader.setFloat("pointLight.quadratic", 0.032f);
-
-
-        ourShader.setVec3("light.position", programState->camera.Position);
-        ourShader.setVec3("light.direction", programState->camera.Front);
-        ourShader.setVec3("light.ambient", 0.0f, 0.0f, 0.0f);
-        if (programState->spotlight) {
-            ourShader.setVec3("light.diffuse", 1.0f, 1.0f, 1.0f);
-            ourShader.setVec3("light.specular", glm::vec3(0.5f));
+        // many point lights: each cluster gets the list of lights reaching into it
+        profiler.push("light clusters");
+        rg::ClustersBlock clusters = rg::ClustersBlock();
+        if (programState->clusteredLights) {
+            lightClusters.update(view, glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT,
+                                 nearPlane, farPlane, SCR_WIDTH, SCR_HEIGHT);
+            clusters = lightClusters.block();
+        }
+        clustersBlock.update(clusters);
+        lightClusters.bind(glState);
+        profiler.pop();
+        if (lightBenchmark.active && lightBenchmark.frame(deltaTime, lightClusters.stats(), lightClusters))
+            quit = true;
+
+        profiler.push("scene update");
+        sceneUpdated = scene.graph.update();
+        if (sceneUpdated) {
+            scene.graph.collectDrawable(drawableNodes, sceneBounds);
+            sceneBVH.build(sceneBounds);
+        }
+        profiler.pop();
+
+        // shadow cascades, up to the far plane
+        profiler.push("shadows");
+        if (programState->shadows) {
+            shadowMap.fit(view, glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT,
+                          nearPlane, farPlane, lights.dirLight.direction, sceneUpdated != 0);
+            shadowMap.render(scene, sceneBVH, drawableNodes, glState);
+            glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
+            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
         } else {
-            ourShader.setVec3("light.diffuse", 0.0f, 0.0f, 0.0f);
-            ourShader.setVec3("light.specular", 0.0f, 0.0f, 0.0f);
-        }
-        ourShader.setFloat("light.constant", 0.6f);
-        ourShader.setFloat("light.linear", 0.9f);
-        ourShader.setFloat("light.quadratic", 0.032f);
-        ourShader.setFloat("light.cutOff", glm::cos(glm::radians(15.0f)));
-        ourShader.setFloat("light.outerCutOff", glm::cos(glm::radians(30.0f)));
-
-
-        // Jars
-        for(int i = 0;i < 7; i++){
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(-13.0f - 3.5f * i,0.0f,-18.0f + 1.2f * i));
-            model = glm::scale(model, glm::vec3(0.05f));
-            model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-            ourShader.setMat4("model", model);
-            Jar.Draw(ourShader);
-
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(-13.0f - 3.5f * i,0.0f,18.0f - 1.2f * i));
-            model = glm::scale(model, glm::vec3(0.05f));
-            model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-            ourShader.setMat4("model", model);
-            Jar.Draw(ourShader);
-        }
-
-        // Stone Gate
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f,-20.0f));
-        model = glm::scale(model, glm::vec3(2.0f));
-        model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1, 0, 0));
-        ourShader.setMat4("model", model);
-        StoneGate.Draw(ourShader);
-
-        // Stone Gate 2
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f,20.0f));
-        model = glm::scale(model, glm::vec3(2.0f));
-        model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1, 0, 0));
-        ourShader.setMat4("model", model);
-        StoneGate.Draw(ourShader);
-
-        // Temple
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(20.0f, 0.0f,0.0f));
-        model = glm::scale(model, glm::vec3(18.0f));
-        model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1, 0, 0));
-        ourShader.setMat4("model", model);
-        Temple.Draw(ourShader);
-
-        // Well
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0, 0.0,0.0));
-        model = glm::scale(model, glm::vec3(0.04f));
-        model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1, 0, 0));
-        ourShader.setMat4("model", model);
-        Well.Draw(ourShader);
-
-        // Lantern
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-13.0f, 0.0f,00.0f));
-        model = glm::scale(model, glm::vec3(11.0f));
-        model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1, 0, 0));
-        ourShader.setMat4("model", model);
-        Lantern.Draw(ourShader);
+            // whatever moves while they are off isn't in the cached cascades
+            shadowMap.invalidate();
+        }
+        shadowsBlock.update(shadowMap.block(programState->shadows));
+        glState.bindTexture(rg::kShadowMapUnit, GL_TEXTURE_2D_ARRAY, shadowMap.texture());
+        profiler.pop();
+
+        // models go through the render queue, sorted by program/material/VAO, then front to back
+        // only what the BVH finds inside the frustum is submitted
+        profiler.push("culling");
+        rg::Frustum frustum(projection * view);
+        renderQueue.setView(programState->camera.Position, programState->camera.Front, farPlane);
+        occlusion.enabled = programState->occlusionCulling;
+        occlusion.beginFrame(scene.graph.size(), programState->camera.Position);
+        lodSelector.enabled = programState->levelsOfDetail;
+        lodSelector.bias = programState->lodBias;
+        lodSelector.beginFrame(scene.graph.size(), programState->camera.Position, projection, SCR_HEIGHT);
+        visibleObjects.clear();
+        for (rg::InstanceBatch &batch : scene.batches)
+            for (vector<glm::mat4> &visible : batch.visible)
+                visible.clear();
+        cullStats = rg::CullStats();
+        cullStats.objects = drawableNodes.size();
+        cullStats.tests = sceneBVH.query(frustum, visibleObjects);
+        cullStats.objectsVisible = visibleObjects.size();
+        for (uint32_t index : visibleObjects) {
+            uint32_t node = drawableNodes[index];
+            if (!occlusion.visible(node, scene.graph.bounds(node)))
+                continue;
+            unsigned int lod = lodSelector.select(node, scene.graph.bounds(node));
+            if (scene.graph.flags(node) & rg::SceneGraph::kInstanced) {
+                scene.batch(node).visible[lod].push_back(scene.graph.world(node));
+                continue;
+            }
+            // the object's box is visible, its meshes may still be outside
+            Model &nodeModel = *scene.graph.model(node);
+            for (size_t i = 0; i < nodeModel.meshes.size(); ++i) {
+                cullStats.meshes++;
+                if (frustum.visible(scene.graph.meshBounds(node, i)))
+                    renderQueue.submitOpaque(opaquePrograms, nodeModel.meshes[i], scene.graph.world(node), lod);
+                else
+                    cullStats.meshesCulled++;
+            }
+        }
+        // one instanced draw per mesh and level of detail for each model with instanced nodes
+        for (rg::InstanceBatch &batch : scene.batches) {
+            for (unsigned int lod = 0; lod < rg::kMaxLodLevels; ++lod) {
+                batch.buffers[lod].upload(batch.visible[lod]);
+                renderQueue.submitOpaqueInstanced(opaquePrograms, *batch.model, batch.buffers[lod], lod);
+            }
+        }
+        profiler.pop();
+
+        profiler.push("opaque");
+        if (deferred)
+            gbuffer.begin();
+        // opaque meshes depth only first, then shaded once per pixel
+        renderQueue.resetStats();
+        if (programState->depthPrepass) {
+            rg::ProfileScope scope(profiler, "depth pre-pass");
+            renderQueue.depthPrepass(glState, depthPrepassShader, depthPrepassModel, depthPrepassInstancedShader);
+        }
+        shadedFragments.begin();
+        profiler.push("models");
+        renderQueue.flush(glState, programState->depthPrepass);
+        profiler.pop();
 
+        // the passes below have their own GL state, they still bind through the state cache
         // plain
+        profiler.push("plane");
         glDisable(GL_CULL_FACE);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseMap);
+        glState.useProgram(opaquePrograms.opaque->ID);
+        glState.setSampler(planeSampler.location(), 0);
+        glState.bindTexture(0, GL_TEXTURE_2D, rg::TextureCache::instance().resolve(diffuseMap));
 
         model = glm::mat4(1.0f);
-        ourShader.setMat4("model", model);
-        glBindVertexArray(plainVAO);
+        modelUniform.set(model);
+        normalMatrixUniform.set(rg::normalMatrix(model));
+        glState.bindVertexArray(plainVAO);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glState.countDraw(1, 2);
         glEnable(GL_CULL_FACE);
+        profiler.pop();
+        shadedFragments.end();
+        profiler.pop();
+        // boxes of everything in the frustum against the finished opaque depth, read next frames
+        profiler.push("occlusion queries");
+        occlusion.issueQueries(glState);
+        profiler.pop();
+
+        // deferred lighting, once per pixel; the G-buffer depth then goes to the window,
+        // the passes below are forward and test against it
+        if (deferred) {
+            rg::ProfileScope scope(profiler, "deferred lighting");
+            glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
+            glDisable(GL_DEPTH_TEST);
+            glState.useProgram(deferredLightingShader.ID);
+            inverseViewProjection.set(glm::inverse(projection * view));
+            glState.bindTexture(rg::kGBufferAlbedoUnit, GL_TEXTURE_2D, gbuffer.albedoSpecular());
+            glState.bindTexture(rg::kGBufferNormalUnit, GL_TEXTURE_2D, gbuffer.normal());
+            glState.bindTexture(rg::kGBufferDepthUnit, GL_TEXTURE_2D, gbuffer.depth());
+            glState.bindVertexArray(fullscreenVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glState.countDraw(1, 1);
+            glEnable(GL_DEPTH_TEST);
+            gbuffer.blitDepth(mainFramebuffer);
+        }
 
         // vegetation
-        blendingShader.use();
-        glBindVertexArray(transparentVAO);
-        glBindTexture(GL_TEXTURE_2D, transparentTexture);
-        for (unsigned int i = 0; i < vegetation.size(); i++)
-        {
-            model = glm::mat4(1.0f);
-            model = glm::scale(model, glm::vec3(10.0f));
-            model = glm::translate(model, vegetation[i]);
-            ourShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        }
+        profiler.push("vegetation");
+        glState.useProgram(blendingShader.ID);
+        glState.setSampler(vegetationSampler.location(), 0);
+        glState.bindVertexArray(transparentVAO);
+        glState.bindTexture(0, GL_TEXTURE_2D, rg::TextureCache::instance().resolve(transparentTexture));
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, vegetationInstances.count());
+        glState.countDraw(vegetationInstances.count(), 2);
+        profiler.pop();
 
         //skybox
-        skyboxShader.use();
-        skyboxShader.setInt("skybox", 0);
+        profiler.push("skybox");
+        glState.useProgram(skyboxShader.ID);
+        glState.setSampler(skyboxSampler.location(), 0);
 
         glDepthMask(GL_FALSE);
         glDepthFunc(GL_LEQUAL);
 
-        view = glm::mat4(glm::mat3(programState->camera.GetViewMatrix()));
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
 
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTexture);
+        glState.bindVertexArray(skyboxVAO);
+        glState.bindTexture(0, GL_TEXTURE_CUBE_MAP, cubeMapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+        glState.countDraw(1, 12);
         glDepthMask(GL_TRUE);
         glDepthFunc(GL_LESS);
+        profiler.pop();
 
 
-        if (programState->ImGuiEnabled)
-            DrawImGui(programState);
+        if (window && programState->ImGuiEnabled) {
+            rg::ProfileScope scope(profiler, "ImGui");
+            DrawImGui(programState, glState.stats(), cullStats, scene.graph.size(), sceneUpdated,
+                      shadowMap.stats(), lightClusters.stats(), deferred ? gbuffer.bytes() : 0, renderQueue.stats(),
+                      shadedFragments.samples(), occlusion.stats(), lodSelector.stats(), profiler,
+                      glCalls);
+        }
+        profiler.endFrame();
+        glCalls = rg::endGLStatsFrame();
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (benchmark.active) {
+            benchmark.endFrame(glState.stats(), glCalls);
+            quit = benchmark.finished;
+        }
+        if (window) {
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        } else {
+            // nothing waits for a swap, finish the frame so its time is the whole cost
+            glFinish();
+            clock::time_point frameEnd = clock::now();
+            deltaTime = std::chrono::duration<float>(frameEnd - frameStart).count();
+            frameStart = frameEnd;
+        }
     }
-
+    if (benchmark.active) {
+        benchmark.recorder.finish();
+        rg::BenchmarkInfo info;
+        info.scene = scenePath;
+        info.path = benchmark.pathName;
+        info.renderer = rg::HeadlessContext::renderer();
+        info.width = SCR_WIDTH;
+        info.height = SCR_HEIGHT;
+        info.timeStep = benchmark.timeStep();
+        info.checksum = window ? 0 : headlessContext.checksum();
+        benchmark.recorder.print(info);
+        if (!benchmarkOut.empty())
+            benchmark.recorder.write(benchmarkOut, info);
+        benchmark.recorder.release();
+    }
+    profiler.finishTrace();
+    profiler.release();
+    if (!recordPath.empty() && recordedPath.save(recordPath))
+        std::cout << "recorded " << recordedPath.keys.size() << " camera keyframes to " << recordPath << std::endl;
+
+    rg::TextureCache::instance().setThreadPool(nullptr);
+    rg::TextureCache::instance().release();
+    frameBlock.release();
+    scene.release();
+    vegetationInstances.release();
+    lightsBlock.release();
+    shadowsBlock.release();
+    shadowMap.release();
+    clustersBlock.release();
+    lightClusters.release();
+    gbuffer.release();
+    glDeleteVertexArrays(1, &fullscreenVAO);
+    shadedFragments.release();
+    occlusion.release();
     glDeleteVertexArrays(1, &skyboxVAO);
     glDeleteBuffers(1, &skyboxVAO);
 
+    return Shutdown(window, headlessContext, 0);
+}
+
+// saves the program state, then closes ImGui and GLFW, or the headless context when there is no window.
+// Returns `exitCode`.
+int Shutdown(GLFWwindow *window, rg::HeadlessContext &headlessContext, int exitCode) {
+    if (!window) {
+        delete programState;
+        headlessContext.release();
+        return exitCode;
+    }
     programState->SaveToFile("resources/program_state.txt");
     delete programState;
     ImGui_ImplOpenGL3_Shutdown();
@@ -555,7 +1072,7 @@ int main() {
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
-    return 0;
+    return exitCode;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -642,14 +1159,35 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     if(glfwGetKey(window, GLFW_KEY_K)==GLFW_PRESS){
         programState->spotlight = !programState->spotlight;
     }
-    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
-        programState->plight = !programState->plight;
-    }
 
 
 }
 
-void DrawImGui(ProgramState *programState) {
+// the scopes at `depth` from `index` on, with their children, as a tree; returns the index after them
+size_t DrawProfileScopes(const std::vector<rg::ProfileScopeResult> &scopes, size_t index, int depth) {
+    while (index < scopes.size() && scopes[index].depth == depth) {
+        const rg::ProfileScopeResult &scope = scopes[index++];
+        bool leaf = index >= scopes.size() || scopes[index].depth <= depth;
+        ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_DefaultOpen | (leaf ? ImGuiTreeNodeFlags_Leaf : 0);
+        bool open = ImGui::TreeNodeEx(scope.name, flags, "%-18s CPU %7.3f ms   GPU %7.3f ms", scope.name,
+                                      scope.cpuAverageMs, scope.gpuAverageMs);
+        if (open) {
+            index = DrawProfileScopes(scopes, index, depth + 1);
+            ImGui::TreePop();
+        } else {
+            while (index < scopes.size() && scopes[index].depth > depth)
+                index++;
+        }
+    }
+    return index;
+}
+
+void DrawImGui(ProgramState *programState, const rg::RenderStats &renderStats, const rg::CullStats &cullStats,
+               unsigned int sceneNodes, unsigned int sceneUpdated,
+               const std::vector<rg::CascadeStats> &shadowStats, const rg::ClusterStats &clusterStats,
+               size_t gbufferBytes, const rg::OpaqueStats &opaqueStats, uint64_t shadedFragments,
+               const rg::OcclusionStats &occlusionStats, const rg::LodStats &lodStats, rg::Profiler &profiler,
+               const rg::GLCallStats &glCalls) {
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -678,33 +1216,119 @@ void DrawImGui(ProgramState *programState) {
             ImGui::End();
         }
 
+        {
+            ImGui::Begin("Render stats");
+            if (gbufferBytes)
+                ImGui::Text("Renderer: deferred, G-buffer %.1f MB", gbufferBytes / (1024.0 * 1024.0));
+            else
+                ImGui::Text("Renderer: forward");
+            ImGui::Text("Draw calls: %u (%u instances)", renderStats.draws, renderStats.instances);
+            ImGui::Text("Triangles: %u", renderStats.triangles);
+            ImGui::Text("Program switches: %u", renderStats.programSwitches);
+            ImGui::Text("Texture switches: %u", renderStats.textureSwitches);
+            ImGui::Text("VAO switches: %u", renderStats.vaoSwitches);
+            ImGui::Text("Redundant binds skipped: %u", renderStats.redundantSkipped);
+            if (rg::kGLStatsEnabled) {
+                ImGui::Separator();
+                ImGui::Text("GL calls (last frame, as issued to the driver):");
+                ImGui::Text("Draws: %u (%u instances), %llu triangles", glCalls.draws, glCalls.instances,
+                            (unsigned long long) glCalls.triangles);
+                ImGui::Text("Binds: %u programs, %u textures, %u VAOs, %u buffers, %u framebuffers",
+                            glCalls.programBinds, glCalls.textureBinds, glCalls.vaoBinds, glCalls.bufferBinds,
+                            glCalls.framebufferBinds);
+                ImGui::Text("Uniforms: %u, state changes: %u, clears: %u, queries: %u", glCalls.uniformCalls,
+                            glCalls.stateChanges, glCalls.clears, glCalls.queries);
+                ImGui::Text("Uploads: %u buffers (%.1f KB), %u textures", glCalls.bufferUploads,
+                            glCalls.bufferUploadBytes / 1024.0, glCalls.textureUploads);
+            }
+            ImGui::Separator();
+            ImGui::Text("Objects: %u drawn, %u culled", cullStats.objectsVisible, cullStats.objects - cullStats.objectsVisible);
+            ImGui::Text("Meshes: %u drawn, %u culled", cullStats.meshes - cullStats.meshesCulled, cullStats.meshesCulled);
+            ImGui::Text("Frustum tests: %u", cullStats.tests);
+            ImGui::Checkbox("Occlusion culling", &programState->occlusionCulling);
+            ImGui::Text("Occluded: %u of %u objects, %u queries issued, %u in flight", occlusionStats.occluded,
+                        occlusionStats.tested, occlusionStats.queries, occlusionStats.inFlight);
+            ImGui::Text("Scene nodes: %u, %u transforms updated", sceneNodes, sceneUpdated);
+            ImGui::Checkbox("Levels of detail", &programState->levelsOfDetail);
+            ImGui::SliderFloat("LOD bias", &programState->lodBias, 0.25f, 4.0f);
+            ImGui::Text("Objects per level: %u / %u / %u / %u, %u switched", lodStats.objects[0], lodStats.objects[1],
+                        lodStats.objects[2], lodStats.objects[3], lodStats.switches);
+            ImGui::Separator();
+            ImGui::Checkbox("Depth pre-pass", &programState->depthPrepass);
+            ImGui::Text("Opaque draws: %u opaque, %u alpha tested, %u in the pre-pass", opaqueStats.opaque,
+                        opaqueStats.alphaTested, opaqueStats.prepassDraws);
+            ImGui::Text("Shaded fragments: %llu (%.2f per pixel)", (unsigned long long) shadedFragments,
+                        (double) shadedFragments / (SCR_WIDTH * SCR_HEIGHT));
+            ImGui::End();
+        }
+
+        {
+            ImGui::Begin("Shadows");
+            ImGui::Checkbox("Cascaded shadows", &programState->shadows);
+            for (size_t i = 0; i < shadowStats.size(); i++) {
+                const rg::CascadeStats &cascade = shadowStats[i];
+                ImGui::Text("Cascade %zu (to %.1f): %s, %u casters, %u draws", i, cascade.splitFar,
+                            cascade.rendered ? "rendered" : "cached", cascade.casters, cascade.draws);
+                ImGui::Text("    CPU %.3f ms, GPU %.3f ms, %u renders", cascade.cpuMs, cascade.gpuMs, cascade.renders);
+            }
+            ImGui::End();
+        }
+
+        {
+            ImGui::Begin("Clustered lights");
+            ImGui::Checkbox("Point lights", &programState->clusteredLights);
+            ImGui::Text("Grid: %d x %d tiles, %d slices", rg::LightClusters::kTilesX, rg::LightClusters::kTilesY,
+                        rg::LightClusters::kSlices);
+            ImGui::Text("Lights: %u, %u in the frustum", clusterStats.lights, clusterStats.visibleLights);
+            ImGui::Text("Clusters: %u occupied, at most %u lights", clusterStats.occupiedClusters,
+                        clusterStats.maxPerCluster);
+            ImGui::Text("Light/cluster pairs: %u", clusterStats.indices);
+            ImGui::Text("Binning: %.3f ms", clusterStats.binMs);
+            ImGui::End();
+        }
+
+        {
+            ImGui::Begin("Profiler");
+            ImGui::Checkbox("Enabled", &profiler.enabled);
+            const std::vector<float> &cpu = profiler.cpuHistory(), &gpu = profiler.gpuHistory();
+            if (!cpu.empty()) {
+                ImGui::PlotLines("CPU ms", cpu.data(), (int) cpu.size(), profiler.historyOffset(), NULL, 0.0f,
+                                 FLT_MAX, ImVec2(0, 60));
+                ImGui::PlotLines("GPU ms", gpu.data(), (int) gpu.size(), profiler.historyOffset(), NULL, 0.0f,
+                                 FLT_MAX, ImVec2(0, 60));
+            }
+            ImGui::Text("Frame %llu, %llu dropped (results not ready in time)",
+                        (unsigned long long) profiler.latest().number, (unsigned long long) profiler.dropped());
+            DrawProfileScopes(profiler.latest().scopes, 0, 0);
+            if (profiler.tracing())
+                ImGui::Text("Tracing: %u frames", profiler.tracedFrames());
+            else if (ImGui::Button("Capture trace (120 frames)"))
+                profiler.startTrace("profile_trace.json", 120);
+            ImGui::End();
+        }
+
     }
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// faces are streamed through the PBO ring like every other texture
 unsigned int loadCubeMap(vector<std::string> faces)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrChannels;
+    rg::TextureStreamer &streamer = rg::TextureCache::instance().streamer();
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
+        rg::ImageData image = rg::decodeImage(faces[i]);
+        if (image.valid())
+            streamer.enqueueCubeFace(textureID, i, std::move(image));
         else
-        {
             std::cout << "CubeMap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
     }
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -713,38 +1337,152 @@ unsigned int loadCubeMap(vector<std::string> faces)
 
     return textureID;
 }
+// decoded on the worker pool and streamed in by the texture cache, the pixels arrive over the next frames
 unsigned int loadTexture(char const * path)
 {
+    return rg::TextureCache::instance().acquire(path);
+}
+// every texture file the scene uses, mapped to whether it is only ever used as a normal map
+std::map<std::string, bool> collectSceneTextures()
+{
+    std::map<std::string, bool> textures;
+    rg::SceneDescription scene;
+    rg::readScene(scenePath, scene);
+    for (const rg::SceneModelRef &model : scene.models)
+    {
+        ModelData data;
+        Model::readMeshes(model.path, data);
+        for (const rg::MeshData &mesh : data.meshes)
+        {
+            for (const rg::TextureRef &ref : mesh.textures)
+            {
+                bool normalMap = ref.type == "texture_normal";
+                auto it = textures.emplace(data.directory + '/' + ref.path, normalMap).first;
+                it->second = it->second && normalMap;
+            }
+        }
+    }
+    for (const std::string &path : sceneTextures)
+        textures[FileSystem::getPath(path)] = false;
+    return textures;
+}
+// compiles the scene file and rebuilds the binary mesh caches of all its models and the block
+// compressed .ktx textures, so the next launch skips parsing, ASSIMP and the image decodes entirely
+int bakeAssets(unsigned int workerThreads)
+{
+    // the baked textures have to match what the decoder produces at runtime
+    stbi_set_flip_vertically_on_load(true);
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    int failed = 0;
+    rg::SceneDescription scene;
+    if (rg::bakeScene(scenePath) && rg::readScene(scenePath, scene))
+        std::cout << "baked " << rg::compiledScenePath(scenePath) << std::endl;
+    else
+        failed++;
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+    rg::ThreadPool pool(workerThreads);
+    vector<std::future<bool>> results;
+    vector<rg::MeshOptimization> optimizations(scene.models.size());
+    for (size_t i = 0; i < scene.models.size(); i++)
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        stbi_image_free(data);
+        const rg::SceneModelRef &model = scene.models[i];
+        rg::MeshOptimization *optimization = &optimizations[i];
+        results.push_back(pool.submit([&model, optimization] { return Model::bakeMeshCache(model.path, optimization); }));
     }
-    else
+
+    for (size_t i = 0; i < results.size(); i++)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        if (results[i].get())
+            std::cout << "baked " << rg::meshCachePath(scene.models[i].path) << std::endl;
+        else
+            failed++;
     }
-    return textureID;
+    // what the import time optimisation did to the vertex shader work of each model
+    printf("vertex cache (FIFO, %u entries), before -> after optimisation:\n", rg::kVertexCacheSize);
+    printf("  %-52s %9s %17s %13s %13s\n", "model", "triangles", "vertices", "ACMR", "ATVR");
+    for (size_t i = 0; i < scene.models.size(); i++)
+    {
+        const rg::MeshOptimization &optimization = optimizations[i];
+        printf("  %-52s %9u %8u->%-8u %5.3f->%-5.3f %5.3f->%-5.3f\n", scene.models[i].path.c_str(),
+               optimization.after.triangles, optimization.before.vertices, optimization.after.vertices,
+               optimization.before.acmr(), optimization.after.acmr(), optimization.atvrBefore(),
+               optimization.after.atvr());
+    }
+
+    std::map<std::string, bool> textures = collectSceneTextures();
+    vector<std::future<bool>> textureResults;
+    for (const auto &texture : textures)
+        textureResults.push_back(pool.submit([&texture] {
+            return rg::bakeCompressedTexture(texture.first, texture.second);
+        }));
+    auto texture = textures.begin();
+    for (size_t i = 0; i < textureResults.size(); i++, ++texture)
+    {
+        if (textureResults[i].get())
+            std::cout << "baked " << rg::compressedTexturePath(texture->first) << std::endl;
+        else
+        {
+            std::cout << "ERROR::TEXTURE_BAKE:: can't bake " << texture->first << std::endl;
+            failed++;
+        }
+    }
+    return failed ? -1 : 0;
+}
+// GPU memory of the vertex and index buffers of every model, in the active vertex layout
+// and as it would be with the float Vertex
+void printVertexMemory(const rg::Scene &scene)
+{
+    const rg::VertexLayout &layout = rg::VertexLayout::active();
+    printf("vertex memory, %s layout (%u bytes per vertex, float Vertex %zu):\n", layout.name.c_str(),
+           layout.vertexSize(), sizeof(Vertex));
+    printf("  %-52s %10s %10s %10s\n", "model", "float MB", "layout MB", "index MB");
+    size_t totalFloat = 0, totalLayout = 0, totalIndex = 0;
+    for (size_t i = 0; i < scene.models.size(); i++)
+    {
+        const Model &model = scene.models[i];
+        printf("  %-52s %10.2f %10.2f %10.2f\n", scene.description.models[i].path.c_str(),
+               model.FloatVertexBytes() / (1024.0 * 1024.0), model.VertexBytes() / (1024.0 * 1024.0),
+               model.IndexBytes() / (1024.0 * 1024.0));
+        totalFloat += model.FloatVertexBytes();
+        totalLayout += model.VertexBytes();
+        totalIndex += model.IndexBytes();
+    }
+    printf("  %-52s %10.2f %10.2f %10.2f\n", "total", totalFloat / (1024.0 * 1024.0),
+           totalLayout / (1024.0 * 1024.0), totalIndex / (1024.0 * 1024.0));
+}
+// compares the GPU memory of every scene texture, decoded with a full mip chain vs. baked,
+// without creating a window
+int printTextureMemory()
+{
+    size_t totalRaw = 0, totalBaked = 0;
+    for (const auto &texture : collectSceneTextures())
+    {
+        const std::string &path = texture.first;
+        int width, height, components;
+        if (!stbi_info(path.c_str(), &width, &height, &components))
+        {
+            std::cout << "ERROR::TEXTURE_MEMORY:: can't read " << path << std::endl;
+            continue;
+        }
+        size_t raw = 0;
+        for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2))
+        {
+            raw += (size_t)w * h * components;
+            if (w == 1 && h == 1)
+                break;
+        }
+        rg::CompressedTexture baked;
+        bool isBaked = rg::readKtx(rg::compressedTexturePath(path), rg::hashFile(path), baked);
+        // textures that aren't baked are uploaded decoded
+        size_t bytes = isBaked ? baked.bytes() : raw;
+        totalRaw += raw;
+        totalBaked += bytes;
+        printf("%8.2f MB -> %8.2f MB  %-3s %s\n", raw / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0),
+               isBaked ? rg::blockFormatName(baked.internalFormat) : "-", path.c_str());
+    }
+    printf("total %.2f MB decoded, %.2f MB with the baked textures (%.1fx)\n", totalRaw / (1024.0 * 1024.0),
+           totalBaked / (1024.0 * 1024.0), totalBaked ? (double)totalRaw / totalBaked : 0.0);
+    return 0;
 }
 int randRange(int low,int high){
     return rand()%(high-low) + low;